@@ -0,0 +1,442 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__AVX__) || defined(__AVX2__)
+#include <immintrin.h>
+#define BLADE_KERNEL_AVX 1
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BLADE_KERNEL_SSE 1
+#endif
+
+#include "BladeKernel.h"
+
+namespace {
+    // Keep in sync with the defines at the top of shaders/blades.glsl
+    constexpr bool USE_FORCES = true;
+    constexpr bool USE_CULLING = true;
+    constexpr bool USE_ORIENTATION_CULLING = true;
+    constexpr bool USE_VIEW_FRUSTUM_CULLING = true;
+    constexpr bool USE_DISTANCE_CULLING = true;
+    // Keep in sync with shaders/blade_lod.glsl
+    constexpr bool USE_SUBPIXEL_CULLING = true;
+    constexpr float MIN_BLADE_PIXELS = 3.0f;
+    constexpr float MIN_BLADE_HEIGHT_PIXELS = 2.0f;
+
+    constexpr float WIND_STRENGTH = 5.0f;
+    constexpr float WIND_FREQUENCY = 1.0f;
+    constexpr float WIND_TURBULENCE = 6.5f;
+    constexpr float CULLING_DISTANCE = 30.0f;
+
+    // --- 8-wide float vector ---
+    // Comparisons return masks with all bits set in the lanes where they hold, like the SSE/AVX compares
+
+#if defined(BLADE_KERNEL_AVX)
+    struct Float8 {
+        __m256 v;
+        Float8() {}
+        Float8(__m256 v) : v(v) {}
+        Float8(float s) : v(_mm256_set1_ps(s)) {}
+        static Float8 Load(const float* p) { return _mm256_load_ps(p); }
+        void Store(float* p) const { _mm256_store_ps(p, v); }
+    };
+
+    inline Float8 operator+(Float8 a, Float8 b) { return _mm256_add_ps(a.v, b.v); }
+    inline Float8 operator-(Float8 a, Float8 b) { return _mm256_sub_ps(a.v, b.v); }
+    inline Float8 operator*(Float8 a, Float8 b) { return _mm256_mul_ps(a.v, b.v); }
+    inline Float8 operator/(Float8 a, Float8 b) { return _mm256_div_ps(a.v, b.v); }
+    inline Float8 Min(Float8 a, Float8 b) { return _mm256_min_ps(a.v, b.v); }
+    inline Float8 Max(Float8 a, Float8 b) { return _mm256_max_ps(a.v, b.v); }
+    inline Float8 Sqrt(Float8 a) { return _mm256_sqrt_ps(a.v); }
+    inline Float8 Abs(Float8 a) { return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v); }
+    inline Float8 Floor(Float8 a) { return _mm256_floor_ps(a.v); }
+    inline Float8 Greater(Float8 a, Float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+    inline Float8 GreaterEqual(Float8 a, Float8 b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+    inline Float8 And(Float8 a, Float8 b) { return _mm256_and_ps(a.v, b.v); }
+    inline Float8 Or(Float8 a, Float8 b) { return _mm256_or_ps(a.v, b.v); }
+    inline Float8 AndNot(Float8 a, Float8 b) { return _mm256_andnot_ps(a.v, b.v); }
+    inline int MoveMask(Float8 a) { return _mm256_movemask_ps(a.v); }
+
+#elif defined(BLADE_KERNEL_SSE)
+    // Two SSE registers so that the kernel still handles 8 blades per iteration
+    struct Float8 {
+        __m128 lo, hi;
+        Float8() {}
+        Float8(__m128 lo, __m128 hi) : lo(lo), hi(hi) {}
+        Float8(float s) : lo(_mm_set1_ps(s)), hi(_mm_set1_ps(s)) {}
+        static Float8 Load(const float* p) { return Float8(_mm_load_ps(p), _mm_load_ps(p + 4)); }
+        void Store(float* p) const { _mm_store_ps(p, lo); _mm_store_ps(p + 4, hi); }
+    };
+
+    inline Float8 operator+(Float8 a, Float8 b) { return Float8(_mm_add_ps(a.lo, b.lo), _mm_add_ps(a.hi, b.hi)); }
+    inline Float8 operator-(Float8 a, Float8 b) { return Float8(_mm_sub_ps(a.lo, b.lo), _mm_sub_ps(a.hi, b.hi)); }
+    inline Float8 operator*(Float8 a, Float8 b) { return Float8(_mm_mul_ps(a.lo, b.lo), _mm_mul_ps(a.hi, b.hi)); }
+    inline Float8 operator/(Float8 a, Float8 b) { return Float8(_mm_div_ps(a.lo, b.lo), _mm_div_ps(a.hi, b.hi)); }
+    inline Float8 Min(Float8 a, Float8 b) { return Float8(_mm_min_ps(a.lo, b.lo), _mm_min_ps(a.hi, b.hi)); }
+    inline Float8 Max(Float8 a, Float8 b) { return Float8(_mm_max_ps(a.lo, b.lo), _mm_max_ps(a.hi, b.hi)); }
+    inline Float8 Sqrt(Float8 a) { return Float8(_mm_sqrt_ps(a.lo), _mm_sqrt_ps(a.hi)); }
+    inline Float8 Abs(Float8 a) {
+        __m128 sign = _mm_set1_ps(-0.0f);
+        return Float8(_mm_andnot_ps(sign, a.lo), _mm_andnot_ps(sign, a.hi));
+    }
+    inline __m128 Floor4(__m128 a) {
+        // SSE2 has no floor, so truncate and step down where truncation rounded up
+        __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a));
+        return _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, a), _mm_set1_ps(1.0f)));
+    }
+    inline Float8 Floor(Float8 a) { return Float8(Floor4(a.lo), Floor4(a.hi)); }
+    inline Float8 Greater(Float8 a, Float8 b) { return Float8(_mm_cmpgt_ps(a.lo, b.lo), _mm_cmpgt_ps(a.hi, b.hi)); }
+    inline Float8 GreaterEqual(Float8 a, Float8 b) { return Float8(_mm_cmpge_ps(a.lo, b.lo), _mm_cmpge_ps(a.hi, b.hi)); }
+    inline Float8 And(Float8 a, Float8 b) { return Float8(_mm_and_ps(a.lo, b.lo), _mm_and_ps(a.hi, b.hi)); }
+    inline Float8 Or(Float8 a, Float8 b) { return Float8(_mm_or_ps(a.lo, b.lo), _mm_or_ps(a.hi, b.hi)); }
+    inline Float8 AndNot(Float8 a, Float8 b) { return Float8(_mm_andnot_ps(a.lo, b.lo), _mm_andnot_ps(a.hi, b.hi)); }
+    inline int MoveMask(Float8 a) { return _mm_movemask_ps(a.lo) | (_mm_movemask_ps(a.hi) << 4); }
+
+#else
+    // Plain loops for targets without SSE (the compiler may still vectorize these)
+    struct Float8 {
+        float v[8];
+        Float8() {}
+        Float8(float s) { for (int i = 0; i < 8; ++i) v[i] = s; }
+        static Float8 Load(const float* p) { Float8 r; for (int i = 0; i < 8; ++i) r.v[i] = p[i]; return r; }
+        void Store(float* p) const { for (int i = 0; i < 8; ++i) p[i] = v[i]; }
+    };
+
+    template<typename F>
+    inline Float8 Apply(Float8 a, Float8 b, F f) { Float8 r; for (int i = 0; i < 8; ++i) r.v[i] = f(a.v[i], b.v[i]); return r; }
+    inline float MaskOf(bool b) { uint32_t bits = b ? 0xFFFFFFFFu : 0u; float f; memcpy(&f, &bits, sizeof(f)); return f; }
+    inline uint32_t BitsOf(float f) { uint32_t bits; memcpy(&bits, &f, sizeof(f)); return bits; }
+    inline float FloatOf(uint32_t bits) { float f; memcpy(&f, &bits, sizeof(f)); return f; }
+
+    inline Float8 operator+(Float8 a, Float8 b) { return Apply(a, b, [](float x, float y) { return x + y; }); }
+    inline Float8 operator-(Float8 a, Float8 b) { return Apply(a, b, [](float x, float y) { return x - y; }); }
+    inline Float8 operator*(Float8 a, Float8 b) { return Apply(a, b, [](float x, float y) { return x * y; }); }
+    inline Float8 operator/(Float8 a, Float8 b) { return Apply(a, b, [](float x, float y) { return x / y; }); }
+    inline Float8 Min(Float8 a, Float8 b) { return Apply(a, b, [](float x, float y) { return y < x ? y : x; }); }
+    inline Float8 Max(Float8 a, Float8 b) { return Apply(a, b, [](float x, float y) { return y > x ? y : x; }); }
+    inline Float8 Sqrt(Float8 a) { return Apply(a, a, [](float x, float) { return std::sqrt(x); }); }
+    inline Float8 Abs(Float8 a) { return Apply(a, a, [](float x, float) { return std::fabs(x); }); }
+    inline Float8 Floor(Float8 a) { return Apply(a, a, [](float x, float) { return std::floor(x); }); }
+    inline Float8 Greater(Float8 a, Float8 b) { return Apply(a, b, [](float x, float y) { return MaskOf(x > y); }); }
+    inline Float8 GreaterEqual(Float8 a, Float8 b) { return Apply(a, b, [](float x, float y) { return MaskOf(x >= y); }); }
+    inline Float8 And(Float8 a, Float8 b) { return Apply(a, b, [](float x, float y) { return FloatOf(BitsOf(x) & BitsOf(y)); }); }
+    inline Float8 Or(Float8 a, Float8 b) { return Apply(a, b, [](float x, float y) { return FloatOf(BitsOf(x) | BitsOf(y)); }); }
+    inline Float8 AndNot(Float8 a, Float8 b) { return Apply(a, b, [](float x, float y) { return FloatOf(~BitsOf(x) & BitsOf(y)); }); }
+    inline int MoveMask(Float8 a) { int m = 0; for (int i = 0; i < 8; ++i) m |= (BitsOf(a.v[i]) >> 31) << i; return m; }
+#endif
+
+    // Transcendentals are evaluated per lane with the C library so the reference stays exact
+    template<typename F>
+    inline Float8 PerLane(Float8 a, F f) {
+        alignas(32) float lanes[8];
+        a.Store(lanes);
+        for (int i = 0; i < 8; ++i) {
+            lanes[i] = f(lanes[i]);
+        }
+        return Float8::Load(lanes);
+    }
+
+    // --- 8-wide vec3 ---
+
+    struct Vec3x8 {
+        Float8 x, y, z;
+        Vec3x8() {}
+        Vec3x8(Float8 x, Float8 y, Float8 z) : x(x), y(y), z(z) {}
+        Vec3x8(const glm::vec3& v) : x(v.x), y(v.y), z(v.z) {}
+    };
+
+    inline Vec3x8 operator+(const Vec3x8& a, const Vec3x8& b) { return Vec3x8(a.x + b.x, a.y + b.y, a.z + b.z); }
+    inline Vec3x8 operator-(const Vec3x8& a, const Vec3x8& b) { return Vec3x8(a.x - b.x, a.y - b.y, a.z - b.z); }
+    inline Vec3x8 operator*(const Vec3x8& a, Float8 s) { return Vec3x8(a.x * s, a.y * s, a.z * s); }
+    inline Float8 Dot(const Vec3x8& a, const Vec3x8& b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+    inline Vec3x8 Cross(const Vec3x8& a, const Vec3x8& b) {
+        return Vec3x8(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+    }
+    inline Float8 Length(const Vec3x8& a) { return Sqrt(Dot(a, a)); }
+    inline Vec3x8 Normalize(const Vec3x8& a) { return a * (Float8(1.0f) / Length(a)); }
+    inline Float8 Distance(const Vec3x8& a, const Vec3x8& b) { return Length(a - b); }
+
+    // Transform (p, w) by a column-major matrix and return xyz or the full clip position
+    inline Vec3x8 TransformXYZ(const glm::mat4& m, const Vec3x8& p, float w) {
+        return Vec3x8(
+            Float8(m[0][0]) * p.x + Float8(m[1][0]) * p.y + Float8(m[2][0]) * p.z + Float8(m[3][0] * w),
+            Float8(m[0][1]) * p.x + Float8(m[1][1]) * p.y + Float8(m[2][1]) * p.z + Float8(m[3][1] * w),
+            Float8(m[0][2]) * p.x + Float8(m[1][2]) * p.y + Float8(m[2][2]) * p.z + Float8(m[3][2] * w));
+    }
+
+    inline Float8 TransformW(const glm::mat4& m, const Vec3x8& p) {
+        return Float8(m[0][3]) * p.x + Float8(m[1][3]) * p.y + Float8(m[2][3]) * p.z + Float8(m[3][3]);
+    }
+
+    // --- Structure-of-arrays view of 8 blades ---
+
+    struct BladeLanes {
+        // v0, v1, v2, up, each as xyzw rows of 8 lanes
+        alignas(32) float data[16][8];
+
+        void Gather(const Blade* blades, size_t count) {
+            for (size_t lane = 0; lane < BladeKernel::LANE_COUNT; ++lane) {
+                // Replicate the last blade into unused lanes so they never produce NaNs
+                const Blade& blade = blades[std::min(lane, count - 1)];
+                const glm::vec4* vectors[] = { &blade.v0, &blade.v1, &blade.v2, &blade.up };
+                for (int v = 0; v < 4; ++v) {
+                    for (int c = 0; c < 4; ++c) {
+                        data[4 * v + c][lane] = (*vectors[v])[c];
+                    }
+                }
+            }
+        }
+
+        Float8 Row(int row) const { return Float8::Load(data[row]); }
+        Vec3x8 Xyz(int vector) const { return Vec3x8(Row(4 * vector + 0), Row(4 * vector + 1), Row(4 * vector + 2)); }
+    };
+
+    Vec3x8 getWindVector(const Vec3x8& v, float totalTime) {
+        float windX = WIND_STRENGTH * std::sin(totalTime * WIND_FREQUENCY);
+        Float8 phase = (v.x * Float8(12.9898f) + v.z * Float8(78.233f)) * Float8(43758.5453f) + Float8(totalTime * WIND_FREQUENCY);
+        Float8 windZ = Float8(WIND_TURBULENCE) * PerLane(phase, [](float x) { return std::sin(x); });
+        return Vec3x8(Float8(windX), Float8(0.2f), windZ);
+    }
+
+    void simulateLanes(BladeLanes& lanes, const Time& time) {
+        Vec3x8 v0 = lanes.Xyz(0);
+        Vec3x8 v1 = lanes.Xyz(1);
+        Vec3x8 v2 = lanes.Xyz(2);
+        Vec3x8 up = lanes.Xyz(3);
+        Float8 orientation = lanes.Row(3);
+        Float8 height = lanes.Row(7);
+        Float8 stiffness = lanes.Row(15);
+
+        Vec3x8 s(PerLane(orientation, [](float o) { return std::cos(o); }), Float8(0.0f), PerLane(orientation, [](float o) { return std::sin(o); }));
+        Vec3x8 f = Normalize(Cross(up, s));
+
+        // Gravity
+        Vec3x8 gE(Float8(0.0f), Float8(-9.8f), Float8(0.0f));
+        Vec3x8 g = gE + f * Float8(0.25f * 9.8f);
+
+        // Recovery
+        Vec3x8 iv2 = v0 + up * height;
+        Vec3x8 r = (iv2 - v2) * stiffness;
+
+        // Wind
+        Vec3x8 wi = getWindVector(v0, time.totalTime);
+        Vec3x8 diff = v2 - v0;
+        Float8 fd = Float8(1.0f) - Abs(Dot(Normalize(wi), Normalize(diff)));
+        Float8 fr = Dot(diff, up) / height;
+        Vec3x8 w = wi * (fd * fr);
+
+        // Move the blade
+        v2 = v2 + (g + r + w) * Float8(time.deltaTime);
+
+        // Validation
+        v2 = v2 - up * Min(Float8(0.0f), Dot(v2 - v0, up));
+        Vec3x8 v2_minus_v0 = v2 - v0;
+        Float8 l_proj = Length(v2_minus_v0 - up * Dot(up, v2_minus_v0));
+        Float8 l_proj_div_height = l_proj / height;
+        Float8 v1_scale = Max(Float8(1.0f) - l_proj_div_height, Float8(0.05f) * Max(l_proj_div_height, Float8(1.0f)));
+        Vec3x8 v1_tmp = v0 + up * (height * v1_scale);
+        Float8 L0 = Distance(v0, v2);
+        Float8 L1 = Distance(v0, v1_tmp) + Distance(v1_tmp, v2);
+        Float8 L = (Float8(2.0f) * L0 + L1) / Float8(3.0f);
+        Float8 ratio = height / Max(L, Float8(0.0001f));
+        v1 = v0 + (v1_tmp - v0) * ratio;
+        v2 = v1 + (v2 - v1_tmp) * ratio;
+
+        v1.x.Store(lanes.data[4]);
+        v1.y.Store(lanes.data[5]);
+        v1.z.Store(lanes.data[6]);
+        v2.x.Store(lanes.data[8]);
+        v2.y.Store(lanes.data[9]);
+        v2.z.Store(lanes.data[10]);
+    }
+
+    inline Float8 Not(Float8 a) {
+        return AndNot(a, GreaterEqual(Float8(0.0f), Float8(0.0f)));
+    }
+
+    inline Float8 inBounds(Float8 value, Float8 bounds) {
+        return And(GreaterEqual(value, Float8(0.0f) - bounds), GreaterEqual(bounds, value));
+    }
+
+    Float8 inFrustum(const glm::mat4& viewProj, const Vec3x8& p) {
+        Vec3x8 clip = TransformXYZ(viewProj, p, 1.0f);
+        Float8 tolerance = TransformW(viewProj, p) + Float8(0.01f);
+        return And(And(inBounds(clip.x, tolerance), inBounds(clip.y, tolerance)), inBounds(clip.z, tolerance));
+    }
+
+    // Same hash as bladeRandom in shaders/blade_lod.glsl
+    inline float bladeRandom(uint32_t bladeIdx) {
+        uint32_t x = bladeIdx;
+        x ^= x >> 16;
+        x *= 0x7feb352du;
+        x ^= x >> 15;
+        x *= 0x846ca68bu;
+        x ^= x >> 16;
+        return static_cast<float>(x >> 8) / 16777216.0f;
+    }
+
+    // Returns a mask with the lanes that survive culling
+    Float8 cullLanes(const BladeLanes& lanes, uint32_t firstIndex, const CameraBufferObject& camera, const glm::vec3& cameraPosition) {
+        Float8 culled(0.0f);
+        if (!USE_CULLING) {
+            return culled;
+        }
+
+        Vec3x8 v0 = lanes.Xyz(0);
+        Vec3x8 v1 = lanes.Xyz(1);
+        Vec3x8 v2 = lanes.Xyz(2);
+        Vec3x8 up = lanes.Xyz(3);
+        Float8 orientation = lanes.Row(3);
+
+        if (USE_ORIENTATION_CULLING) {
+            Vec3x8 s(PerLane(orientation, [](float o) { return std::cos(o); }), Float8(0.0f), PerLane(orientation, [](float o) { return std::sin(o); }));
+            Vec3x8 dir_b = Normalize(TransformXYZ(camera.viewMatrix, s, 0.0f));
+            Vec3x8 dir_c = Normalize(TransformXYZ(camera.viewMatrix, v0, 1.0f));
+            culled = Or(culled, Greater(Abs(Dot(dir_b, dir_c)), Float8(0.9f)));
+        }
+
+        if (USE_VIEW_FRUSTUM_CULLING) {
+            const glm::mat4& viewProj = camera.viewProjectionMatrix;
+            Vec3x8 m = v0 * Float8(0.25f) + v1 * Float8(0.5f) + v2 * Float8(0.25f);
+            Float8 visible = Or(Or(inFrustum(viewProj, v0), inFrustum(viewProj, v2)), inFrustum(viewProj, m));
+            culled = Or(culled, Not(visible));
+        }
+
+        if (USE_DISTANCE_CULLING) {
+            Vec3x8 camera_to_blade = v0 - Vec3x8(cameraPosition);
+            Vec3x8 projected_up = up * Dot(camera_to_blade, up);
+            Float8 distance = Length(camera_to_blade - projected_up);
+            culled = Or(culled, GreaterEqual(distance, Float8(CULLING_DISTANCE)));
+        }
+
+        if (USE_SUBPIXEL_CULLING) {
+            // Pixels per world space unit at the root of each blade
+            Float8 w = Max(TransformW(camera.viewProjectionMatrix, v0), Float8(1e-3f));
+            Float8 pixels = Float8(0.5f * camera.viewport.y * std::fabs(camera.projectionMatrix[1][1])) / w;
+            culled = Or(culled, Greater(Float8(MIN_BLADE_HEIGHT_PIXELS), lanes.Row(7) * pixels));
+
+            alignas(32) float thresholds[8];
+            for (uint32_t lane = 0; lane < 8; ++lane) {
+                thresholds[lane] = bladeRandom(firstIndex + lane) * MIN_BLADE_PIXELS;
+            }
+            culled = Or(culled, GreaterEqual(Float8::Load(thresholds), lanes.Row(11) * pixels));
+        }
+
+        return culled;
+    }
+
+    // The box is outside when its corner furthest along a plane's normal is outside that plane
+    bool tileInPlanes(const BladeTile& tile, const glm::vec4* planes) {
+        for (int i = 0; i < 6; ++i) {
+            const glm::vec4& plane = planes[i];
+            glm::vec3 corner(plane.x >= 0.0f ? tile.boundsMax.x : tile.boundsMin.x,
+                             plane.y >= 0.0f ? tile.boundsMax.y : tile.boundsMin.y,
+                             plane.z >= 0.0f ? tile.boundsMax.z : tile.boundsMin.z);
+            if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Whether the tile has blades within CULLING_DISTANCE of the camera, whichever view draws them
+    bool tileInRange(const BladeTile& tile, const CameraBufferObject& camera) {
+        if (tile.bladeCount == 0) {
+            return false;
+        }
+        if (USE_CULLING && USE_DISTANCE_CULLING) {
+            glm::vec2 c(camera.position.x, camera.position.z);
+            glm::vec2 closest = glm::clamp(c, glm::vec2(tile.boundsMin.x, tile.boundsMin.z), glm::vec2(tile.boundsMax.x, tile.boundsMax.z));
+            return glm::distance(c, closest) < CULLING_DISTANCE;
+        }
+        return true;
+    }
+}
+
+void BladeKernel::Simulate(Blade* blades, size_t count, const Time& time) {
+    if (!USE_FORCES) {
+        return;
+    }
+
+    BladeLanes lanes;
+    for (size_t base = 0; base < count; base += LANE_COUNT) {
+        size_t active = std::min<size_t>(LANE_COUNT, count - base);
+        lanes.Gather(blades + base, active);
+        simulateLanes(lanes, time);
+
+        for (size_t lane = 0; lane < active; ++lane) {
+            Blade& blade = blades[base + lane];
+            blade.v1 = glm::vec4(lanes.data[4][lane], lanes.data[5][lane], lanes.data[6][lane], blade.v1.w);
+            blade.v2 = glm::vec4(lanes.data[8][lane], lanes.data[9][lane], lanes.data[10][lane], blade.v2.w);
+        }
+    }
+}
+
+bool BladeKernel::IsTileVisible(const BladeTile& tile, const CameraBufferObject& camera) {
+    if (!tileInRange(tile, camera)) {
+        return false;
+    }
+    return !(USE_CULLING && USE_VIEW_FRUSTUM_CULLING) || tileInPlanes(tile, camera.frustumPlanes);
+}
+
+bool BladeKernel::IsTileSimulated(const BladeTile& tile, const CameraBufferObject& camera, const ShadowBufferObject& shadow) {
+    if (IsTileVisible(tile, camera)) {
+        return true;
+    }
+    if (!tileInRange(tile, camera)) {
+        return false;
+    }
+    if (!(USE_CULLING && USE_VIEW_FRUSTUM_CULLING)) {
+        return NUM_SHADOW_CASCADES > 0;
+    }
+
+    for (uint32_t cascade = 0; cascade < NUM_SHADOW_CASCADES; ++cascade) {
+        if (tileInPlanes(tile, shadow.frustumPlanes[cascade])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+uint32_t BladeKernel::Cull(const Blade* blades, size_t count, uint32_t firstIndex, const CameraBufferObject& camera, Blade* culledBlades) {
+    glm::vec3 cameraPosition(camera.position);
+
+    uint32_t numCulled = 0;
+    BladeLanes lanes;
+    for (size_t base = 0; base < count; base += LANE_COUNT) {
+        size_t active = std::min<size_t>(LANE_COUNT, count - base);
+        lanes.Gather(blades + base, active);
+        int culledMask = MoveMask(cullLanes(lanes, firstIndex + static_cast<uint32_t>(base), camera, cameraPosition));
+
+        for (size_t lane = 0; lane < active; ++lane) {
+            if (!(culledMask & (1 << lane))) {
+                culledBlades[numCulled++] = blades[base + lane];
+            }
+        }
+    }
+
+    return numCulled;
+}
+
+uint32_t BladeKernel::Step(Blade* blades, size_t count, uint32_t firstIndex, const Time& time, const CameraBufferObject& camera, Blade* culledBlades) {
+    Simulate(blades, count, time);
+    return Cull(blades, count, firstIndex, camera, culledBlades);
+}
+
+BladeKernel::Divergence BladeKernel::Compare(const Blade* reference, const Blade* other, size_t count) {
+    Divergence divergence;
+    for (size_t i = 0; i < count; ++i) {
+        glm::vec3 dv1 = glm::abs(glm::vec3(reference[i].v1) - glm::vec3(other[i].v1));
+        glm::vec3 dv2 = glm::abs(glm::vec3(reference[i].v2) - glm::vec3(other[i].v2));
+        divergence.v1 = glm::max(divergence.v1, dv1);
+        divergence.v2 = glm::max(divergence.v2, dv2);
+
+        float worst = std::max(glm::max(dv1.x, glm::max(dv1.y, dv1.z)), glm::max(dv2.x, glm::max(dv2.y, dv2.z)));
+        if (worst > divergence.worstDifference) {
+            divergence.worstDifference = worst;
+            divergence.worstBlade = i;
+        }
+    }
+    return divergence;
+}
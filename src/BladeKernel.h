@@ -0,0 +1,48 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <cstddef>
+#include <cstdint>
+#include "Blades.h"
+#include "Camera.h"
+#include "Scene.h"
+#include "ShadowCascades.h"
+
+// CPU port of shaders/simulate.comp and shaders/cull.glsl. Blades are processed
+// 8 at a time with AVX (or two SSE registers when AVX is not enabled), so this
+// doubles as the correctness oracle for the compute passes and as the fallback
+// when the device has no usable compute queue.
+namespace BladeKernel {
+
+    // Number of blades processed per SIMD iteration
+    constexpr static unsigned int LANE_COUNT = 8;
+
+    struct Divergence {
+        // Max absolute per-component difference over all compared blades
+        glm::vec3 v1 = glm::vec3(0.0f);
+        glm::vec3 v2 = glm::vec3(0.0f);
+        // Index of the blade with the largest single component difference
+        size_t worstBlade = 0;
+        float worstDifference = 0.0f;
+    };
+
+    // Apply gravity, recovery and wind and validate the length of every blade (in place)
+    void Simulate(Blade* blades, size_t count, const Time& time);
+
+    // Orientation, frustum, distance and sub-pixel cull blades and write the survivors to culledBlades
+    // firstIndex is the global index of blades[0], which seeds the random width threshold of the sub-pixel thinning
+    // Returns the number of blades written
+    uint32_t Cull(const Blade* blades, size_t count, uint32_t firstIndex, const CameraBufferObject& camera, Blade* culledBlades);
+
+    // Camera view test of shaders/tile_cull.comp, false when no blade of the tile can survive Cull
+    bool IsTileVisible(const BladeTile& tile, const CameraBufferObject& camera);
+    // Same dispatch as shaders/tile_cull.comp with occlusion culling off: in range, and seen by the camera or
+    // by a shadow cascade. The GPU simulates exactly these tiles
+    bool IsTileSimulated(const BladeTile& tile, const CameraBufferObject& camera, const ShadowBufferObject& shadow);
+
+    // Simulate followed by Cull, which is what the simulate and cull passes do
+    uint32_t Step(Blade* blades, size_t count, uint32_t firstIndex, const Time& time, const CameraBufferObject& camera, Blade* culledBlades);
+
+    // Compare the control points of two blade arrays of the same length
+    Divergence Compare(const Blade* reference, const Blade* other, size_t count);
+}
@@ -0,0 +1,141 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "BladeSimulator.h"
+#include "BladeKernel.h"
+
+namespace {
+    unsigned int defaultThreadCount() {
+        return std::max(std::thread::hardware_concurrency(), 1u);
+    }
+}
+
+BladeSimulator::BladeSimulator(unsigned int numThreads)
+  : threadPool(numThreads > 0 ? numThreads : defaultThreadCount()) {}
+
+unsigned int BladeSimulator::GetThreadCount() const {
+    return threadPool.GetThreadCount();
+}
+
+BladeDrawIndirect BladeSimulator::Step(std::vector<Blade>& blades, const Time& time, const CameraBufferObject& camera, std::vector<Blade>& culledBlades) {
+    const uint32_t numBlades = static_cast<uint32_t>(blades.size());
+    const uint32_t numTiles = (numBlades + TILE_SIZE - 1) / TILE_SIZE;
+
+    tileCulledBlades.resize(numBlades);
+    tileStarts.resize(numTiles);
+    tileCounts.resize(numTiles);
+
+    // --- Simulate and cull each tile ---
+    threadPool.ParallelFor(numTiles, [&](unsigned int tile) {
+        uint32_t first = tile * TILE_SIZE;
+        uint32_t count = std::min(TILE_SIZE, numBlades - first);
+        tileStarts[tile] = first;
+        tileCounts[tile] = stepTile(blades.data() + first, count, first, time, camera, tileCulledBlades.data() + first);
+    });
+
+    return compact(culledBlades);
+}
+
+BladeDrawIndirect BladeSimulator::Step(std::vector<Blade>& blades, const std::vector<BladeTile>& tiles, const Time& time, const CameraBufferObject& camera, std::vector<Blade>& culledBlades) {
+    const uint32_t numTiles = static_cast<uint32_t>(tiles.size());
+
+    tileCulledBlades.resize(blades.size());
+    tileStarts.resize(numTiles);
+    tileCounts.resize(numTiles);
+
+    // --- Simulate and cull each visible tile ---
+    threadPool.ParallelFor(numTiles, [&](unsigned int tile) {
+        uint32_t first = tiles[tile].firstBlade;
+        tileStarts[tile] = first;
+        tileCounts[tile] = 0;
+        if (BladeKernel::IsTileVisible(tiles[tile], camera)) {
+            tileCounts[tile] = stepTile(blades.data() + first, tiles[tile].bladeCount, first, time, camera, tileCulledBlades.data() + first);
+        }
+    });
+
+    return compact(culledBlades);
+}
+
+uint32_t BladeSimulator::stepTile(Blade* blades, uint32_t count, uint32_t firstIndex, const Time& time, const CameraBufferObject& camera, Blade* culledBlades) {
+    if (time.substeps == 0) {
+        return BladeKernel::Cull(blades, count, firstIndex, camera, culledBlades);
+    }
+
+    // All substeps run while the tile is in cache, the last one together with the culling
+    for (uint32_t substep = 0; substep + 1 < time.substeps; ++substep) {
+        BladeKernel::Simulate(blades, count, time.GetSubstep(substep));
+    }
+    return BladeKernel::Step(blades, count, firstIndex, time.GetSubstep(time.substeps - 1), camera, culledBlades);
+}
+
+BladeDrawIndirect BladeSimulator::compact(std::vector<Blade>& culledBlades) {
+    const uint32_t numTiles = static_cast<uint32_t>(tileCounts.size());
+    tileOffsets.resize(numTiles);
+
+    // --- Exclusive prefix sum of the tile counts ---
+    uint32_t numCulled = 0;
+    for (uint32_t tile = 0; tile < numTiles; ++tile) {
+        tileOffsets[tile] = numCulled;
+        numCulled += tileCounts[tile];
+    }
+
+    // --- Compact ---
+    culledBlades.resize(numCulled);
+    threadPool.ParallelFor(numTiles, [&](unsigned int tile) {
+        if (tileCounts[tile] > 0) {
+            memcpy(culledBlades.data() + tileOffsets[tile], tileCulledBlades.data() + tileStarts[tile], tileCounts[tile] * sizeof(Blade));
+        }
+    });
+
+    BladeDrawIndirect indirectDraw;
+    indirectDraw.vertexCount = numCulled;
+    indirectDraw.instanceCount = 1;
+    indirectDraw.firstVertex = 0;
+    indirectDraw.firstInstance = 0;
+    return indirectDraw;
+}
+
+void BladeSimulator::ReportScaling(const std::vector<Blade>& blades, unsigned int steps, unsigned int maxThreads, const CameraBufferObject& camera) {
+    if (maxThreads == 0) {
+        maxThreads = defaultThreadCount();
+    }
+    steps = std::max(steps, 1u);
+
+    printf("CPU blade simulation: %zu blades, %u steps, tiles of %u blades\n", blades.size(), steps, TILE_SIZE);
+    printf("%8s %12s %16s %9s %11s\n", "threads", "ms/step", "blades/s", "speedup", "efficiency");
+
+    double singleThreadSeconds = 0.0;
+    for (unsigned int numThreads = 1; numThreads <= maxThreads; ++numThreads) {
+        BladeSimulator simulator(numThreads);
+        std::vector<Blade> stepBlades = blades;
+        std::vector<Blade> culledBlades;
+
+        // Every thread count sees the same sequence of time values
+        Time time;
+        time.deltaTime = 1.0f / 60.0f;
+        time.totalTime = 0.0f;
+
+        // Warm up the pool and the scratch buffers before timing
+        simulator.Step(stepBlades, time, camera, culledBlades);
+
+        auto start = std::chrono::high_resolution_clock::now();
+        for (unsigned int i = 0; i < steps; ++i) {
+            time.totalTime += time.deltaTime;
+            simulator.Step(stepBlades, time, camera, culledBlades);
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+
+        if (numThreads == 1) {
+            singleThreadSeconds = seconds;
+        }
+        double speedup = singleThreadSeconds / seconds;
+
+        printf("%8u %12.3f %16.0f %8.2fx %10.0f%%\n",
+            numThreads,
+            seconds * 1000.0 / steps,
+            static_cast<double>(blades.size()) * steps / seconds,
+            speedup,
+            speedup / numThreads * 100.0);
+    }
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include "Blades.h"
+#include "Camera.h"
+#include "Scene.h"
+#include "ThreadPool.h"
+
+// Runs BladeKernel over the blade array in fixed-size tiles spread over a work-stealing
+// thread pool, then compacts the per-tile survivors into one culled list in blade order.
+// The output matches what the compute passes leave in culledBladesBuffer and numBladesBuffer.
+class BladeSimulator {
+public:
+    // 256 blades are 16KB, so a tile and its culled output stay in L1/L2 while it is simulated
+    constexpr static unsigned int TILE_SIZE = 256;
+
+    BladeSimulator() = delete;
+    // numThreads of 0 uses every hardware thread
+    explicit BladeSimulator(unsigned int numThreads);
+
+    unsigned int GetThreadCount() const;
+
+    // Simulate and cull blades in place, culledBlades is resized to hold the survivors.
+    // Each tile runs all of time.substeps before it is culled
+    BladeDrawIndirect Step(std::vector<Blade>& blades, const Time& time, const CameraBufferObject& camera, std::vector<Blade>& culledBlades);
+
+    // Same as above with the tiles of Blades as the units of work.
+    // Tiles that fail BladeKernel::IsTileVisible are neither simulated nor culled, like on the GPU
+    BladeDrawIndirect Step(std::vector<Blade>& blades, const std::vector<BladeTile>& tiles, const Time& time, const CameraBufferObject& camera, std::vector<Blade>& culledBlades);
+
+    // Time steps of the blades with 1 to maxThreads threads and print the throughput of each
+    static void ReportScaling(const std::vector<Blade>& blades, unsigned int steps, unsigned int maxThreads, const CameraBufferObject& camera);
+
+private:
+    // Run the substeps of one tile then cull it, returns the number of survivors
+    static uint32_t stepTile(Blade* blades, uint32_t count, uint32_t firstIndex, const Time& time, const CameraBufferObject& camera, Blade* culledBlades);
+
+    // Pack the tileCounts[i] survivors written at tileStarts[i] of tileCulledBlades
+    BladeDrawIndirect compact(std::vector<Blade>& culledBlades);
+
+    ThreadPool threadPool;
+
+    // Survivors of each tile are written at the tile's own offset first, then packed
+    std::vector<Blade> tileCulledBlades;
+    std::vector<uint32_t> tileStarts;
+    std::vector<uint32_t> tileCounts;
+    std::vector<uint32_t> tileOffsets;
+};
@@ -1,3 +1,5 @@
+#include <algorithm>
+#include <limits>
 #include <vector>
 #include "Blades.h"
 #include "BufferUtils.h"
@@ -6,11 +8,11 @@ float generateRandomFloat() {
     return rand() / (float)RAND_MAX;
 }
 
-Blades::Blades(Device* device, VkCommandPool commandPool, float planeDim) : Model(device, commandPool, {}, {}) {
+std::vector<Blade> Blades::Generate(float planeDim, unsigned int count) {
     std::vector<Blade> blades;
-    blades.reserve(NUM_BLADES);
+    blades.reserve(count);
 
-    for (int i = 0; i < NUM_BLADES; i++) {
+    for (unsigned int i = 0; i < count; i++) {
         Blade currentBlade = Blade();
 
         glm::vec3 bladeUp(0.0f, 1.0f, 0.0f);
@@ -38,34 +40,572 @@ Blades::Blades(Device* device, VkCommandPool commandPool, float planeDim) : Mode
         blades.push_back(currentBlade);
     }
 
-    BladeDrawIndirect indirectDraw;
-    indirectDraw.vertexCount = NUM_BLADES;
-    indirectDraw.instanceCount = 1;
-    indirectDraw.firstVertex = 0;
-    indirectDraw.firstInstance = 0;
+    return blades;
+}
+
+namespace {
+    // Hash of a world tile, seeds everything generated for it
+    uint32_t tileSeed(const glm::ivec2& tile) {
+        uint32_t h = static_cast<uint32_t>(tile.x) * 0x8da6b343u ^ static_cast<uint32_t>(tile.y) * 0xd8163841u;
+        h ^= h >> 16;
+        h *= 0x7feb352du;
+        h ^= h >> 15;
+        h *= 0x846ca68bu;
+        h ^= h >> 16;
+        return h;
+    }
+
+    // Next value in [0, 1] of a generator seeded with tileSeed
+    float nextTileRandom(uint32_t& state) {
+        state = state * 747796405u + 2891336453u;
+        uint32_t word = ((state >> ((state >> 28u) + 4u)) ^ state) * 277803737u;
+        return static_cast<float>((word >> 22u) ^ word) / 4294967295.0f;
+    }
+
+    // Remainder of value by divisor, also for negative values
+    int positiveModulo(int value, int divisor) {
+        int remainder = value % divisor;
+        return remainder < 0 ? remainder + divisor : remainder;
+    }
+
+    unsigned int slotOf(const glm::ivec2& tile) {
+        return static_cast<unsigned int>(positiveModulo(tile.y, TILE_GRID_DIM) * TILE_GRID_DIM + positiveModulo(tile.x, TILE_GRID_DIM));
+    }
+
+    // World tile of a slot for a ring starting at origin
+    glm::ivec2 ringTile(const glm::ivec2& origin, uint32_t slot) {
+        glm::ivec2 cell(slot % TILE_GRID_DIM, slot / TILE_GRID_DIM);
+        return glm::ivec2(origin.x + positiveModulo(cell.x - origin.x, TILE_GRID_DIM),
+                          origin.y + positiveModulo(cell.y - origin.y, TILE_GRID_DIM));
+    }
+
+    // Bytes one regenerated slot takes in a streaming buffer
+    VkDeviceSize streamingSlotSize() {
+        return STORED_BLADES_PER_TILE * (sizeof(RestPosition) + sizeof(RestUp) + sizeof(RestShape) + sizeof(BladeControlPoints)) + sizeof(BladeTile) + sizeof(TileSleep);
+    }
+}
+
+void Blades::GenerateTile(const glm::ivec2& tile, float tileSize, Blade* blades, unsigned int count) {
+    uint32_t state = tileSeed(tile);
+    glm::vec2 tileMin = glm::vec2(tile) * tileSize;
+
+    for (unsigned int i = 0; i < count; i++) {
+        Blade& currentBlade = blades[i];
+
+        glm::vec3 bladeUp(0.0f, 1.0f, 0.0f);
 
-    BufferUtils::CreateBufferFromData(device, commandPool, blades.data(), NUM_BLADES * sizeof(Blade), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, bladesBuffer, bladesBufferMemory);
-    BufferUtils::CreateBuffer(device, NUM_BLADES * sizeof(Blade), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, culledBladesBuffer, culledBladesBufferMemory);
-    BufferUtils::CreateBufferFromData(device, commandPool, &indirectDraw, sizeof(BladeDrawIndirect), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, numBladesBuffer, numBladesBufferMemory);
+        // Generate positions and direction (v0)
+        float x = tileMin.x + nextTileRandom(state) * tileSize;
+        float z = tileMin.y + nextTileRandom(state) * tileSize;
+        float direction = nextTileRandom(state) * 2.f * 3.14159265f;
+        glm::vec3 bladePosition(x, 0.0f, z);
+        currentBlade.v0 = glm::vec4(bladePosition, direction);
+
+        // Bezier point and height (v1)
+        float height = MIN_HEIGHT + (nextTileRandom(state) * (MAX_HEIGHT - MIN_HEIGHT));
+        currentBlade.v1 = glm::vec4(bladePosition + bladeUp * height, height);
+
+        // Physical model guide and width (v2)
+        float width = MIN_WIDTH + (nextTileRandom(state) * (MAX_WIDTH - MIN_WIDTH));
+        currentBlade.v2 = glm::vec4(bladePosition + bladeUp * height, width);
+
+        // Up vector and stiffness coefficient (up)
+        float stiffness = MIN_BEND + (nextTileRandom(state) * (MAX_BEND - MIN_BEND));
+        currentBlade.up = glm::vec4(bladeUp, stiffness);
+    }
 }
 
-VkBuffer Blades::GetBladesBuffer() const {
-    return bladesBuffer;
+unsigned int Blades::TileOf(const Blade& blade, float tileSize) {
+    return slotOf(glm::ivec2(static_cast<int>(std::floor(blade.v0.x / tileSize)), static_cast<int>(std::floor(blade.v0.z / tileSize))));
 }
 
-VkBuffer Blades::GetCulledBladesBuffer() const {
-    return culledBladesBuffer;
+namespace {
+    // Value in [0, 1) at a point of the noise lattice, which repeats every period points
+    float latticeValue(int x, int z, int period) {
+        return (tileSeed(glm::ivec2(positiveModulo(x, period), positiveModulo(z, period))) >> 8) / 16777216.0f;
+    }
+
+    // Smoothly interpolated lattice values
+    float valueNoise(float x, float z, int period) {
+        int x0 = static_cast<int>(std::floor(x));
+        int z0 = static_cast<int>(std::floor(z));
+        float fx = glm::smoothstep(0.0f, 1.0f, x - x0);
+        float fz = glm::smoothstep(0.0f, 1.0f, z - z0);
+        return glm::mix(glm::mix(latticeValue(x0, z0, period), latticeValue(x0 + 1, z0, period), fx),
+                        glm::mix(latticeValue(x0, z0 + 1, period), latticeValue(x0 + 1, z0 + 1, period), fx), fz);
+    }
 }
 
-VkBuffer Blades::GetNumBladesBuffer() const {
-    return numBladesBuffer;
+std::vector<float> Blades::GenerateDensityMap(unsigned int dim) {
+    // Three octaves with about four patches across the map, sharpened so that there are bare patches
+    // as well as fully grown ones. Each octave repeats across the map so that the map tiles
+    std::vector<float> density(dim * dim);
+    for (unsigned int z = 0; z < dim; ++z) {
+        for (unsigned int x = 0; x < dim; ++x) {
+            float u = 4.0f * x / dim;
+            float v = 4.0f * z / dim;
+            float noise = 0.5f * valueNoise(u, v, 4) + 0.3f * valueNoise(2.0f * u, 2.0f * v, 8) + 0.2f * valueNoise(4.0f * u, 4.0f * v, 16);
+            density[z * dim + x] = glm::smoothstep(0.3f, 0.6f, noise);
+        }
+    }
+    return density;
+}
+
+namespace {
+    uint32_t packUnorm(float value, unsigned int bits) {
+        float maxValue = static_cast<float>((1u << bits) - 1u);
+        return static_cast<uint32_t>(glm::round(glm::clamp(value, 0.0f, 1.0f) * maxValue));
+    }
+
+    float unpackUnorm(uint32_t value, unsigned int bits) {
+        uint32_t maxValue = (1u << bits) - 1u;
+        return static_cast<float>(value & maxValue) / static_cast<float>(maxValue);
+    }
+
+    // Where value lies between low and high, 0 when they are the same
+    float unmix(float low, float high, float value) {
+        return high > low ? (value - low) / (high - low) : 0.0f;
+    }
+}
+
+PackedBlade Blades::Pack(const Blade& blade, unsigned int tileIndex, const BladeTile& tile) {
+    PackedBlade packed;
+    packed.position = packUnorm(unmix(tile.boundsMin.x, tile.boundsMax.x, blade.v0.x), 11)
+                    | packUnorm(unmix(tile.boundsMin.y, tile.boundsMax.y, blade.v0.y), 10) << 11
+                    | packUnorm(unmix(tile.boundsMin.z, tile.boundsMax.z, blade.v0.z), 11) << 21;
+
+    // Up vectors point away from the ground, so the upper half of an octahedral map is enough.
+    // Rotating it by 45 degrees fills the whole square, stored as 0..30 with 15 for 0
+    glm::vec3 up = glm::vec3(blade.up) / (std::abs(blade.up.x) + std::abs(blade.up.y) + std::abs(blade.up.z));
+    glm::vec2 e(up.x + up.z, up.x - up.z);
+    uint32_t ex = static_cast<uint32_t>(glm::round(glm::clamp(e.x, -1.0f, 1.0f) * 15.0f) + 15.0f);
+    uint32_t ey = static_cast<uint32_t>(glm::round(glm::clamp(e.y, -1.0f, 1.0f) * 15.0f) + 15.0f);
+    float turns = blade.v0.w / (2.0f * 3.14159265f);
+    packed.tileOrientationUp = (tileIndex & 0xFFFu)
+                             | (packUnorm(turns - std::floor(turns), 10) << 12)
+                             | (ex << 22)
+                             | (ey << 27);
+
+    glm::vec3 d1 = (glm::vec3(blade.v1) - glm::vec3(blade.v0)) / CONTROL_POINT_RANGE;
+    glm::vec3 d2 = (glm::vec3(blade.v2) - glm::vec3(blade.v0)) / CONTROL_POINT_RANGE;
+    packed.controlPoints[0] = glm::packSnorm2x16(glm::vec2(d1.x, d1.y));
+    packed.controlPoints[1] = glm::packSnorm2x16(glm::vec2(d1.z, d2.x));
+    packed.controlPoints[2] = glm::packSnorm2x16(glm::vec2(d2.y, d2.z));
+
+    packed.shape = packUnorm(unmix(MIN_HEIGHT, MAX_HEIGHT, blade.v1.w), 11)
+                 | packUnorm(unmix(MIN_WIDTH, MAX_WIDTH, blade.v2.w), 10) << 11
+                 | packUnorm(unmix(MIN_BEND, MAX_BEND, blade.up.w), 11) << 21;
+    return packed;
+}
+
+Blade Blades::Unpack(const PackedBlade& packed, const BladeTile& tile) {
+    glm::vec3 t(unpackUnorm(packed.position, 11), unpackUnorm(packed.position >> 11, 10), unpackUnorm(packed.position >> 21, 11));
+    glm::vec3 v0 = glm::mix(glm::vec3(tile.boundsMin), glm::vec3(tile.boundsMax), t);
+
+    glm::vec2 e = (glm::vec2(static_cast<float>((packed.tileOrientationUp >> 22) & 0x1Fu), static_cast<float>(packed.tileOrientationUp >> 27)) - 15.0f) / 15.0f;
+    glm::vec2 p = glm::vec2(e.x + e.y, e.x - e.y) * 0.5f;
+    glm::vec3 up = glm::normalize(glm::vec3(p.x, 1.0f - std::abs(p.x) - std::abs(p.y), p.y));
+
+    glm::vec2 a = glm::unpackSnorm2x16(packed.controlPoints[0]);
+    glm::vec2 b = glm::unpackSnorm2x16(packed.controlPoints[1]);
+    glm::vec2 c = glm::unpackSnorm2x16(packed.controlPoints[2]);
+
+    Blade blade;
+    blade.v0 = glm::vec4(v0, unpackUnorm(packed.tileOrientationUp >> 12, 10) * 2.0f * 3.14159265f);
+    blade.v1 = glm::vec4(v0 + glm::vec3(a.x, a.y, b.x) * CONTROL_POINT_RANGE, glm::mix(MIN_HEIGHT, MAX_HEIGHT, unpackUnorm(packed.shape, 11)));
+    blade.v2 = glm::vec4(v0 + glm::vec3(b.y, c.x, c.y) * CONTROL_POINT_RANGE, glm::mix(MIN_WIDTH, MAX_WIDTH, unpackUnorm(packed.shape >> 11, 10)));
+    blade.up = glm::vec4(up, glm::mix(MIN_BEND, MAX_BEND, unpackUnorm(packed.shape >> 21, 11)));
+    return blade;
+}
+
+Blades::Blades(Device* device, float planeDim) : Model(device, {}, {}), tileSize(planeDim / TILE_GRID_DIM) {
+    // Fill every slot for a ring centered at the origin. With spawning only the tiles are kept,
+    // their blades are spawned by the cull pass
+    ringOrigin = glm::ivec2(-static_cast<int>(TILE_GRID_DIM) / 2);
+    hostBlades.resize(NUM_TILES * STORED_BLADES_PER_TILE);
+    hostTiles.resize(NUM_TILES);
+    slotPending.fill(false);
+    for (uint32_t slot = 0; slot < NUM_TILES; ++slot) {
+        slotTiles[slot] = ringTile(ringOrigin, slot);
+        generateSlot(slot);
+    }
+
+    // Until the first frame is culled every stored blade is drawn in the near tier, the other tiers and the
+    // shadow cascades are empty
+    BladeDrawArguments drawArguments = {};
+    drawArguments.draws[0].vertexCount = static_cast<uint32_t>(hostBlades.size());
+    drawArguments.draws[0].instanceCount = 1;
+    drawArguments.drawCounts[0] = 1;
+
+    // Split the blades into the rest pose arrays and the control points
+    std::vector<RestPosition> restPositions(NUM_STORED_BLADES);
+    std::vector<RestUp> restUps(NUM_STORED_BLADES);
+    std::vector<RestShape> restShapes(NUM_STORED_BLADES);
+    std::vector<BladeControlPoints> controlPoints(NUM_STORED_BLADES);
+    for (uint32_t slot = 0; slot < NUM_TILES; ++slot) {
+        uint32_t first = slot * STORED_BLADES_PER_TILE;
+        splitSlot(slot, restPositions.data() + first, restUps.data() + first, restShapes.data() + first, controlPoints.data() + first);
+    }
+    BufferUtils::CreateBufferFromData(device, restPositions.data(), NUM_STORED_BLADES * sizeof(RestPosition), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, restPositionsBuffer, restPositionsBufferMemory);
+    BufferUtils::CreateBufferFromData(device, restUps.data(), NUM_STORED_BLADES * sizeof(RestUp), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, restUpsBuffer, restUpsBufferMemory);
+    BufferUtils::CreateBufferFromData(device, restShapes.data(), NUM_STORED_BLADES * sizeof(RestShape), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, restShapesBuffer, restShapesBufferMemory);
+
+    // Both copies of the state start at the rest pose
+    std::vector<BladeControlPoints> bladeStates;
+    bladeStates.reserve(NUM_BLADE_STATES * NUM_STORED_BLADES);
+    for (unsigned int i = 0; i < NUM_BLADE_STATES; ++i) {
+        bladeStates.insert(bladeStates.end(), controlPoints.begin(), controlPoints.end());
+    }
+    BufferUtils::CreateBufferFromData(device, bladeStates.data(), NUM_BLADE_STATES * NUM_STORED_BLADES * sizeof(BladeControlPoints), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, controlPointsBuffer, controlPointsBufferMemory);
+
+    for (unsigned int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        // One list of MAX_CULLED_BLADES per LOD tier and per shadow cascade
+        BufferUtils::CreateBuffer(device, NUM_CULLED_LISTS * MAX_CULLED_BLADES * sizeof(DeviceBlade), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, culledBladesBuffers[frame], culledBladesBufferMemories[frame]);
+
+        // Host visible so that the CPU fallback can write the indirect draw arguments directly
+        BufferUtils::CreateBuffer(device, sizeof(BladeDrawArguments), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, numBladesBuffers[frame], numBladesBufferMemories[frame]);
+        memcpy(numBladesBufferMemories[frame].mappedData, &drawArguments, sizeof(BladeDrawArguments));
+    }
+
+    // Tile bounds are static and only the state index is written by simulate.comp,
+    // the visible tile list and the dispatch arguments are written by tile_cull.comp
+    BufferUtils::CreateBufferFromData(device, hostTiles.data(), NUM_TILES * sizeof(BladeTile), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT, tilesBuffer, tilesBufferMemory);
+    BufferUtils::CreateBuffer(device, NUM_TILES * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, visibleTilesBuffer, visibleTilesBufferMemory);
+    // Only x is cleared every frame, y and z stay 1
+    VkDispatchIndirectCommand tileDispatch = { 0, 1, 1 };
+    BufferUtils::CreateBufferFromData(device, &tileDispatch, sizeof(VkDispatchIndirectCommand), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, tileDispatchBuffer, tileDispatchBufferMemory);
+
+    // Culled blade count, turned into the indirect draw arguments by finalize.comp, and sleeping blade count.
+    // Copied to a host visible buffer every frame for reporting
+    BufferUtils::CreateBuffer(device, sizeof(BladeCounters), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, countersBuffer, countersBufferMemory);
+    BladeCounters counters = {};
+    for (unsigned int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        BufferUtils::CreateBuffer(device, sizeof(BladeCounters), VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, counterReadbackBuffers[frame], counterReadbackBufferMemories[frame]);
+        memcpy(counterReadbackBufferMemories[frame].mappedData, &counters, sizeof(BladeCounters));
+    }
+
+    // Every tile starts awake
+    std::vector<TileSleep> tileSleep(NUM_TILES, TileSleep());
+    BufferUtils::CreateBufferFromData(device, tileSleep.data(), NUM_TILES * sizeof(TileSleep), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, tileSleepBuffer, tileSleepBufferMemory);
+
+    // The density map repeats from the origin, its header takes the place of the first four texels
+    DensityMapHeader header = { glm::vec2(0.0f), 1.0f / DENSITY_MAP_SIZE, DENSITY_MAP_DIM };
+    std::vector<float> densityMap = GenerateDensityMap(DENSITY_MAP_DIM);
+    densityMap.insert(densityMap.begin(), sizeof(DensityMapHeader) / sizeof(float), 0.0f);
+    memcpy(densityMap.data(), &header, sizeof(DensityMapHeader));
+    BufferUtils::CreateBufferFromData(device, densityMap.data(), densityMap.size() * sizeof(float), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, densityMapBuffer, densityMapBufferMemory);
+
+    // Nothing has been seen before the first frame
+    std::vector<uint32_t> tileVisibility(NUM_TILES * TILE_VISIBILITY_WORDS, 0);
+    BufferUtils::CreateBufferFromData(device, tileVisibility.data(), NUM_TILES * TILE_VISIBILITY_WORDS * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, tileVisibilityBuffer, tileVisibilityBufferMemory);
+
+    // Regenerated slots are staged in host memory that stays mapped
+    for (unsigned int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        BufferUtils::CreateBuffer(device, STREAM_TILES_PER_FRAME * streamingSlotSize(), VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, streamingBuffers[frame], streamingBufferMemories[frame]);
+        streamingMappedData[frame] = streamingBufferMemories[frame].mappedData;
+    }
+}
+
+void Blades::generateSlot(uint32_t slot) {
+    const glm::ivec2& tileCoords = slotTiles[slot];
+    BladeTile& tile = hostTiles[slot];
+    tile.stateIndex = 0;
+    tile.padding = 0;
+
+#if USE_DENSITY_SPAWNING
+    // Spawned blades never get further from their tile than their height and width, mirrors SPAWN_REACH
+    // in shaders/blades.glsl, which finds the tile back from the bounds
+    const float reach = MAX_HEIGHT + MAX_WIDTH;
+    glm::vec2 tileMin = glm::vec2(tileCoords) * tileSize;
+    tile.boundsMin = glm::vec4(tileMin.x - reach, 0.0f, tileMin.y - reach, 0.0f);
+    tile.boundsMax = glm::vec4(tileMin.x + tileSize + reach, reach, tileMin.y + tileSize + reach, 0.0f);
+    // The blade indices only seed the spawned blades, so every world tile gets its own range
+    tile.firstBlade = tileSeed(tileCoords) & ~(SPAWN_BLADES_PER_TILE - 1u);
+    tile.bladeCount = SPAWN_BLADES_PER_TILE;
+#else
+    tile.firstBlade = slot * STORED_BLADES_PER_TILE;
+    tile.bladeCount = STORED_BLADES_PER_TILE;
+    Blade* blades = hostBlades.data() + tile.firstBlade;
+    GenerateTile(tileCoords, tileSize, blades, STORED_BLADES_PER_TILE);
+
+    // A blade never gets further than its height from v0 and never goes below the ground,
+    // so grow the box by the height sideways and upwards, plus the width for the blade's edges
+    tile.boundsMin = glm::vec4(std::numeric_limits<float>::max());
+    tile.boundsMax = glm::vec4(-std::numeric_limits<float>::max());
+    for (uint32_t i = 0; i < STORED_BLADES_PER_TILE; ++i) {
+        glm::vec3 root(blades[i].v0);
+        float reach = blades[i].v1.w + blades[i].v2.w;
+        tile.boundsMin = glm::min(tile.boundsMin, glm::vec4(root - glm::vec3(reach, 0.0f, reach), 0.0f));
+        tile.boundsMax = glm::max(tile.boundsMax, glm::vec4(root + glm::vec3(reach), 0.0f));
+    }
+#endif
+}
+
+void Blades::splitSlot(uint32_t slot, RestPosition* restPositions, RestUp* restUps, RestShape* restShapes, BladeControlPoints* controlPoints) {
+    const BladeTile& tile = hostTiles[slot];
+    for (uint32_t i = 0; i < STORED_BLADES_PER_TILE; ++i) {
+        Blade& blade = hostBlades[tile.firstBlade + i];
+#if USE_PACKED_BLADES
+        // The host keeps the quantized blades so that the CPU fallback simulates what the GPU would
+        PackedBlade packed = Pack(blade, slot, tile);
+        blade = Unpack(packed, tile);
+        restPositions[i] = packed.position;
+        restUps[i] = packed.tileOrientationUp;
+        restShapes[i] = packed.shape;
+        std::copy(packed.controlPoints, packed.controlPoints + 3, controlPoints[i].controlPoints);
+#else
+        restPositions[i] = blade.v0;
+        restUps[i] = blade.up;
+        restShapes[i] = glm::vec2(blade.v1.w, blade.v2.w);
+        controlPoints[i].v1 = glm::vec4(glm::vec3(blade.v1), 0.0f);
+        controlPoints[i].v2 = glm::vec4(glm::vec3(blade.v2), 0.0f);
+#endif
+    }
+}
+
+void Blades::Stream(const glm::vec3& center) {
+    glm::ivec2 centerTile(static_cast<int>(std::floor(center.x / tileSize)), static_cast<int>(std::floor(center.z / tileSize)));
+    glm::ivec2 origin = centerTile - glm::ivec2(static_cast<int>(TILE_GRID_DIM) / 2);
+    if (origin == ringOrigin) {
+        return;
+    }
+    ringOrigin = origin;
+
+    // Only the slots of the rows and columns the ring moved past hold another world tile now
+    for (uint32_t slot = 0; slot < NUM_TILES; ++slot) {
+        glm::ivec2 tile = ringTile(ringOrigin, slot);
+        if (tile != slotTiles[slot]) {
+            slotTiles[slot] = tile;
+            if (!slotPending[slot]) {
+                slotPending[slot] = true;
+                pendingSlots.push_back(slot);
+            }
+        }
+    }
+}
+
+uint32_t Blades::RecordStreaming(VkCommandBuffer commandBuffer, uint32_t frame) {
+    uint32_t count = std::min(static_cast<uint32_t>(pendingSlots.size()), STREAM_TILES_PER_FRAME);
+
+    // Each slot is staged as its rest pose arrays, its control points, its tile and its sleep state,
+    // and copied to its ranges of the device buffers
+    const VkDeviceSize restPositionsOffset = 0;
+    const VkDeviceSize restUpsOffset = restPositionsOffset + STORED_BLADES_PER_TILE * sizeof(RestPosition);
+    const VkDeviceSize restShapesOffset = restUpsOffset + STORED_BLADES_PER_TILE * sizeof(RestUp);
+    const VkDeviceSize controlPointsOffset = restShapesOffset + STORED_BLADES_PER_TILE * sizeof(RestShape);
+    const VkDeviceSize tileOffset = controlPointsOffset + STORED_BLADES_PER_TILE * sizeof(BladeControlPoints);
+    const VkDeviceSize tileSleepOffset = tileOffset + sizeof(BladeTile);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        uint32_t slot = pendingSlots.front();
+        pendingSlots.pop_front();
+        slotPending[slot] = false;
+        generateSlot(slot);
+
+        VkDeviceSize staged = i * streamingSlotSize();
+        char* data = static_cast<char*>(streamingMappedData[frame]) + staged;
+        splitSlot(slot,
+            reinterpret_cast<RestPosition*>(data + restPositionsOffset),
+            reinterpret_cast<RestUp*>(data + restUpsOffset),
+            reinterpret_cast<RestShape*>(data + restShapesOffset),
+            reinterpret_cast<BladeControlPoints*>(data + controlPointsOffset));
+        memcpy(data + tileOffset, &hostTiles[slot], sizeof(BladeTile));
+        TileSleep tileSleep = TileSleep();
+        memcpy(data + tileSleepOffset, &tileSleep, sizeof(TileSleep));
+
+        VkBuffer streamingBuffer = streamingBuffers[frame];
+        VkBufferCopy tileCopy = { staged + tileOffset, slot * sizeof(BladeTile), sizeof(BladeTile) };
+        vkCmdCopyBuffer(commandBuffer, streamingBuffer, tilesBuffer, 1, &tileCopy);
+        VkBufferCopy tileSleepCopy = { staged + tileSleepOffset, slot * sizeof(TileSleep), sizeof(TileSleep) };
+        vkCmdCopyBuffer(commandBuffer, streamingBuffer, tileSleepBuffer, 1, &tileSleepCopy);
+        vkCmdFillBuffer(commandBuffer, tileVisibilityBuffer, slot * TILE_VISIBILITY_WORDS * sizeof(uint32_t), TILE_VISIBILITY_WORDS * sizeof(uint32_t), 0);
+
+        if (STORED_BLADES_PER_TILE > 0) {
+            VkDeviceSize first = slot * STORED_BLADES_PER_TILE;
+            VkBufferCopy restPositionsCopy = { staged + restPositionsOffset, first * sizeof(RestPosition), STORED_BLADES_PER_TILE * sizeof(RestPosition) };
+            vkCmdCopyBuffer(commandBuffer, streamingBuffer, restPositionsBuffer, 1, &restPositionsCopy);
+            VkBufferCopy restUpsCopy = { staged + restUpsOffset, first * sizeof(RestUp), STORED_BLADES_PER_TILE * sizeof(RestUp) };
+            vkCmdCopyBuffer(commandBuffer, streamingBuffer, restUpsBuffer, 1, &restUpsCopy);
+            VkBufferCopy restShapesCopy = { staged + restShapesOffset, first * sizeof(RestShape), STORED_BLADES_PER_TILE * sizeof(RestShape) };
+            vkCmdCopyBuffer(commandBuffer, streamingBuffer, restShapesBuffer, 1, &restShapesCopy);
+
+            // Both copies of the state start at the rest pose
+            std::array<VkBufferCopy, NUM_BLADE_STATES> controlPointsCopies;
+            for (uint32_t state = 0; state < NUM_BLADE_STATES; ++state) {
+                controlPointsCopies[state] = { staged + controlPointsOffset, (state * NUM_STORED_BLADES + first) * sizeof(BladeControlPoints), STORED_BLADES_PER_TILE * sizeof(BladeControlPoints) };
+            }
+            vkCmdCopyBuffer(commandBuffer, streamingBuffer, controlPointsBuffer, NUM_BLADE_STATES, controlPointsCopies.data());
+        }
+    }
+    return count;
+}
+
+glm::vec3 Blades::GetRingCenter() const {
+    glm::vec2 center = (glm::vec2(ringOrigin) + 0.5f * TILE_GRID_DIM) * tileSize;
+    return glm::vec3(center.x, 0.0f, center.y);
+}
+
+VkBuffer Blades::GetControlPointsBuffer() const {
+    return controlPointsBuffer;
+}
+
+VkBuffer Blades::GetRestPositionsBuffer() const {
+    return restPositionsBuffer;
+}
+
+VkBuffer Blades::GetRestUpsBuffer() const {
+    return restUpsBuffer;
+}
+
+VkBuffer Blades::GetRestShapesBuffer() const {
+    return restShapesBuffer;
+}
+
+VkBuffer Blades::GetCulledBladesBuffer(uint32_t frame) const {
+    return culledBladesBuffers[frame];
+}
+
+VkBuffer Blades::GetNumBladesBuffer(uint32_t frame) const {
+    return numBladesBuffers[frame];
+}
+
+VkBuffer Blades::GetTilesBuffer() const {
+    return tilesBuffer;
+}
+
+VkBuffer Blades::GetVisibleTilesBuffer() const {
+    return visibleTilesBuffer;
+}
+
+VkBuffer Blades::GetTileDispatchBuffer() const {
+    return tileDispatchBuffer;
+}
+
+VkBuffer Blades::GetCountersBuffer() const {
+    return countersBuffer;
+}
+
+VkBuffer Blades::GetTileSleepBuffer() const {
+    return tileSleepBuffer;
+}
+
+VkBuffer Blades::GetDensityMapBuffer() const {
+    return densityMapBuffer;
+}
+
+VkBuffer Blades::GetTileVisibilityBuffer() const {
+    return tileVisibilityBuffer;
+}
+
+VkBuffer Blades::GetCounterReadbackBuffer(uint32_t frame) const {
+    return counterReadbackBuffers[frame];
+}
+
+BladeCounters Blades::ReadCounters(uint32_t frame) const {
+    BladeCounters counters;
+    memcpy(&counters, counterReadbackBufferMemories[frame].mappedData, sizeof(BladeCounters));
+    return counters;
+}
+
+std::vector<Blade>& Blades::GetHostBlades() {
+    return hostBlades;
+}
+
+const std::vector<BladeTile>& Blades::GetHostTiles() const {
+    return hostTiles;
+}
+
+void Blades::ReadBladesBuffer(VkCommandPool commandPool, std::vector<Blade>& blades) const {
+    std::vector<BladeControlPoints> bladeStates(NUM_BLADE_STATES * NUM_STORED_BLADES);
+    std::vector<BladeTile> tiles(NUM_TILES);
+    BufferUtils::ReadBufferToHost(device, commandPool, controlPointsBuffer, NUM_BLADE_STATES * NUM_STORED_BLADES * sizeof(BladeControlPoints), bladeStates.data());
+    BufferUtils::ReadBufferToHost(device, commandPool, tilesBuffer, NUM_TILES * sizeof(BladeTile), tiles.data());
+
+    // The rest pose never changes and the host blades hold the same one,
+    // each tile's latest control points are in the copy its state index points at
+    blades.resize(NUM_STORED_BLADES);
+    for (unsigned int tileIndex = 0; tileIndex < NUM_TILES; ++tileIndex) {
+        const BladeTile& tile = tiles[tileIndex];
+        const BladeControlPoints* latest = bladeStates.data() + tile.stateIndex * NUM_STORED_BLADES + tile.firstBlade;
+        for (uint32_t i = 0; i < tile.bladeCount; ++i) {
+            const Blade& rest = hostBlades[tile.firstBlade + i];
+#if USE_PACKED_BLADES
+            PackedBlade packed = Pack(rest, tileIndex, tile);
+            std::copy(latest[i].controlPoints, latest[i].controlPoints + 3, packed.controlPoints);
+            blades[tile.firstBlade + i] = Unpack(packed, tile);
+#else
+            Blade& blade = blades[tile.firstBlade + i];
+            blade = rest;
+            blade.v1 = glm::vec4(glm::vec3(latest[i].v1), rest.v1.w);
+            blade.v2 = glm::vec4(glm::vec3(latest[i].v2), rest.v2.w);
+#endif
+        }
+    }
+}
+
+void Blades::UploadCulledBlades(uint32_t frame, const Blade* culledBlades, uint32_t count, uint32_t verticesPerBlade) {
+    void* data;
+    if (count > 0) {
+        data = culledBladesBufferMemories[frame].mappedData;
+#if USE_PACKED_BLADES
+        // Culled blades have been reordered, so look their tile up from their position. Quantization may
+        // move a blade into the next cell, whose bounds still contain it as they extend by the blade height
+        PackedBlade* packed = static_cast<PackedBlade*>(data);
+        for (uint32_t i = 0; i < count; ++i) {
+            unsigned int tileIndex = TileOf(culledBlades[i], tileSize);
+            packed[i] = Pack(culledBlades[i], tileIndex, hostTiles[tileIndex]);
+        }
+#else
+        memcpy(data, culledBlades, count * sizeof(Blade));
+#endif
+
+        // The culled blades buffer is not required to be host coherent
+        device->GetAllocator()->Flush(culledBladesBufferMemories[frame], 0, count * sizeof(DeviceBlade));
+    }
+
+    // The mid and far tiers and the shadow cascades keep the empty arguments written at creation
+    data = numBladesBufferMemories[frame].mappedData;
+    BladeDrawArguments* drawArguments = static_cast<BladeDrawArguments*>(data);
+    drawArguments->draws[0].vertexCount = count * verticesPerBlade;
+    drawArguments->drawCounts[0] = count > 0 ? 1 : 0;
 }
 
 Blades::~Blades() {
-    vkDestroyBuffer(device->GetVkDevice(), bladesBuffer, nullptr);
-    vkFreeMemory(device->GetVkDevice(), bladesBufferMemory, nullptr);
-    vkDestroyBuffer(device->GetVkDevice(), culledBladesBuffer, nullptr);
-    vkFreeMemory(device->GetVkDevice(), culledBladesBufferMemory, nullptr);
-    vkDestroyBuffer(device->GetVkDevice(), numBladesBuffer, nullptr);
-    vkFreeMemory(device->GetVkDevice(), numBladesBufferMemory, nullptr);
+    vkDestroyBuffer(device->GetVkDevice(), controlPointsBuffer, nullptr);
+    device->GetAllocator()->Free(controlPointsBufferMemory);
+    vkDestroyBuffer(device->GetVkDevice(), restPositionsBuffer, nullptr);
+    device->GetAllocator()->Free(restPositionsBufferMemory);
+    vkDestroyBuffer(device->GetVkDevice(), restUpsBuffer, nullptr);
+    device->GetAllocator()->Free(restUpsBufferMemory);
+    vkDestroyBuffer(device->GetVkDevice(), restShapesBuffer, nullptr);
+    device->GetAllocator()->Free(restShapesBufferMemory);
+    for (unsigned int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        vkDestroyBuffer(device->GetVkDevice(), culledBladesBuffers[frame], nullptr);
+        device->GetAllocator()->Free(culledBladesBufferMemories[frame]);
+        vkDestroyBuffer(device->GetVkDevice(), numBladesBuffers[frame], nullptr);
+        device->GetAllocator()->Free(numBladesBufferMemories[frame]);
+    }
+    vkDestroyBuffer(device->GetVkDevice(), tilesBuffer, nullptr);
+    device->GetAllocator()->Free(tilesBufferMemory);
+    vkDestroyBuffer(device->GetVkDevice(), visibleTilesBuffer, nullptr);
+    device->GetAllocator()->Free(visibleTilesBufferMemory);
+    vkDestroyBuffer(device->GetVkDevice(), tileDispatchBuffer, nullptr);
+    device->GetAllocator()->Free(tileDispatchBufferMemory);
+    vkDestroyBuffer(device->GetVkDevice(), countersBuffer, nullptr);
+    device->GetAllocator()->Free(countersBufferMemory);
+    vkDestroyBuffer(device->GetVkDevice(), tileSleepBuffer, nullptr);
+    device->GetAllocator()->Free(tileSleepBufferMemory);
+    vkDestroyBuffer(device->GetVkDevice(), densityMapBuffer, nullptr);
+    device->GetAllocator()->Free(densityMapBufferMemory);
+
+    vkDestroyBuffer(device->GetVkDevice(), tileVisibilityBuffer, nullptr);
+    device->GetAllocator()->Free(tileVisibilityBufferMemory);
+    for (unsigned int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        vkDestroyBuffer(device->GetVkDevice(), streamingBuffers[frame], nullptr);
+        device->GetAllocator()->Free(streamingBufferMemories[frame]);
+    }
+    for (unsigned int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        vkDestroyBuffer(device->GetVkDevice(), counterReadbackBuffers[frame], nullptr);
+        device->GetAllocator()->Free(counterReadbackBufferMemories[frame]);
+    }
 }
@@ -2,6 +2,8 @@
 #include <vulkan/vulkan.h>
 #include <glm/glm.hpp>
 #include <array>
+#include <deque>
+#include <vector>
 #include "Model.h"
 
 constexpr static unsigned int NUM_BLADES = 1 << 13; // default 1 << 13
@@ -12,6 +14,61 @@ constexpr static float MAX_WIDTH = 0.14f;
 constexpr static float MIN_BEND = 7.0f;
 constexpr static float MAX_BEND = 13.0f;
 
+// The field is a ring of TILE_GRID_DIM x TILE_GRID_DIM tiles following the camera over an endless world.
+// The tiles are a fixed pool of slots laid out toroidally: world tile (x, z) lives in slot
+// (x mod TILE_GRID_DIM, z mod TILE_GRID_DIM), so only the tiles that leave the ring are regenerated
+constexpr static unsigned int TILE_GRID_DIM = 16;
+constexpr static unsigned int NUM_TILES = TILE_GRID_DIM * TILE_GRID_DIM;
+// Slots regenerated in one frame at most, the others wait for the next frames
+constexpr static unsigned int STREAM_TILES_PER_FRAME = 8;
+
+// The simulation reads one copy of the blade state and writes the other
+constexpr static unsigned int NUM_BLADE_STATES = 2;
+
+// Blades are drawn in LOD tiers by distance to the camera: tessellated blades, fixed strips, and camera facing cards
+// that each stand for a clump of blades. Mirrors NUM_LOD_TIERS in shaders/blades.glsl
+constexpr static unsigned int NUM_LOD_TIERS = 3;
+// Grass casts shadows into NUM_SHADOW_CASCADES cascades of the shadow map, see ShadowCascades.h.
+// Mirrors NUM_SHADOW_CASCADES in shaders/shadow.glsl
+constexpr static unsigned int NUM_SHADOW_CASCADES = 2;
+// The cull pass tests every blade against the camera and the cascades at once, and writes one list of culled
+// blades per LOD tier followed by one per cascade. Mirrors NUM_CULLED_LISTS in shaders/blades.glsl
+constexpr static unsigned int NUM_CULLED_LISTS = NUM_LOD_TIERS + NUM_SHADOW_CASCADES;
+
+// Store blades on the device as PackedBlade instead of Blade, mirrors USE_PACKED_BLADES in shaders/blade_packing.glsl
+#define USE_PACKED_BLADES 0
+
+// Spawn the blades of visible tiles on the device every frame from a density map instead of storing and
+// simulating NUM_BLADES blades, mirrors USE_DENSITY_SPAWNING in shaders/blades.glsl
+#define USE_DENSITY_SPAWNING 0
+// Candidate blades of a spawned tile, all of them grow where the density map is 1
+constexpr static unsigned int SPAWN_BLADES_PER_TILE = 64;
+// Texels on each side of the density map, which repeats every DENSITY_MAP_SIZE world units
+constexpr static unsigned int DENSITY_MAP_DIM = 128;
+constexpr static float DENSITY_MAP_SIZE = 64.0f;
+
+#if USE_DENSITY_SPAWNING && USE_PACKED_BLADES
+#error "Spawned blades have no rest pose to pack the culled blades against"
+#endif
+
+#if USE_DENSITY_SPAWNING
+// Nothing is stored per blade, the blade buffers keep a single element to stay valid
+constexpr static unsigned int NUM_STORED_BLADES = 1;
+constexpr static unsigned int STORED_BLADES_PER_TILE = 0;
+// Room for blades in each culled list, the spawned blades past it are dropped
+constexpr static unsigned int MAX_CULLED_BLADES = 1 << 15;
+#else
+// Every slot holds the same number of blades, so that a tile is regenerated in place
+constexpr static unsigned int NUM_STORED_BLADES = NUM_BLADES;
+constexpr static unsigned int STORED_BLADES_PER_TILE = NUM_BLADES / NUM_TILES;
+constexpr static unsigned int MAX_CULLED_BLADES = NUM_BLADES;
+static_assert(NUM_BLADES % NUM_TILES == 0, "NUM_BLADES has to be a multiple of NUM_TILES");
+#endif
+// Words of the visible set of a tile, one bit per blade slot it can cull, see USE_TEMPORAL_CULLING in shaders/blades.glsl
+constexpr static unsigned int TILE_VISIBILITY_WORDS = ((USE_DENSITY_SPAWNING ? SPAWN_BLADES_PER_TILE : STORED_BLADES_PER_TILE) + 31) / 32;
+// v1 and v2 are packed relative to v0, within this distance on each axis
+constexpr static float CONTROL_POINT_RANGE = 2.0f * MAX_HEIGHT;
+
 struct Blade {
     // Position and direction
     glm::vec4 v0;
@@ -62,6 +119,83 @@ struct Blade {
     }
 };
 
+// Quantized blade, 24 bytes instead of 64. Positions are relative to the bounds of the blade's tile,
+// see shaders/blade_packing.glsl for the bit layout
+struct PackedBlade {
+    // v0 within the tile bounds, unorm 11/10/11 bits for x/y/z
+    uint32_t position;
+    // Tile index (12 bits), orientation (unorm 10 bits) and hemi-octahedral up vector (snorm 5/5 bits)
+    uint32_t tileOrientationUp;
+    // v1 - v0 and v2 - v0 over CONTROL_POINT_RANGE, snorm 16 bits each
+    uint32_t controlPoints[3];
+    // Height, width and stiffness between their MIN and MAX, unorm 11/10/11 bits
+    uint32_t shape;
+
+    static VkVertexInputBindingDescription getBindingDescription() {
+        VkVertexInputBindingDescription bindingDescription = {};
+        bindingDescription.binding = 0;
+        bindingDescription.stride = sizeof(PackedBlade);
+        bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+        return bindingDescription;
+    }
+
+    static std::array<VkVertexInputAttributeDescription, 3> getAttributeDescriptions() {
+        std::array<VkVertexInputAttributeDescription, 3> attributeDescriptions = {};
+
+        // position and tileOrientationUp
+        attributeDescriptions[0].binding = 0;
+        attributeDescriptions[0].location = 0;
+        attributeDescriptions[0].format = VK_FORMAT_R32G32_UINT;
+        attributeDescriptions[0].offset = offsetof(PackedBlade, position);
+
+        // controlPoints
+        attributeDescriptions[1].binding = 0;
+        attributeDescriptions[1].location = 1;
+        attributeDescriptions[1].format = VK_FORMAT_R32G32B32_UINT;
+        attributeDescriptions[1].offset = offsetof(PackedBlade, controlPoints);
+
+        // shape
+        attributeDescriptions[2].binding = 0;
+        attributeDescriptions[2].location = 2;
+        attributeDescriptions[2].format = VK_FORMAT_R32_UINT;
+        attributeDescriptions[2].offset = offsetof(PackedBlade, shape);
+
+        return attributeDescriptions;
+    }
+};
+
+// Layout of the blade, culled blade and vertex buffers on the device
+#if USE_PACKED_BLADES
+typedef PackedBlade DeviceBlade;
+#else
+typedef Blade DeviceBlade;
+#endif
+
+// Control points of a blade, the only part of it the simulation writes.
+// Layout matches the BladeControlPoints struct in shaders/blades.glsl
+#if USE_PACKED_BLADES
+struct BladeControlPoints {
+    uint32_t controlPoints[3];
+};
+#else
+struct BladeControlPoints {
+    glm::vec4 v1;
+    glm::vec4 v2;
+};
+#endif
+
+// Rest pose attributes, each stored in its own array. Layouts match the rest buffers in shaders/blades.glsl
+#if USE_PACKED_BLADES
+typedef uint32_t RestPosition; // PackedBlade::position
+typedef uint32_t RestUp;       // PackedBlade::tileOrientationUp
+typedef uint32_t RestShape;    // PackedBlade::shape
+#else
+typedef glm::vec4 RestPosition; // v0 and orientation
+typedef glm::vec4 RestUp;       // Up vector and stiffness
+typedef glm::vec2 RestShape;    // Height and width
+#endif
+
 struct BladeDrawIndirect {
     uint32_t vertexCount;
     uint32_t instanceCount;
@@ -69,20 +203,172 @@ struct BladeDrawIndirect {
     uint32_t firstInstance;
 };
 
+// Contents of the numBlades buffers: the draw arguments of every culled list, then how many of them to draw.
+// Layout matches the NumBlades buffer in shaders/blades.glsl
+struct BladeDrawArguments {
+    BladeDrawIndirect draws[NUM_CULLED_LISTS];
+    // 1 when the list has blades to draw, read by vkCmdDrawIndirectCount
+    uint32_t drawCounts[NUM_CULLED_LISTS];
+};
+
+// Contiguous range of blades and the box that contains them however they bend
+// Layout matches the BladeTile struct in shaders/blades.glsl
+struct BladeTile {
+    glm::vec4 boundsMin;
+    glm::vec4 boundsMax;
+    uint32_t firstBlade;
+    uint32_t bladeCount;
+    // Copy of the blade state holding the tile's latest blades, flipped every time the tile is simulated
+    uint32_t stateIndex;
+    uint32_t padding;
+};
+
+// Rest tracking of a tile, the tile sleeps while its blades have barely moved for a while
+// and the wind on none of them has changed much since. Layout matches the TileSleep struct in shaders/blades.glsl
+struct TileSleep {
+    // Total time at which the tile was last simulated
+    float simulatedTime;
+    // Consecutive substeps in which no blade of the tile moved more than the sleep threshold
+    uint32_t restSteps;
+};
+
+// Leads the density map buffer, followed by dim x dim floats row by row along z.
+// Layout matches the DensityMap buffer in shaders/blades.glsl
+struct DensityMapHeader {
+    // Corner of the square the map covers on the ground plane, it repeats from there
+    glm::vec2 origin;
+    // One over the side of the square
+    float inverseSize;
+    uint32_t dim;
+};
+
+// Layout matches the Counters buffer in shaders/blades.glsl
+struct BladeCounters {
+    // Blades that survived culling in each LOD tier, then in each shadow cascade
+    uint32_t culledBlades[NUM_CULLED_LISTS];
+    // Blades of visible tiles that skipped simulation because their tile was asleep
+    uint32_t sleepingBlades;
+    // Blades of visible tiles that went through the view dependent tests, and the ones that were in
+    // the visible set of the previous frame and skipped them
+    uint32_t retestedBlades;
+    uint32_t reusedBlades;
+};
+
 class Blades : public Model {
 private:
-    VkBuffer bladesBuffer;
-    VkBuffer culledBladesBuffer;
-    VkBuffer numBladesBuffer;
+    // NUM_BLADE_STATES copies of the control points, one after the other
+    VkBuffer controlPointsBuffer;
+    // Rest pose, never written after creation
+    VkBuffer restPositionsBuffer;
+    VkBuffer restUpsBuffer;
+    VkBuffer restShapesBuffer;
+    std::array<VkBuffer, MAX_FRAMES_IN_FLIGHT> culledBladesBuffers;
+    std::array<VkBuffer, MAX_FRAMES_IN_FLIGHT> numBladesBuffers;
+    VkBuffer tilesBuffer;
+    VkBuffer visibleTilesBuffer;
+    VkBuffer tileDispatchBuffer;
+    VkBuffer countersBuffer;
+    VkBuffer tileSleepBuffer;
+    VkBuffer densityMapBuffer;
+    // Blades that survived the last cull of each tile, TILE_VISIBILITY_WORDS per tile
+    VkBuffer tileVisibilityBuffer;
+    // Host visible copies of the counters of each frame in flight
+    std::array<VkBuffer, MAX_FRAMES_IN_FLIGHT> counterReadbackBuffers;
+    // Regenerated slots of each frame in flight, copied into the buffers above
+    std::array<VkBuffer, MAX_FRAMES_IN_FLIGHT> streamingBuffers;
+
+    MemoryAllocation controlPointsBufferMemory;
+    MemoryAllocation restPositionsBufferMemory;
+    MemoryAllocation restUpsBufferMemory;
+    MemoryAllocation restShapesBufferMemory;
+    std::array<MemoryAllocation, MAX_FRAMES_IN_FLIGHT> culledBladesBufferMemories;
+    std::array<MemoryAllocation, MAX_FRAMES_IN_FLIGHT> numBladesBufferMemories;
+    MemoryAllocation tilesBufferMemory;
+    MemoryAllocation visibleTilesBufferMemory;
+    MemoryAllocation tileDispatchBufferMemory;
+    MemoryAllocation countersBufferMemory;
+    MemoryAllocation tileSleepBufferMemory;
+    MemoryAllocation densityMapBufferMemory;
+    MemoryAllocation tileVisibilityBufferMemory;
+    std::array<MemoryAllocation, MAX_FRAMES_IN_FLIGHT> counterReadbackBufferMemories;
+    std::array<MemoryAllocation, MAX_FRAMES_IN_FLIGHT> streamingBufferMemories;
+    std::array<void*, MAX_FRAMES_IN_FLIGHT> streamingMappedData;
+
+    // Host copy of the blades, simulated by BladeKernel when there is no compute queue
+    std::vector<Blade> hostBlades;
+    std::vector<BladeTile> hostTiles;
+    float tileSize;
+
+    // World tile of the first tile of the ring, and the world tile each slot holds or is waiting for
+    glm::ivec2 ringOrigin;
+    std::array<glm::ivec2, NUM_TILES> slotTiles;
+    // Slots whose world tile changed since they were last generated, oldest first
+    std::deque<uint32_t> pendingSlots;
+    std::array<bool, NUM_TILES> slotPending;
 
-    VkDeviceMemory bladesBufferMemory;
-    VkDeviceMemory culledBladesBufferMemory;
-    VkDeviceMemory numBladesBufferMemory;
+    // Fill the host blades and tile of a slot for the world tile it holds
+    void generateSlot(uint32_t slot);
+    // Split the host blades of a slot into the rest pose arrays and the control points
+    void splitSlot(uint32_t slot, RestPosition* restPositions, RestUp* restUps, RestShape* restShapes, BladeControlPoints* controlPoints);
 
 public:
-    Blades(Device* device, VkCommandPool commandPool, float planeDim);
-    VkBuffer GetBladesBuffer() const;
-    VkBuffer GetCulledBladesBuffer() const;
-    VkBuffer GetNumBladesBuffer() const;
+    // The ring spans planeDim x planeDim and starts centered at the origin
+    Blades(Device* device, float planeDim);
+
+    // Randomly place count blades on a planeDim x planeDim square centered at the origin
+    static std::vector<Blade> Generate(float planeDim, unsigned int count);
+
+    // Place count blades on the world tile of the given coordinates, the same ones every time
+    static void GenerateTile(const glm::ivec2& tile, float tileSize, Blade* blades, unsigned int count);
+
+    // Share of the full tile density at each texel of a dim x dim map, patchy noise that repeats
+    // seamlessly and is the same on every run
+    static std::vector<float> GenerateDensityMap(unsigned int dim);
+
+    // Slot of the world tile a blade stands on
+    static unsigned int TileOf(const Blade& blade, float tileSize);
+
+    // Move the ring so that it is centered on the tile under center. Slots that leave the ring are queued
+    // for regeneration, they keep their old blades until then
+    void Stream(const glm::vec3& center);
+    // Regenerate up to STREAM_TILES_PER_FRAME queued slots on the host, and record the copies of their new
+    // contents into the device buffers from the staging buffer of the frame. The visible sets of the slots
+    // are emptied so that their new blades are all tested. Returns the number of slots.
+    // The staging buffer of the frame must not be in use anymore
+    uint32_t RecordStreaming(VkCommandBuffer commandBuffer, uint32_t frame);
+    // Center of the ring on the ground
+    glm::vec3 GetRingCenter() const;
+
+    // Quantize a blade of the given tile, and back
+    static PackedBlade Pack(const Blade& blade, unsigned int tileIndex, const BladeTile& tile);
+    static Blade Unpack(const PackedBlade& packed, const BladeTile& tile);
+
+    VkBuffer GetControlPointsBuffer() const;
+    VkBuffer GetRestPositionsBuffer() const;
+    VkBuffer GetRestUpsBuffer() const;
+    VkBuffer GetRestShapesBuffer() const;
+    VkBuffer GetCulledBladesBuffer(uint32_t frame) const;
+    VkBuffer GetNumBladesBuffer(uint32_t frame) const;
+    VkBuffer GetTilesBuffer() const;
+    VkBuffer GetVisibleTilesBuffer() const;
+    VkBuffer GetTileDispatchBuffer() const;
+    VkBuffer GetCountersBuffer() const;
+    VkBuffer GetTileSleepBuffer() const;
+    VkBuffer GetDensityMapBuffer() const;
+    VkBuffer GetTileVisibilityBuffer() const;
+    VkBuffer GetCounterReadbackBuffer(uint32_t frame) const;
+
+    // Counters copied at the end of the frame's compute pass. Only valid once that pass has completed
+    BladeCounters ReadCounters(uint32_t frame) const;
+
+    std::vector<Blade>& GetHostBlades();
+    const std::vector<BladeTile>& GetHostTiles() const;
+
+    // Copy the latest state of the simulated blades back from the device
+    void ReadBladesBuffer(VkCommandPool commandPool, std::vector<Blade>& blades) const;
+
+    // Write blades culled on the host and their count as the indirect draw arguments of a frame.
+    // Host culled blades are all drawn in the near tier, with verticesPerBlade vertices each, and cast no shadows
+    void UploadCulledBlades(uint32_t frame, const Blade* culledBlades, uint32_t count, uint32_t verticesPerBlade);
     ~Blades();
 };
@@ -1,13 +1,19 @@
 #include "BufferUtils.h"
 #include "Instance.h"
 
-void BufferUtils::CreateBuffer(Device* device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+void BufferUtils::CreateBuffer(Device* device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, MemoryAllocation& bufferMemory, bool shared) {
+    // Concurrent sharing only matters when the queues are of more than one family
+    std::vector<uint32_t> queueFamilies = device->GetQueueFamilies();
+    bool concurrent = shared && queueFamilies.size() > 1;
+
     // Create buffer
     VkBufferCreateInfo bufferInfo = {};
     bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
     bufferInfo.size = size;
     bufferInfo.usage = usage;
-    bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    bufferInfo.sharingMode = concurrent ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+    bufferInfo.queueFamilyIndexCount = concurrent ? static_cast<uint32_t>(queueFamilies.size()) : 0;
+    bufferInfo.pQueueFamilyIndices = concurrent ? queueFamilies.data() : nullptr;
 
     if (vkCreateBuffer(device->GetVkDevice(), &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create vertex buffer");
@@ -17,18 +23,11 @@ void BufferUtils::CreateBuffer(Device* device, VkDeviceSize size, VkBufferUsageF
     VkMemoryRequirements memRequirements;
     vkGetBufferMemoryRequirements(device->GetVkDevice(), buffer, &memRequirements);
 
-    // Allocate memory in device
-    VkMemoryAllocateInfo allocInfo = {};
-    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-    allocInfo.allocationSize = memRequirements.size;
-    allocInfo.memoryTypeIndex = device->GetInstance()->GetMemoryTypeIndex(memRequirements.memoryTypeBits, properties);
-
-    if (vkAllocateMemory(device->GetVkDevice(), &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
-      throw std::runtime_error("Failed to allocate vertex buffer");
-    }
+    // Take a range of a device memory block
+    bufferMemory = device->GetAllocator()->Allocate(memRequirements, properties, true);
 
     // Associate allocated memory with vertex buffer
-    vkBindBufferMemory(device->GetVkDevice(), buffer, bufferMemory, 0);
+    vkBindBufferMemory(device->GetVkDevice(), buffer, bufferMemory.memory, bufferMemory.offset);
 }
 
 void BufferUtils::CopyBuffer(Device* device, VkCommandPool commandPool, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size) {
@@ -58,35 +57,36 @@ void BufferUtils::CopyBuffer(Device* device, VkCommandPool commandPool, VkBuffer
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &commandBuffer;
 
-    vkQueueSubmit(device->GetQueue(QueueFlags::Graphics), 1, &submitInfo, VK_NULL_HANDLE);
-    vkQueueWaitIdle(device->GetQueue(QueueFlags::Graphics));
+    vkQueueSubmit(device->GetQueue(QueueFlags::Transfer), 1, &submitInfo, VK_NULL_HANDLE);
+    vkQueueWaitIdle(device->GetQueue(QueueFlags::Transfer));
     vkFreeCommandBuffers(device->GetVkDevice(), commandPool, 1, &commandBuffer);
 }
 
-void BufferUtils::CreateBufferFromData(Device* device, VkCommandPool commandPool, void* bufferData, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
-    // Create the staging buffer
+void BufferUtils::CreateBufferFromData(Device* device, const void* bufferData, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage, VkBuffer& buffer, MemoryAllocation& bufferMemory) {
+    // Create the buffer
+    VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | bufferUsage;
+    VkMemoryPropertyFlags flags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+    BufferUtils::CreateBuffer(device, bufferSize, usage, flags, buffer, bufferMemory, true);
+
+    // Stage the data and record the copy, submitted with the next flush
+    device->GetStagingRing()->UploadBuffer(buffer, 0, bufferData, bufferSize);
+}
+
+void BufferUtils::ReadBufferToHost(Device* device, VkCommandPool commandPool, VkBuffer buffer, VkDeviceSize bufferSize, void* hostData) {
+    // Create the staging buffer (the source buffer needs VK_BUFFER_USAGE_TRANSFER_SRC_BIT)
     VkBuffer stagingBuffer;
-    VkDeviceMemory stagingBufferMemory;
+    MemoryAllocation stagingBufferMemory;
 
-    VkBufferUsageFlags stagingUsage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    VkBufferUsageFlags stagingUsage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
     VkMemoryPropertyFlags stagingProperties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
     BufferUtils::CreateBuffer(device, bufferSize, stagingUsage, stagingProperties, stagingBuffer, stagingBufferMemory);
 
-    // Fill the staging buffer
-    void *data;
-    vkMapMemory(device->GetVkDevice(), stagingBufferMemory, 0, bufferSize, 0, &data);
-    memcpy(data, bufferData, static_cast<size_t>(bufferSize));
-    vkUnmapMemory(device->GetVkDevice(), stagingBufferMemory);
-
-    // Create the buffer
-    VkBufferUsageFlags usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT | bufferUsage;
-    VkMemoryPropertyFlags flags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
-    BufferUtils::CreateBuffer(device, bufferSize, usage, flags, buffer, bufferMemory);
+    // Copy data from buffer to staging
+    BufferUtils::CopyBuffer(device, commandPool, buffer, stagingBuffer, bufferSize);
 
-    // Copy data from staging to buffer
-    BufferUtils::CopyBuffer(device, commandPool, stagingBuffer, buffer, bufferSize);
+    // Read the staging buffer
+    memcpy(hostData, stagingBufferMemory.mappedData, static_cast<size_t>(bufferSize));
 
-    // No need for the staging buffer anymore
     vkDestroyBuffer(device->GetVkDevice(), stagingBuffer, nullptr);
-    vkFreeMemory(device->GetVkDevice(), stagingBufferMemory, nullptr);
+    device->GetAllocator()->Free(stagingBufferMemory);
 }
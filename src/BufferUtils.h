@@ -4,7 +4,11 @@
 #include "Device.h"
 
 namespace BufferUtils {
-    void CreateBuffer(Device* device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
+    // Shared buffers are used by the queues of every family without ownership transfers
+    void CreateBuffer(Device* device, VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, MemoryAllocation& bufferMemory, bool shared = false);
+    // Runs on the transfer queue, the command pool must be of its family
     void CopyBuffer(Device* device, VkCommandPool commandPool, VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
-    void CreateBufferFromData(Device* device, VkCommandPool commandPool, void* bufferData, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
+    // The buffer is shared, it is uploaded through the staging ring and used on the other queues once that is flushed
+    void CreateBufferFromData(Device* device, const void* bufferData, VkDeviceSize bufferSize, VkBufferUsageFlags bufferUsage, VkBuffer& buffer, MemoryAllocation& bufferMemory);
+    void ReadBufferToHost(Device* device, VkCommandPool commandPool, VkBuffer buffer, VkDeviceSize bufferSize, void* hostData);
 }
@@ -8,47 +8,101 @@
 #include "Camera.h"
 #include "BufferUtils.h"
 
-Camera::Camera(Device* device, float aspectRatio) : device(device) {
+CameraBufferObject Camera::CreateBufferObject(float width, float height) {
+    CameraBufferObject bufferObject;
+    bufferObject.viewMatrix = glm::lookAt(glm::vec3(0.0f, 1.0f, 10.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+    bufferObject.projectionMatrix = glm::perspective(glm::radians(45.0f), width / height, 0.1f, 100.0f);
+    bufferObject.projectionMatrix[1][1] *= -1; // y-coordinate is flipped
+    bufferObject.viewport = glm::vec4(width, height, 1.0f / width, 1.0f / height);
+    UpdateDerived(bufferObject);
+    return bufferObject;
+}
+
+void Camera::UpdateDerived(CameraBufferObject& bufferObject) {
+    bufferObject.viewProjectionMatrix = bufferObject.projectionMatrix * bufferObject.viewMatrix;
+    bufferObject.position = glm::vec4(-glm::transpose(glm::mat3(bufferObject.viewMatrix)) * glm::vec3(bufferObject.viewMatrix[3]), 1.0f);
+
+    // Planes of the clip volume -w <= x, y <= w and 0 <= z <= w, from the rows of the view projection
+    const glm::mat4 m = glm::transpose(bufferObject.viewProjectionMatrix);
+    bufferObject.frustumPlanes[0] = m[3] + m[0];
+    bufferObject.frustumPlanes[1] = m[3] - m[0];
+    bufferObject.frustumPlanes[2] = m[3] + m[1];
+    bufferObject.frustumPlanes[3] = m[3] - m[1];
+    bufferObject.frustumPlanes[4] = m[2];
+    bufferObject.frustumPlanes[5] = m[3] - m[2];
+    for (glm::vec4& plane : bufferObject.frustumPlanes) {
+        plane /= glm::length(glm::vec3(plane));
+    }
+}
+
+Camera::Camera(Device* device, float width, float height) : device(device) {
     r = 10.0f;
     theta = 0.0f;
     phi = 0.0f;
-    cameraBufferObject.viewMatrix = glm::lookAt(glm::vec3(0.0f, 1.0f, 10.0f), glm::vec3(0.0f, 1.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f));
-    cameraBufferObject.projectionMatrix = glm::perspective(glm::radians(45.0f), aspectRatio, 0.1f, 100.0f);
-    cameraBufferObject.projectionMatrix[1][1] *= -1; // y-coordinate is flipped
+    target = glm::vec3(0.0f);
+    cameraBufferObject = CreateBufferObject(width, height);
+
+    for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        // Read by the cull pass on the compute queue and by the draws on the graphics queue
+        BufferUtils::CreateBuffer(device, sizeof(CameraBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffers[frame], bufferMemories[frame], true);
+        mappedData[frame] = bufferMemories[frame].mappedData;
+        UploadBuffer(frame);
+    }
+}
 
-    BufferUtils::CreateBuffer(device, sizeof(CameraBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, bufferMemory);
-    vkMapMemory(device->GetVkDevice(), bufferMemory, 0, sizeof(CameraBufferObject), 0, &mappedData);
-    memcpy(mappedData, &cameraBufferObject, sizeof(CameraBufferObject));
+VkBuffer Camera::GetBuffer(uint32_t frame) const {
+    return buffers[frame];
 }
 
-VkBuffer Camera::GetBuffer() const {
-    return buffer;
+void Camera::UploadBuffer(uint32_t frame) {
+    memcpy(mappedData[frame], &cameraBufferObject, sizeof(CameraBufferObject));
+}
+
+const CameraBufferObject& Camera::GetBufferObject() const {
+    return cameraBufferObject;
 }
 
 void Camera::UpdateOrbit(float deltaX, float deltaY, float deltaZ) {
     theta += deltaX;
     phi += deltaY;
     r = glm::clamp(r - deltaZ, 1.0f, 50.0f);
+    updateView();
+}
+
+void Camera::Pan(float forward, float right) {
+    // The camera looks down -z before its rotation around y by theta
+    float radTheta = glm::radians(theta);
+    glm::vec3 forwardDirection(-std::sin(radTheta), 0.0f, -std::cos(radTheta));
+    glm::vec3 rightDirection(std::cos(radTheta), 0.0f, -std::sin(radTheta));
+    target += forward * forwardDirection + right * rightDirection;
+    updateView();
+}
+
+const glm::vec3& Camera::GetTarget() const {
+    return target;
+}
 
+void Camera::updateView() {
     float radTheta = glm::radians(theta);
     float radPhi = glm::radians(phi);
 
     glm::mat4 rotation = glm::rotate(glm::mat4(1.0f), radTheta, glm::vec3(0.0f, 1.0f, 0.0f)) * glm::rotate(glm::mat4(1.0f), radPhi, glm::vec3(1.0f, 0.0f, 0.0f));
-    glm::mat4 finalTransform = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f)) * rotation * glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 1.0f, r));
+    glm::mat4 finalTransform = glm::translate(glm::mat4(1.0f), target) * rotation * glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 1.0f, r));
 
     cameraBufferObject.viewMatrix = glm::inverse(finalTransform);
-
-    memcpy(mappedData, &cameraBufferObject, sizeof(CameraBufferObject));
+    UpdateDerived(cameraBufferObject);
 }
 
-void Camera::UpdateAspectRatio(float aspectRatio) {
-    cameraBufferObject.projectionMatrix = glm::perspective(glm::radians(45.0f), aspectRatio, 0.1f, 100.0f);
+void Camera::UpdateAspectRatio(float width, float height) {
+    cameraBufferObject.projectionMatrix = glm::perspective(glm::radians(45.0f), width / height, 0.1f, 100.0f);
     cameraBufferObject.projectionMatrix[1][1] *= -1; // y-coordinate is flipped
-    memcpy(mappedData, &cameraBufferObject, sizeof(CameraBufferObject));
+    cameraBufferObject.viewport = glm::vec4(width, height, 1.0f / width, 1.0f / height);
+    UpdateDerived(cameraBufferObject);
 }
 
 Camera::~Camera() {
-  vkUnmapMemory(device->GetVkDevice(), bufferMemory);
-  vkDestroyBuffer(device->GetVkDevice(), buffer, nullptr);
-  vkFreeMemory(device->GetVkDevice(), bufferMemory, nullptr);
+  for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+    vkDestroyBuffer(device->GetVkDevice(), buffers[frame], nullptr);
+    device->GetAllocator()->Free(bufferMemories[frame]);
+  }
 }
@@ -1,12 +1,23 @@
 
 #pragma once
 
+#include <array>
 #include <glm/glm.hpp>
 #include "Device.h"
 
+// Layout matches the CameraBufferObject uniform in shaders/camera.glsl
 struct CameraBufferObject {
   glm::mat4 viewMatrix;
   glm::mat4 projectionMatrix;
+  // Derived from the view and projection whenever they change, so that shaders don't recompute them per blade or patch
+  glm::mat4 viewProjectionMatrix;
+  // World space position, w = 1
+  glm::vec4 position;
+  // Left, right, bottom, top, near and far planes, normalized and pointing inside.
+  // A point p is inside a plane when dot(plane.xyz, p) + plane.w >= 0
+  glm::vec4 frustumPlanes[6];
+  // Viewport size in pixels, then its inverse
+  glm::vec4 viewport;
 };
 
 class Camera {
@@ -15,19 +26,39 @@ private:
     
     CameraBufferObject cameraBufferObject;
     
-    VkBuffer buffer;
-    VkDeviceMemory bufferMemory;
+    // One uniform copy per frame in flight, written by UploadBuffer
+    std::array<VkBuffer, MAX_FRAMES_IN_FLIGHT> buffers;
+    std::array<MemoryAllocation, MAX_FRAMES_IN_FLIGHT> bufferMemories;
 
-    void* mappedData;
+    std::array<void*, MAX_FRAMES_IN_FLIGHT> mappedData;
 
     float r, theta, phi;
+    // Point the camera orbits around, on the ground
+    glm::vec3 target;
+
+    // Rebuild the view from the orbit
+    void updateView();
 
 public:
-    Camera(Device* device, float aspectRatio);
+    Camera(Device* device, float width, float height);
     ~Camera();
 
-    VkBuffer GetBuffer() const;
+    // Initial view and projection of the orbit camera for a width x height viewport,
+    // also used without a device by the CPU benchmark
+    static CameraBufferObject CreateBufferObject(float width, float height);
+
+    // Recompute the view projection, position and frustum planes from the view and projection
+    static void UpdateDerived(CameraBufferObject& bufferObject);
+
+    VkBuffer GetBuffer(uint32_t frame) const;
+    const CameraBufferObject& GetBufferObject() const;
+    // Copy the buffer object to the uniform copy of the frame, which the GPU must be done with
+    void UploadBuffer(uint32_t frame);
     
     void UpdateOrbit(float deltaX, float deltaY, float deltaZ);
-    void UpdateAspectRatio(float aspectRatio);  // Add this method
+    // Move the target along the ground, forward is where the camera looks and right is to its right
+    void Pan(float forward, float right);
+    const glm::vec3& GetTarget() const;
+    // Projection for a width x height viewport
+    void UpdateAspectRatio(float width, float height);
 };
@@ -1,8 +1,11 @@
+#include <algorithm>
 #include "Device.h"
 #include "Instance.h"
 
 Device::Device(Instance* instance, VkDevice vkDevice, Queues queues)
   : instance(instance), vkDevice(vkDevice), queues(queues) {
+    allocator = new MemoryAllocator(this);
+    stagingRing = new StagingRing(this);
 }
 
 Instance* Device::GetInstance() {
@@ -21,10 +24,31 @@ unsigned int Device::GetQueueIndex(QueueFlags flag) {
     return GetInstance()->GetQueueFamilyIndices()[flag];
 }
 
+std::vector<uint32_t> Device::GetQueueFamilies() {
+    std::vector<uint32_t> families;
+    for (QueueFlags flag : { QueueFlags::Graphics, QueueFlags::Compute, QueueFlags::Transfer }) {
+        int family = GetInstance()->GetQueueFamilyIndices()[flag];
+        if (queues[flag] != VK_NULL_HANDLE && family >= 0 && std::find(families.begin(), families.end(), static_cast<uint32_t>(family)) == families.end()) {
+            families.push_back(static_cast<uint32_t>(family));
+        }
+    }
+    return families;
+}
+
+MemoryAllocator* Device::GetAllocator() {
+    return allocator;
+}
+
+StagingRing* Device::GetStagingRing() {
+    return stagingRing;
+}
+
 SwapChain* Device::CreateSwapChain(VkSurfaceKHR surface, unsigned int numBuffers) {
     return new SwapChain(this, surface, numBuffers);
 }
 
 Device::~Device() {
+    delete stagingRing;
+    delete allocator;
     vkDestroyDevice(vkDevice, nullptr);
 }
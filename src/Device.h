@@ -2,10 +2,17 @@
 
 #include <array>
 #include <stdexcept>
+#include <vector>
 #include <vulkan/vulkan.h>
 #include "QueueFlags.h"
+#include "MemoryAllocator.h"
+#include "StagingRing.h"
 #include "SwapChain.h"
 
+// Frames the CPU may prepare while the GPU still runs earlier ones. Each frame has its own fence, semaphores,
+// command buffers, uniform copies and culled blades, and waits for the frame that last used them
+constexpr static unsigned int MAX_FRAMES_IN_FLIGHT = 2;
+
 class SwapChain;
 class Device {
     friend class Instance;
@@ -16,6 +23,12 @@ public:
     VkDevice GetVkDevice();
     VkQueue GetQueue(QueueFlags flag);
     unsigned int GetQueueIndex(QueueFlags flag);
+    // Distinct families of the graphics, compute and transfer queues the device was created with
+    std::vector<uint32_t> GetQueueFamilies();
+    // Every buffer and image of the device takes its memory from here
+    MemoryAllocator* GetAllocator();
+    // Uploads to shared buffers and images, flushed by the renderer at the start of every frame
+    StagingRing* GetStagingRing();
     ~Device();
 
 private:
@@ -27,4 +40,6 @@ private:
     Instance* instance;
     VkDevice vkDevice;
     Queues queues;
+    MemoryAllocator* allocator;
+    StagingRing* stagingRing;
 };
@@ -88,7 +88,14 @@ Instance::Instance(const char* applicationName, unsigned int additionalExtension
     appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
     appInfo.pEngineName = "No Engine";
     appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-    appInfo.apiVersion = VK_API_VERSION_1_0;
+    // Vulkan 1.1 is needed to query subgroup support, older loaders do not have vkEnumerateInstanceVersion
+    apiVersion = VK_API_VERSION_1_0;
+    auto enumerateInstanceVersion = (PFN_vkEnumerateInstanceVersion)vkGetInstanceProcAddr(nullptr, "vkEnumerateInstanceVersion");
+    uint32_t loaderVersion;
+    if (enumerateInstanceVersion != nullptr && enumerateInstanceVersion(&loaderVersion) == VK_SUCCESS && loaderVersion >= VK_API_VERSION_1_1) {
+        apiVersion = VK_API_VERSION_1_1;
+    }
+    appInfo.apiVersion = apiVersion;
     
     // --- Create Vulkan instance ---
     VkInstanceCreateInfo createInfo = {};
@@ -156,6 +163,23 @@ const std::vector<VkPresentModeKHR>& Instance::GetPresentModes() const {
     return presentModes;
 }
 
+const VkPhysicalDeviceSubgroupProperties& Instance::GetSubgroupProperties() const {
+    return subgroupProperties;
+}
+
+const VkPhysicalDeviceTimelineSemaphoreFeaturesKHR& Instance::GetTimelineSemaphoreFeatures() const {
+    return timelineSemaphoreFeatures;
+}
+
+bool Instance::IsDeviceExtensionEnabled(const char* extensionName) const {
+    for (const char* enabledExtension : deviceExtensions) {
+        if (strcmp(enabledExtension, extensionName) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
 uint32_t Instance::GetMemoryTypeIndex(uint32_t typeBits, VkMemoryPropertyFlags properties) const {
     // Iterate over all memory types available for the device used in this example
     for (uint32_t i = 0; i < deviceMemoryProperties.memoryTypeCount; i++) {
@@ -216,55 +240,57 @@ namespace {
         std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
         vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
 
-        VkQueueFlags requiredVulkanQueues = 0;
-        if (requiredQueues[QueueFlags::Graphics]) {
-            requiredVulkanQueues |= VK_QUEUE_GRAPHICS_BIT;
-        }
-        if (requiredQueues[QueueFlags::Compute]) {
-            requiredVulkanQueues |= VK_QUEUE_COMPUTE_BIT;
-        }
-        if (requiredQueues[QueueFlags::Transfer]) {
-            requiredVulkanQueues |= VK_QUEUE_TRANSFER_BIT;
-        }
-
         QueueFamilyIndices indices = {};
         indices.fill(-1);
-        VkQueueFlags supportedQueues = 0;
         bool needsPresent = requiredQueues[QueueFlags::Present];
-        bool presentSupported = false;
-
-        int i = 0;
-        for (const auto& queueFamily : queueFamilies) {
-            if (queueFamily.queueCount > 0) {
-                supportedQueues |= queueFamily.queueFlags;
-            }
-
-            if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-                indices[QueueFlags::Graphics] = i;
-            }
-
-            if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) {
-                indices[QueueFlags::Compute] = i;
-            }
+        std::vector<VkBool32> presentSupport(queueFamilyCount, VK_FALSE);
 
-            if (queueFamily.queueCount > 0 && queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) {
-                indices[QueueFlags::Transfer] = i;
+        for (uint32_t i = 0; i < queueFamilyCount; ++i) {
+            if (queueFamilies[i].queueCount > 0 && needsPresent) {
+                vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport[i]);
             }
+        }
 
-            if (needsPresent) {
-                VkBool32 presentSupport = false;
-                vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
-                if (queueFamily.queueCount > 0 && presentSupport) {
-                    presentSupported = true;
-                    indices[QueueFlags::Present] = i;
+        // First family with all of the flags and none of the avoided ones, -1 when there is none
+        auto findFamily = [&](VkQueueFlags flags, VkQueueFlags avoidedFlags) {
+            for (uint32_t i = 0; i < queueFamilyCount; ++i) {
+                if (queueFamilies[i].queueCount > 0 && (queueFamilies[i].queueFlags & flags) == flags && !(queueFamilies[i].queueFlags & avoidedFlags)) {
+                    return static_cast<int>(i);
                 }
             }
+            return -1;
+        };
 
-            if ((requiredVulkanQueues & supportedQueues) == requiredVulkanQueues && (!needsPresent || presentSupported)) {
+        // Graphics and present on the same family when there is one
+        for (uint32_t i = 0; i < queueFamilyCount && needsPresent; ++i) {
+            if (queueFamilies[i].queueCount > 0 && (queueFamilies[i].queueFlags & VK_QUEUE_GRAPHICS_BIT) && presentSupport[i]) {
+                indices[QueueFlags::Graphics] = i;
+                indices[QueueFlags::Present] = i;
                 break;
             }
+        }
+        if (indices[QueueFlags::Graphics] < 0) {
+            indices[QueueFlags::Graphics] = findFamily(VK_QUEUE_GRAPHICS_BIT, 0);
+        }
+        for (uint32_t i = 0; i < queueFamilyCount && needsPresent && indices[QueueFlags::Present] < 0; ++i) {
+            if (queueFamilies[i].queueCount > 0 && presentSupport[i]) {
+                indices[QueueFlags::Present] = i;
+            }
+        }
+
+        // Compute on a family without graphics runs alongside the graphics work, otherwise it shares the graphics family
+        const int graphicsFamily = indices[QueueFlags::Graphics];
+        const bool graphicsCompute = graphicsFamily >= 0 && (queueFamilies[graphicsFamily].queueFlags & VK_QUEUE_COMPUTE_BIT);
+        indices[QueueFlags::Compute] = findFamily(VK_QUEUE_COMPUTE_BIT, VK_QUEUE_GRAPHICS_BIT);
+        if (indices[QueueFlags::Compute] < 0) {
+            indices[QueueFlags::Compute] = graphicsCompute ? graphicsFamily : findFamily(VK_QUEUE_COMPUTE_BIT, 0);
+        }
 
-            i++;
+        // Transfer on a family with neither graphics nor compute is a copy engine of its own. Graphics and compute
+        // families support transfers whether or not they report it
+        indices[QueueFlags::Transfer] = findFamily(VK_QUEUE_TRANSFER_BIT, VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT);
+        if (indices[QueueFlags::Transfer] < 0) {
+            indices[QueueFlags::Transfer] = graphicsFamily >= 0 ? graphicsFamily : findFamily(VK_QUEUE_TRANSFER_BIT, 0);
         }
 
         return indices;
@@ -288,7 +314,7 @@ namespace {
     }
 }
 
-void Instance::PickPhysicalDevice(std::vector<const char*> deviceExtensions, QueueFlagBits requiredQueues, VkSurfaceKHR surface) {
+void Instance::PickPhysicalDevice(std::vector<const char*> deviceExtensions, QueueFlagBits requiredQueues, VkSurfaceKHR surface, std::vector<const char*> optionalDeviceExtensions) {
     // List the graphics cards on the machine
     uint32_t deviceCount = 0;
     vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
@@ -342,13 +368,46 @@ void Instance::PickPhysicalDevice(std::vector<const char*> deviceExtensions, Que
         }
     }
 
-    this->deviceExtensions = deviceExtensions;
-    
     if (physicalDevice == VK_NULL_HANDLE) {
         throw std::runtime_error("Failed to find a suitable GPU");
     }
 
+    this->deviceExtensions = deviceExtensions;
+    for (const char* extension : optionalDeviceExtensions) {
+        if (checkDeviceExtensionSupport(physicalDevice, { extension })) {
+            this->deviceExtensions.push_back(extension);
+        }
+    }
+
     vkGetPhysicalDeviceMemoryProperties(physicalDevice, &deviceMemoryProperties);
+
+    // Subgroup properties are core in 1.1, leave them empty (no supported operations) otherwise
+    subgroupProperties = {};
+    subgroupProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SUBGROUP_PROPERTIES;
+
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+    auto getPhysicalDeviceProperties2 = (PFN_vkGetPhysicalDeviceProperties2)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceProperties2");
+    if (apiVersion >= VK_API_VERSION_1_1 && deviceProperties.apiVersion >= VK_API_VERSION_1_1 && getPhysicalDeviceProperties2 != nullptr) {
+        VkPhysicalDeviceProperties2 properties2 = {};
+        properties2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+        properties2.pNext = &subgroupProperties;
+        getPhysicalDeviceProperties2(physicalDevice, &properties2);
+    }
+
+    // Timeline semaphores are a feature of their extension, left unsupported without the extension or 1.1
+    timelineSemaphoreFeatures = {};
+    timelineSemaphoreFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+
+    auto getPhysicalDeviceFeatures2 = (PFN_vkGetPhysicalDeviceFeatures2)vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2");
+    if (IsDeviceExtensionEnabled(VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME) &&
+        apiVersion >= VK_API_VERSION_1_1 && deviceProperties.apiVersion >= VK_API_VERSION_1_1 && getPhysicalDeviceFeatures2 != nullptr) {
+        VkPhysicalDeviceFeatures2 features2 = {};
+        features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+        features2.pNext = &timelineSemaphoreFeatures;
+        getPhysicalDeviceFeatures2(physicalDevice, &features2);
+        timelineSemaphoreFeatures.pNext = nullptr;
+    }
 }
 
 Device* Instance::CreateDevice(QueueFlagBits requiredQueues, VkPhysicalDeviceFeatures deviceFeatures) {
@@ -385,6 +444,12 @@ Device* Instance::CreateDevice(QueueFlagBits requiredQueues, VkPhysicalDeviceFea
 
     createInfo.pEnabledFeatures = &deviceFeatures;
 
+    // Features of the optional extensions are only requested when supported
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineFeatures = timelineSemaphoreFeatures;
+    if (timelineFeatures.timelineSemaphore) {
+        createInfo.pNext = &timelineFeatures;
+    }
+
     // Enable device-specific extensions and validation layers
     createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
     createInfo.ppEnabledExtensionNames = deviceExtensions.data();
@@ -402,7 +467,7 @@ Device* Instance::CreateDevice(QueueFlagBits requiredQueues, VkPhysicalDeviceFea
         throw std::runtime_error("Failed to create logical device");
     }
 
-    Device::Queues queues;
+    Device::Queues queues = {};
     for (unsigned int i = 0; i < requiredQueues.size(); ++i) {
         if (requiredQueues[i]) {
             vkGetDeviceQueue(vkDevice, queueFamilyIndices[i], 0, &queues[i]);
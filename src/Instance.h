@@ -20,11 +20,18 @@ public:
     const VkSurfaceCapabilitiesKHR& GetSurfaceCapabilities() const;
     const std::vector<VkSurfaceFormatKHR>& GetSurfaceFormats() const;
     const std::vector<VkPresentModeKHR>& GetPresentModes() const;
+    const VkPhysicalDeviceSubgroupProperties& GetSubgroupProperties() const;
+    // timelineSemaphore is set when VK_KHR_timeline_semaphore is enabled and the device supports the feature,
+    // which is then enabled on the logical device
+    const VkPhysicalDeviceTimelineSemaphoreFeaturesKHR& GetTimelineSemaphoreFeatures() const;
+    // Whether the logical device is created with the extension, required or optional
+    bool IsDeviceExtensionEnabled(const char* extensionName) const;
     
     uint32_t GetMemoryTypeIndex(uint32_t types, VkMemoryPropertyFlags properties) const;
     VkFormat GetSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features) const;
 
-    void PickPhysicalDevice(std::vector<const char*> deviceExtensions, QueueFlagBits requiredQueues, VkSurfaceKHR surface = VK_NULL_HANDLE);
+    // Optional extensions are enabled when the picked device supports them, and do not affect which device is picked
+    void PickPhysicalDevice(std::vector<const char*> deviceExtensions, QueueFlagBits requiredQueues, VkSurfaceKHR surface = VK_NULL_HANDLE, std::vector<const char*> optionalDeviceExtensions = {});
 
     Device* CreateDevice(QueueFlagBits requiredQueues, VkPhysicalDeviceFeatures deviceFeatures);
 
@@ -44,4 +51,7 @@ private:
     std::vector<VkSurfaceFormatKHR> surfaceFormats;
     std::vector<VkPresentModeKHR> presentModes;
     VkPhysicalDeviceMemoryProperties deviceMemoryProperties;
+    VkPhysicalDeviceSubgroupProperties subgroupProperties = {};
+    VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineSemaphoreFeatures = {};
+    uint32_t apiVersion;
 };
@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <iterator>
+#include <stdexcept>
+#include "MemoryAllocator.h"
+#include "Device.h"
+#include "Instance.h"
+
+namespace {
+    VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}
+
+MemoryAllocator::MemoryAllocator(Device* device) : device(device), usedBytes(0) {
+    vkGetPhysicalDeviceMemoryProperties(device->GetInstance()->GetPhysicalDevice(), &memoryProperties);
+
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(device->GetInstance()->GetPhysicalDevice(), &deviceProperties);
+    nonCoherentAtomSize = std::max<VkDeviceSize>(deviceProperties.limits.nonCoherentAtomSize, 1);
+}
+
+uint32_t MemoryAllocator::createBlock(uint32_t memoryType, VkDeviceSize size, bool linear, bool dedicated) {
+    VkMemoryAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    allocInfo.allocationSize = size;
+    allocInfo.memoryTypeIndex = memoryType;
+
+    Block* block = new Block();
+    if (vkAllocateMemory(device->GetVkDevice(), &allocInfo, nullptr, &block->memory) != VK_SUCCESS) {
+        delete block;
+        throw std::runtime_error("Failed to allocate device memory");
+    }
+    block->size = size;
+    block->memoryType = memoryType;
+    block->linear = linear;
+    block->dedicated = dedicated;
+    block->mappedData = nullptr;
+    block->freeRanges[0] = size;
+    block->allocationCount = 0;
+
+    // Host visible blocks are mapped once, a memory object cannot be mapped by each of its resources
+    if (memoryProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) {
+        vkMapMemory(device->GetVkDevice(), block->memory, 0, VK_WHOLE_SIZE, 0, &block->mappedData);
+    }
+
+    auto slot = std::find(blocks.begin(), blocks.end(), nullptr);
+    if (slot != blocks.end()) {
+        *slot = block;
+        return static_cast<uint32_t>(slot - blocks.begin());
+    }
+    blocks.push_back(block);
+    return static_cast<uint32_t>(blocks.size() - 1);
+}
+
+bool MemoryAllocator::allocateFromBlock(uint32_t blockIndex, VkDeviceSize size, VkDeviceSize alignment, MemoryAllocation& allocation) {
+    Block* block = blocks[blockIndex];
+    for (auto range = block->freeRanges.begin(); range != block->freeRanges.end(); ++range) {
+        const VkDeviceSize start = range->first;
+        const VkDeviceSize end = range->first + range->second;
+        const VkDeviceSize offset = alignUp(start, alignment);
+        if (offset + size > end) {
+            continue;
+        }
+
+        // The padding in front and the rest stay free
+        block->freeRanges.erase(range);
+        if (offset > start) {
+            block->freeRanges[start] = offset - start;
+        }
+        if (offset + size < end) {
+            block->freeRanges[offset + size] = end - offset - size;
+        }
+
+        allocation.memory = block->memory;
+        allocation.offset = offset;
+        allocation.size = size;
+        allocation.mappedData = block->mappedData != nullptr ? static_cast<char*>(block->mappedData) + offset : nullptr;
+        allocation.block = blockIndex;
+        ++block->allocationCount;
+        usedBytes += size;
+        return true;
+    }
+    return false;
+}
+
+MemoryAllocation MemoryAllocator::Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear) {
+    const uint32_t memoryType = device->GetInstance()->GetMemoryTypeIndex(requirements.memoryTypeBits, properties);
+    const VkMemoryPropertyFlags typeProperties = memoryProperties.memoryTypes[memoryType].propertyFlags;
+
+    // Memory that is not host coherent is flushed in whole atoms, which must not reach into other resources
+    VkDeviceSize alignment = std::max<VkDeviceSize>(requirements.alignment, 1);
+    VkDeviceSize size = requirements.size;
+    if ((typeProperties & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(typeProperties & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+        alignment = std::max(alignment, nonCoherentAtomSize);
+        size = alignUp(size, nonCoherentAtomSize);
+    }
+
+    // Small heaps, such as host visible device local memory, get smaller blocks
+    const VkDeviceSize heapSize = memoryProperties.memoryHeaps[memoryProperties.memoryTypes[memoryType].heapIndex].size;
+    const VkDeviceSize blockSize = std::min(MEMORY_BLOCK_SIZE, heapSize / 8);
+
+    MemoryAllocation allocation;
+    if (size > blockSize / 2) {
+        allocateFromBlock(createBlock(memoryType, size, linear, true), size, alignment, allocation);
+        return allocation;
+    }
+
+    for (uint32_t i = 0; i < blocks.size(); ++i) {
+        Block* block = blocks[i];
+        if (block != nullptr && !block->dedicated && block->memoryType == memoryType && block->linear == linear &&
+            allocateFromBlock(i, size, alignment, allocation)) {
+            return allocation;
+        }
+    }
+
+    allocateFromBlock(createBlock(memoryType, blockSize, linear, false), size, alignment, allocation);
+    return allocation;
+}
+
+void MemoryAllocator::Free(MemoryAllocation& allocation) {
+    if (allocation.memory == VK_NULL_HANDLE) {
+        return;
+    }
+
+    Block* block = blocks[allocation.block];
+    --block->allocationCount;
+    usedBytes -= allocation.size;
+
+    if (block->dedicated) {
+        if (block->mappedData != nullptr) {
+            vkUnmapMemory(device->GetVkDevice(), block->memory);
+        }
+        vkFreeMemory(device->GetVkDevice(), block->memory, nullptr);
+        delete block;
+        blocks[allocation.block] = nullptr;
+        allocation = MemoryAllocation();
+        return;
+    }
+
+    // Merge the range with the free ones right after and right before it. Emptied blocks are kept for reuse
+    VkDeviceSize start = allocation.offset;
+    VkDeviceSize end = allocation.offset + allocation.size;
+    auto next = block->freeRanges.lower_bound(start);
+    if (next != block->freeRanges.end() && next->first == end) {
+        end += next->second;
+        next = block->freeRanges.erase(next);
+    }
+    if (next != block->freeRanges.begin()) {
+        auto previous = std::prev(next);
+        if (previous->first + previous->second == start) {
+            start = previous->first;
+            block->freeRanges.erase(previous);
+        }
+    }
+    block->freeRanges[start] = end - start;
+
+    allocation = MemoryAllocation();
+}
+
+void MemoryAllocator::Flush(const MemoryAllocation& allocation, VkDeviceSize offset, VkDeviceSize size) {
+    if (allocation.memory == VK_NULL_HANDLE || size == 0) {
+        return;
+    }
+
+    const Block* block = blocks[allocation.block];
+    if (memoryProperties.memoryTypes[block->memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) {
+        return;
+    }
+
+    // The allocation starts and ends on atoms, so rounding the range out stays within it
+    const VkDeviceSize allocationEnd = allocation.offset + allocation.size;
+    VkDeviceSize end = size == VK_WHOLE_SIZE ? allocationEnd : std::min(alignUp(allocation.offset + offset + size, nonCoherentAtomSize), allocationEnd);
+
+    VkMappedMemoryRange range = {};
+    range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+    range.memory = allocation.memory;
+    range.offset = (allocation.offset + offset) / nonCoherentAtomSize * nonCoherentAtomSize;
+    range.size = end - range.offset;
+    vkFlushMappedMemoryRanges(device->GetVkDevice(), 1, &range);
+}
+
+MemoryStats MemoryAllocator::GetStats() const {
+    MemoryStats stats = {};
+    for (const Block* block : blocks) {
+        if (block != nullptr) {
+            ++stats.blockCount;
+            stats.allocationCount += block->allocationCount;
+            stats.blockBytes += block->size;
+        }
+    }
+    stats.usedBytes = usedBytes;
+    return stats;
+}
+
+MemoryAllocator::~MemoryAllocator() {
+    for (Block* block : blocks) {
+        if (block != nullptr) {
+            if (block->mappedData != nullptr) {
+                vkUnmapMemory(device->GetVkDevice(), block->memory);
+            }
+            vkFreeMemory(device->GetVkDevice(), block->memory, nullptr);
+            delete block;
+        }
+    }
+}
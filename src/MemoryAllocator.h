@@ -0,0 +1,77 @@
+#pragma once
+
+#include <map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+class Device;
+
+// Size of the device memory blocks resources are sub-allocated from, smaller on heaps that could not hold a few.
+// Resources larger than half a block get a block of their own
+constexpr static VkDeviceSize MEMORY_BLOCK_SIZE = 64 * 1024 * 1024;
+
+// Range of a device memory block bound to one buffer or image
+struct MemoryAllocation {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+    // Start of the range in host visible memory, which stays mapped. Null otherwise
+    void* mappedData = nullptr;
+    // Index of the block in MemoryAllocator
+    uint32_t block = 0;
+};
+
+struct MemoryStats {
+    // Device memory allocations made, each one a block
+    uint32_t blockCount;
+    // Buffers and images living in the blocks
+    uint32_t allocationCount;
+    VkDeviceSize blockBytes;
+    // Bytes of the blocks taken by buffers and images, alignment padding excluded
+    VkDeviceSize usedBytes;
+};
+
+// Sub-allocates buffers and images from large blocks of device memory, one set of blocks per memory type.
+// Free ranges of each block are kept sorted by offset, taken first fit and merged with their neighbours
+// when freed. Linear resources (buffers) and optimal images never share a block, so bufferImageGranularity
+// does not apply
+class MemoryAllocator {
+private:
+    struct Block {
+        VkDeviceMemory memory;
+        VkDeviceSize size;
+        uint32_t memoryType;
+        bool linear;
+        // Whole block for one resource, given back to the device with it
+        bool dedicated;
+        void* mappedData;
+        // Offset to size of each free range
+        std::map<VkDeviceSize, VkDeviceSize> freeRanges;
+        uint32_t allocationCount;
+    };
+
+    Device* device;
+    VkPhysicalDeviceMemoryProperties memoryProperties;
+    VkDeviceSize nonCoherentAtomSize;
+
+    // Null once a dedicated block is given back, the slot is then reused
+    std::vector<Block*> blocks;
+    VkDeviceSize usedBytes;
+
+    // Index of the new block
+    uint32_t createBlock(uint32_t memoryType, VkDeviceSize size, bool linear, bool dedicated);
+    bool allocateFromBlock(uint32_t blockIndex, VkDeviceSize size, VkDeviceSize alignment, MemoryAllocation& allocation);
+
+public:
+    MemoryAllocator(Device* device);
+    ~MemoryAllocator();
+
+    // Linear is set for buffers and linear images, clear for optimal images
+    MemoryAllocation Allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear);
+    // Leaves the allocation empty, freeing an empty allocation does nothing
+    void Free(MemoryAllocation& allocation);
+    // Make host writes to a range of the allocation visible, for memory that is not host coherent
+    void Flush(const MemoryAllocation& allocation, VkDeviceSize offset, VkDeviceSize size);
+
+    MemoryStats GetStats() const;
+};
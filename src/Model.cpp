@@ -2,34 +2,36 @@
 #include "BufferUtils.h"
 #include "Image.h"
 
-Model::Model(Device* device, VkCommandPool commandPool, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices)
+Model::Model(Device* device, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices)
   : device(device), vertices(vertices), indices(indices) {
 
     if (vertices.size() > 0) {
-        BufferUtils::CreateBufferFromData(device, commandPool, this->vertices.data(), vertices.size() * sizeof(Vertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBuffer, vertexBufferMemory);
+        BufferUtils::CreateBufferFromData(device, this->vertices.data(), vertices.size() * sizeof(Vertex), VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, vertexBuffer, vertexBufferMemory);
     }
 
     if (indices.size() > 0) {
-        BufferUtils::CreateBufferFromData(device, commandPool, this->indices.data(), indices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indexBuffer, indexBufferMemory);
+        BufferUtils::CreateBufferFromData(device, this->indices.data(), indices.size() * sizeof(uint32_t), VK_BUFFER_USAGE_INDEX_BUFFER_BIT, indexBuffer, indexBufferMemory);
     }
 
     modelBufferObject.modelMatrix = glm::mat4(1.0f);
-    BufferUtils::CreateBufferFromData(device, commandPool, &modelBufferObject, sizeof(ModelBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, modelBuffer, modelBufferMemory);
+    BufferUtils::CreateBuffer(device, sizeof(ModelBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, modelBuffer, modelBufferMemory);
+    mappedModelData = modelBufferMemory.mappedData;
+    memcpy(mappedModelData, &modelBufferObject, sizeof(ModelBufferObject));
 }
 
 Model::~Model() {
     if (indices.size() > 0) {
         vkDestroyBuffer(device->GetVkDevice(), indexBuffer, nullptr);
-        vkFreeMemory(device->GetVkDevice(), indexBufferMemory, nullptr);
+        device->GetAllocator()->Free(indexBufferMemory);
     }
 
     if (vertices.size() > 0) {
         vkDestroyBuffer(device->GetVkDevice(), vertexBuffer, nullptr);
-        vkFreeMemory(device->GetVkDevice(), vertexBufferMemory, nullptr);
+        device->GetAllocator()->Free(vertexBufferMemory);
     }
 
     vkDestroyBuffer(device->GetVkDevice(), modelBuffer, nullptr);
-    vkFreeMemory(device->GetVkDevice(), modelBufferMemory, nullptr);
+    device->GetAllocator()->Free(modelBufferMemory);
 
     if (textureView != VK_NULL_HANDLE) {
         vkDestroyImageView(device->GetVkDevice(), textureView, nullptr);
@@ -82,6 +84,11 @@ void Model::SetTexture(VkImage texture) {
     }
 }
 
+void Model::SetModelMatrix(const glm::mat4& modelMatrix) {
+    modelBufferObject.modelMatrix = modelMatrix;
+    memcpy(mappedModelData, &modelBufferObject, sizeof(ModelBufferObject));
+}
+
 const std::vector<Vertex>& Model::getVertices() const {
     return vertices;
 }
@@ -17,14 +17,15 @@ protected:
 
     std::vector<Vertex> vertices;
     VkBuffer vertexBuffer;
-    VkDeviceMemory vertexBufferMemory;
+    MemoryAllocation vertexBufferMemory;
 
     std::vector<uint32_t> indices;
     VkBuffer indexBuffer;
-    VkDeviceMemory indexBufferMemory;
+    MemoryAllocation indexBufferMemory;
 
     VkBuffer modelBuffer;
-    VkDeviceMemory modelBufferMemory;
+    MemoryAllocation modelBufferMemory;
+    void* mappedModelData;
 
     ModelBufferObject modelBufferObject;
 
@@ -34,11 +35,14 @@ protected:
 
 public:
     Model() = delete;
-    Model(Device* device, VkCommandPool commandPool, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices);
+    Model(Device* device, const std::vector<Vertex> &vertices, const std::vector<uint32_t> &indices);
     virtual ~Model();
 
     void SetTexture(VkImage texture);
 
+    // Written straight to the uniform buffer, like the camera
+    void SetModelMatrix(const glm::mat4& modelMatrix);
+
     const std::vector<Vertex>& getVertices() const;
 
     VkBuffer getVertexBuffer() const;
@@ -1,53 +1,186 @@
+#include <algorithm>
+#include <cstddef>
+#include <limits>
 #include "Renderer.h"
+#include "BufferUtils.h"
 #include "Instance.h"
 #include "ShaderModule.h"
 #include "Vertex.h"
 #include "Blades.h"
 #include "Camera.h"
 #include "Image.h"
+#include "BladeSimulator.h"
 
 static constexpr unsigned int WORKGROUP_SIZE = 32;
+// Mirrors USE_OCCLUSION_CULLING in shaders/blades.glsl
+#define USE_OCCLUSION_CULLING 1
+// Workgroup size of hiz.comp on each axis
+static constexpr unsigned int HIZ_WORKGROUP_SIZE = 8;
+// Enough levels for a 32768 x 32768 depth attachment
+static constexpr unsigned int HIZ_MAX_LEVELS = 16;
+// Vertices grass_pull.vert draws per near blade, mirrors PULL_VERTICES_PER_BLADE in shaders/blade_lod.glsl
+static constexpr unsigned int PULL_VERTICES_PER_BLADE = 17;
+
+namespace {
+    VkBufferMemoryBarrier bufferBarrier(VkBuffer buffer, VkAccessFlags srcAccessMask, VkAccessFlags dstAccessMask) {
+        VkBufferMemoryBarrier barrier = {};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = srcAccessMask;
+        barrier.dstAccessMask = dstAccessMask;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.buffer = buffer;
+        barrier.offset = 0;
+        barrier.size = VK_WHOLE_SIZE;
+        return barrier;
+    }
+}
 
-Renderer::Renderer(Device* device, SwapChain* swapChain, Scene* scene, Camera* camera)
+Renderer::Renderer(Device* device, SwapChain* swapChain, Scene* scene, Camera* camera, bool vertexPulling)
   : device(device),
     logicalDevice(device->GetVkDevice()),
     swapChain(swapChain),
     scene(scene),
-    camera(camera) {
+    camera(camera),
+    frameIndex(0),
+    sleepingBlades(0),
+    retestedBlades(0),
+    reusedBlades(0),
+    cpuSimulation(device->GetInstance()->GetQueueFamilyIndices()[QueueFlags::Compute] < 0),
+    bladeSimulator(nullptr),
+    vertexPulling(vertexPulling) {
+
+#if USE_DENSITY_SPAWNING
+    if (cpuSimulation) {
+        throw std::runtime_error("Spawning blades from the density map requires a compute queue");
+    }
+#endif
+
+    if (cpuSimulation) {
+        bladeSimulator = new BladeSimulator(0);
+        std::cout << "No compute queue available, simulating blades on " << bladeSimulator->GetThreadCount() << " CPU threads" << std::endl;
+    }
+
+    // Compute and transfer only overlap the graphics work when they have families of their own
+    const unsigned int graphicsFamily = device->GetQueueIndex(QueueFlags::Graphics);
+    const unsigned int transferFamily = device->GetQueueIndex(QueueFlags::Transfer);
+    std::cout << "Queue families: graphics " << graphicsFamily;
+    if (!cpuSimulation) {
+        const unsigned int computeFamily = device->GetQueueIndex(QueueFlags::Compute);
+        std::cout << ", compute " << computeFamily << (computeFamily != graphicsFamily ? " (async)" : " (shared with graphics)");
+    }
+    std::cout << ", transfer " << transferFamily << (transferFamily != graphicsFamily && transferFamily != device->GetQueueIndex(QueueFlags::Compute) ? " (dedicated)" : " (shared)") << std::endl;
+    queueOwnershipTransfer = !cpuSimulation && device->GetQueueIndex(QueueFlags::Compute) != graphicsFamily;
+
+    // cull_subgroup.comp scans the per-subgroup counts within the first subgroup,
+    // so all subgroups of a workgroup have to fit in one
+    const VkPhysicalDeviceSubgroupProperties& subgroupProperties = device->GetInstance()->GetSubgroupProperties();
+    const VkSubgroupFeatureFlags requiredSubgroupOperations = VK_SUBGROUP_FEATURE_BASIC_BIT | VK_SUBGROUP_FEATURE_BALLOT_BIT | VK_SUBGROUP_FEATURE_ARITHMETIC_BIT;
+    subgroupCompaction = (subgroupProperties.supportedStages & VK_SHADER_STAGE_COMPUTE_BIT) &&
+        (subgroupProperties.supportedOperations & requiredSubgroupOperations) == requiredSubgroupOperations &&
+        subgroupProperties.subgroupSize * subgroupProperties.subgroupSize >= WORKGROUP_SIZE;
+    if (!cpuSimulation) {
+        std::cout << "Compacting culled blades with " << (subgroupCompaction ? "subgroup ballots" : "a workgroup scan") << std::endl;
+    }
+
+    // The depth pyramid is reduced with a compute shader right after the graphics pass that rendered the depth
+    uint32_t queueFamilyCount = 0;
+    vkGetPhysicalDeviceQueueFamilyProperties(device->GetInstance()->GetPhysicalDevice(), &queueFamilyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+    vkGetPhysicalDeviceQueueFamilyProperties(device->GetInstance()->GetPhysicalDevice(), &queueFamilyCount, queueFamilies.data());
+    occlusionCulling = USE_OCCLUSION_CULLING && !cpuSimulation &&
+        (queueFamilies[device->GetQueueIndex(QueueFlags::Graphics)].queueFlags & VK_QUEUE_COMPUTE_BIT);
+    if (!cpuSimulation) {
+        std::cout << "Occlusion culling against the previous frame's depth " << (occlusionCulling ? "enabled" : "disabled") << std::endl;
+    }
+
+    // The cull passes are timed on the compute queue, when its family writes timestamps
+    cullQueryPool = VK_NULL_HANDLE;
+    timestampPeriod = 0.0f;
+    cullTime = 0.0f;
+    if (!cpuSimulation && queueFamilies[device->GetQueueIndex(QueueFlags::Compute)].timestampValidBits > 0) {
+        VkPhysicalDeviceProperties deviceProperties;
+        vkGetPhysicalDeviceProperties(device->GetInstance()->GetPhysicalDevice(), &deviceProperties);
+        timestampPeriod = deviceProperties.limits.timestampPeriod;
+
+        VkQueryPoolCreateInfo queryPoolInfo = {};
+        queryPoolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        queryPoolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        queryPoolInfo.queryCount = static_cast<uint32_t>(2 * MAX_FRAMES_IN_FLIGHT * scene->GetBlades().size());
+        if (vkCreateQueryPool(logicalDevice, &queryPoolInfo, nullptr, &cullQueryPool) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create query pool");
+        }
+    }
+    std::cout << "Drawing near blades with " << (vertexPulling ? "vertex pulling" : "tessellation") << std::endl;
+
+    drawIndirectCount = device->GetInstance()->IsDeviceExtensionEnabled(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+    cmdDrawIndirectCount = drawIndirectCount ? (PFN_vkCmdDrawIndirectCountKHR)vkGetDeviceProcAddr(logicalDevice, "vkCmdDrawIndirectCountKHR") : nullptr;
+    drawIndirectCount = cmdDrawIndirectCount != nullptr;
+    std::cout << "Skipping empty LOD tiers " << (drawIndirectCount ? "with GPU draw counts" : "by drawing zero instances") << std::endl;
+
+    timelineSemaphores = device->GetInstance()->GetTimelineSemaphoreFeatures().timelineSemaphore == VK_TRUE;
+    waitTimelineSemaphores = timelineSemaphores ? (PFN_vkWaitSemaphoresKHR)vkGetDeviceProcAddr(logicalDevice, "vkWaitSemaphoresKHR") : nullptr;
+    timelineSemaphores = waitTimelineSemaphores != nullptr;
+    std::cout << "Synchronizing the queues with " << (timelineSemaphores ? "timeline semaphores" : "binary semaphores and fences") << std::endl;
+    submittedFrames = 0;
+
+    hiZValid = false;
+    occlusionTests = true;
+    visibleSetReuse = true;
+    hiZCamera = camera->GetBufferObject();
+    graphicsFinishedPending = false;
+    hiZImage = VK_NULL_HANDLE;
+    hiZImageView = VK_NULL_HANDLE;
+    shadowCascades = new ShadowCascades(device, camera->GetBufferObject(), camera->GetTarget());
 
     CreateCommandPools();
     CreateRenderPass();
+    CreateShadowResources();
     CreateCameraDescriptorSetLayout();
     CreateModelDescriptorSetLayout();
     CreateTimeDescriptorSetLayout();
     CreateComputeDescriptorSetLayout();
+    CreateGrassDescriptorSetLayout();
+    CreateHiZDescriptorSetLayouts();
     CreateDescriptorPool();
-    CreateCameraDescriptorSet();
+    CreateCameraDescriptorSets();
     CreateModelDescriptorSets();
-    CreateTimeDescriptorSet();
+    CreateTimeDescriptorSets();
     CreateComputeDescriptorSets();
+    CreateGrassDescriptorSets();
+    CreateHiZDescriptorSets();
     CreateFrameResources();
     CreateGraphicsPipeline();
     CreateGrassPipeline();
     CreateComputePipeline();
+    CreateHiZPipeline();
     RecordCommandBuffers();
     RecordComputeCommandBuffer();
+    CreateStreamingCommandBuffers();
+    CreateFences();
+    CreateSemaphores();
 }
 
 void Renderer::CreateCommandPools() {
     VkCommandPoolCreateInfo graphicsPoolInfo = {};
     graphicsPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     graphicsPoolInfo.queueFamilyIndex = device->GetInstance()->GetQueueFamilyIndices()[QueueFlags::Graphics];
-    graphicsPoolInfo.flags = 0;
+    // The streaming command buffers are reset one at a time
+    graphicsPoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
     if (vkCreateCommandPool(logicalDevice, &graphicsPoolInfo, nullptr, &graphicsCommandPool) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create command pool");
     }
 
+    if (cpuSimulation) {
+        computeCommandPool = VK_NULL_HANDLE;
+        return;
+    }
+
     VkCommandPoolCreateInfo computePoolInfo = {};
     computePoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
     computePoolInfo.queueFamilyIndex = device->GetInstance()->GetQueueFamilyIndices()[QueueFlags::Compute];
-    computePoolInfo.flags = 0;
+    computePoolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
 
     if (vkCreateCommandPool(logicalDevice, &computePoolInfo, nullptr, &computeCommandPool) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create command pool");
@@ -77,11 +210,12 @@ void Renderer::CreateRenderPass() {
     depthAttachment.format = depthFormat;
     depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
     depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    // Kept for the depth pyramid of the occlusion culling
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
     depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
     depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
     depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
 
     // Create a depth attachment reference
     VkAttachmentReference depthAttachmentRef = {};
@@ -106,6 +240,17 @@ void Renderer::CreateRenderPass() {
     dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
     dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
 
+    // The depth pyramid of the previous frame has to be done reading the depth before it is cleared
+    VkSubpassDependency depthDependency = {};
+    depthDependency.srcSubpass = VK_SUBPASS_EXTERNAL;
+    depthDependency.dstSubpass = 0;
+    depthDependency.srcStageMask = VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    depthDependency.srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    depthDependency.dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    depthDependency.dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    std::array<VkSubpassDependency, 2> dependencies = { dependency, depthDependency };
+
     // Create render pass
     VkRenderPassCreateInfo renderPassInfo = {};
     renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -113,14 +258,151 @@ void Renderer::CreateRenderPass() {
     renderPassInfo.pAttachments = attachments.data();
     renderPassInfo.subpassCount = 1;
     renderPassInfo.pSubpasses = &subpass;
-    renderPassInfo.dependencyCount = 1;
-    renderPassInfo.pDependencies = &dependency;
+    renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+    renderPassInfo.pDependencies = dependencies.data();
 
     if (vkCreateRenderPass(logicalDevice, &renderPassInfo, nullptr, &renderPass) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create render pass");
     }
 }
 
+void Renderer::CreateShadowResources() {
+    VkFormat shadowFormat = device->GetInstance()->GetSupportedFormat({ VK_FORMAT_D32_SFLOAT, VK_FORMAT_D16_UNORM }, VK_IMAGE_TILING_OPTIMAL, VK_FORMAT_FEATURE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT);
+
+    // Depth only, cleared by every cascade's pass and left ready for the fragment shaders of the graphics pass
+    VkAttachmentDescription depthAttachment = {};
+    depthAttachment.format = shadowFormat;
+    depthAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+    depthAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+    depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+    depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+    depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+    depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    depthAttachment.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    VkAttachmentReference depthAttachmentRef = {};
+    depthAttachmentRef.attachment = 0;
+    depthAttachmentRef.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
+
+    VkSubpassDescription subpass = {};
+    subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    subpass.colorAttachmentCount = 0;
+    subpass.pDepthStencilAttachment = &depthAttachmentRef;
+
+    // The previous frame has to be done sampling the layer before it is cleared,
+    // and this frame samples it only once it is drawn
+    std::array<VkSubpassDependency, 2> dependencies = {};
+    dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[0].dstSubpass = 0;
+    dependencies[0].srcStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    dependencies[0].srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    dependencies[0].dstStageMask = VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependencies[0].dstAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+
+    dependencies[1].srcSubpass = 0;
+    dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+    dependencies[1].srcStageMask = VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT;
+    dependencies[1].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    dependencies[1].dstStageMask = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+    dependencies[1].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+
+    VkRenderPassCreateInfo renderPassInfo = {};
+    renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+    renderPassInfo.attachmentCount = 1;
+    renderPassInfo.pAttachments = &depthAttachment;
+    renderPassInfo.subpassCount = 1;
+    renderPassInfo.pSubpasses = &subpass;
+    renderPassInfo.dependencyCount = static_cast<uint32_t>(dependencies.size());
+    renderPassInfo.pDependencies = dependencies.data();
+
+    if (vkCreateRenderPass(logicalDevice, &renderPassInfo, nullptr, &shadowRenderPass) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create shadow render pass");
+    }
+
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent.width = SHADOW_MAP_DIM;
+    imageInfo.extent.height = SHADOW_MAP_DIM;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = 1;
+    imageInfo.arrayLayers = NUM_SHADOW_CASCADES;
+    imageInfo.format = shadowFormat;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+    if (vkCreateImage(logicalDevice, &imageInfo, nullptr, &shadowImage) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create shadow map");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(logicalDevice, shadowImage, &memRequirements);
+
+    shadowImageMemory = device->GetAllocator()->Allocate(memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false);
+    vkBindImageMemory(logicalDevice, shadowImage, shadowImageMemory.memory, shadowImageMemory.offset);
+
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = shadowImage;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY;
+    viewInfo.format = shadowFormat;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = 1;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = NUM_SHADOW_CASCADES;
+
+    if (vkCreateImageView(logicalDevice, &viewInfo, nullptr, &shadowImageView) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create shadow map view");
+    }
+
+    for (uint32_t cascade = 0; cascade < NUM_SHADOW_CASCADES; ++cascade) {
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.subresourceRange.baseArrayLayer = cascade;
+        viewInfo.subresourceRange.layerCount = 1;
+        if (vkCreateImageView(logicalDevice, &viewInfo, nullptr, &shadowLayerViews[cascade]) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create shadow map view");
+        }
+
+        VkFramebufferCreateInfo framebufferInfo = {};
+        framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+        framebufferInfo.renderPass = shadowRenderPass;
+        framebufferInfo.attachmentCount = 1;
+        framebufferInfo.pAttachments = &shadowLayerViews[cascade];
+        framebufferInfo.width = SHADOW_MAP_DIM;
+        framebufferInfo.height = SHADOW_MAP_DIM;
+        framebufferInfo.layers = 1;
+
+        if (vkCreateFramebuffer(logicalDevice, &framebufferInfo, nullptr, &shadowFramebuffers[cascade]) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create shadow framebuffer");
+        }
+    }
+
+    // Depth comparison with bilinear filtering, so that every lookup blends the results of 2x2 texels
+    VkSamplerCreateInfo samplerInfo = {};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.anisotropyEnable = VK_FALSE;
+    samplerInfo.maxAnisotropy = 1.0f;
+    samplerInfo.compareEnable = VK_TRUE;
+    samplerInfo.compareOp = VK_COMPARE_OP_LESS_OR_EQUAL;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = 0.0f;
+    samplerInfo.unnormalizedCoordinates = VK_FALSE;
+
+    if (vkCreateSampler(logicalDevice, &samplerInfo, nullptr, &shadowSampler) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create shadow map sampler");
+    }
+}
+
 void Renderer::CreateCameraDescriptorSetLayout() {
     // Describe the binding of the descriptor set layout
     VkDescriptorSetLayoutBinding uboLayoutBinding = {};
@@ -130,7 +412,22 @@ void Renderer::CreateCameraDescriptorSetLayout() {
     uboLayoutBinding.stageFlags = VK_SHADER_STAGE_ALL;
     uboLayoutBinding.pImmutableSamplers = nullptr;
 
-    std::vector<VkDescriptorSetLayoutBinding> bindings = { uboLayoutBinding };
+    // The shadow cascades, culled against by the compute passes and looked up by the fragment shaders
+    VkDescriptorSetLayoutBinding shadowLayoutBinding = {};
+    shadowLayoutBinding.binding = 1;
+    shadowLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    shadowLayoutBinding.descriptorCount = 1;
+    shadowLayoutBinding.stageFlags = VK_SHADER_STAGE_ALL;
+    shadowLayoutBinding.pImmutableSamplers = nullptr;
+
+    VkDescriptorSetLayoutBinding shadowMapLayoutBinding = {};
+    shadowMapLayoutBinding.binding = 2;
+    shadowMapLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    shadowMapLayoutBinding.descriptorCount = 1;
+    shadowMapLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    shadowMapLayoutBinding.pImmutableSamplers = nullptr;
+
+    std::vector<VkDescriptorSetLayoutBinding> bindings = { uboLayoutBinding, shadowLayoutBinding, shadowMapLayoutBinding };
 
     // Create the descriptor set layout
     VkDescriptorSetLayoutCreateInfo layoutInfo = {};
@@ -218,7 +515,67 @@ void Renderer::CreateComputeDescriptorSetLayout() {
 	numBladesLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT; // NOTE: So far only seen in compute shader. Might need in vertex shader.
 	numBladesLayoutBinding.pImmutableSamplers = nullptr;
 
-	std::vector<VkDescriptorSetLayoutBinding> bindings = { inputBladesLayoutBinding, outputBladesLayoutBinding, numBladesLayoutBinding };
+	// Tile bounds, visible tile list and the indirect dispatch arguments written by tile_cull.comp
+	VkDescriptorSetLayoutBinding tilesLayoutBinding = {};
+	tilesLayoutBinding.binding = 3;
+	tilesLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	tilesLayoutBinding.descriptorCount = 1;
+	tilesLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	tilesLayoutBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding visibleTilesLayoutBinding = {};
+	visibleTilesLayoutBinding.binding = 4;
+	visibleTilesLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	visibleTilesLayoutBinding.descriptorCount = 1;
+	visibleTilesLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	visibleTilesLayoutBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding tileDispatchLayoutBinding = {};
+	tileDispatchLayoutBinding.binding = 5;
+	tileDispatchLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	tileDispatchLayoutBinding.descriptorCount = 1;
+	tileDispatchLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	tileDispatchLayoutBinding.pImmutableSamplers = nullptr;
+
+	// Culled blade count, read by finalize.comp
+	VkDescriptorSetLayoutBinding countersLayoutBinding = {};
+	countersLayoutBinding.binding = 6;
+	countersLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	countersLayoutBinding.descriptorCount = 1;
+	countersLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	countersLayoutBinding.pImmutableSamplers = nullptr;
+
+	// Per-tile rest tracking, read and written by simulate.comp
+	VkDescriptorSetLayoutBinding tileSleepLayoutBinding = {};
+	tileSleepLayoutBinding.binding = 7;
+	tileSleepLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	tileSleepLayoutBinding.descriptorCount = 1;
+	tileSleepLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	tileSleepLayoutBinding.pImmutableSamplers = nullptr;
+
+	// Rest pose of the blades, one array per attribute, read only
+	VkDescriptorSetLayoutBinding restPositionsLayoutBinding = {};
+	restPositionsLayoutBinding.binding = 8;
+	restPositionsLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	restPositionsLayoutBinding.descriptorCount = 1;
+	restPositionsLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	restPositionsLayoutBinding.pImmutableSamplers = nullptr;
+
+	VkDescriptorSetLayoutBinding restUpsLayoutBinding = restPositionsLayoutBinding;
+	restUpsLayoutBinding.binding = 9;
+
+	VkDescriptorSetLayoutBinding restShapesLayoutBinding = restPositionsLayoutBinding;
+	restShapesLayoutBinding.binding = 10;
+
+	// Density the cull pass spawns blades with, read only
+	VkDescriptorSetLayoutBinding densityMapLayoutBinding = restPositionsLayoutBinding;
+	densityMapLayoutBinding.binding = 11;
+
+	// Blades that survived the last cull of each tile, read and written by the cull pass
+	VkDescriptorSetLayoutBinding tileVisibilityLayoutBinding = tileSleepLayoutBinding;
+	tileVisibilityLayoutBinding.binding = 12;
+
+	std::vector<VkDescriptorSetLayoutBinding> bindings = { inputBladesLayoutBinding, outputBladesLayoutBinding, numBladesLayoutBinding, tilesLayoutBinding, visibleTilesLayoutBinding, tileDispatchLayoutBinding, countersLayoutBinding, tileSleepLayoutBinding, restPositionsLayoutBinding, restUpsLayoutBinding, restShapesLayoutBinding, densityMapLayoutBinding, tileVisibilityLayoutBinding };
 
     // Create the descriptor set layout
     VkDescriptorSetLayoutCreateInfo layoutInfo = {};
@@ -234,11 +591,94 @@ void Renderer::CreateComputeDescriptorSetLayout() {
     }
 }
 
+void Renderer::CreateGrassDescriptorSetLayout() {
+    // Tile bounds, packed blade positions are relative to them
+    VkDescriptorSetLayoutBinding tilesLayoutBinding = {};
+    tilesLayoutBinding.binding = 0;
+    tilesLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    tilesLayoutBinding.descriptorCount = 1;
+    tilesLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    tilesLayoutBinding.pImmutableSamplers = nullptr;
+
+    // Culled blades, read by grass_pull.vert
+    VkDescriptorSetLayoutBinding culledBladesLayoutBinding = {};
+    culledBladesLayoutBinding.binding = 1;
+    culledBladesLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    culledBladesLayoutBinding.descriptorCount = 1;
+    culledBladesLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    culledBladesLayoutBinding.pImmutableSamplers = nullptr;
+
+    std::vector<VkDescriptorSetLayoutBinding> bindings = { tilesLayoutBinding, culledBladesLayoutBinding };
+
+    // Create the descriptor set layout
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+
+    if (vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, nullptr, &grassDescriptorSetLayout) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create descriptor set layout");
+    }
+}
+
+void Renderer::CreateHiZDescriptorSetLayouts() {
+    // hiz.comp: the level below, or the depth attachment, and the level to write
+    VkDescriptorSetLayoutBinding sourceLayoutBinding = {};
+    sourceLayoutBinding.binding = 0;
+    sourceLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    sourceLayoutBinding.descriptorCount = 1;
+    sourceLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    sourceLayoutBinding.pImmutableSamplers = nullptr;
+
+    VkDescriptorSetLayoutBinding destinationLayoutBinding = {};
+    destinationLayoutBinding.binding = 1;
+    destinationLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+    destinationLayoutBinding.descriptorCount = 1;
+    destinationLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    destinationLayoutBinding.pImmutableSamplers = nullptr;
+
+    std::vector<VkDescriptorSetLayoutBinding> reduceBindings = { sourceLayoutBinding, destinationLayoutBinding };
+
+    VkDescriptorSetLayoutCreateInfo layoutInfo = {};
+    layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    layoutInfo.bindingCount = static_cast<uint32_t>(reduceBindings.size());
+    layoutInfo.pBindings = reduceBindings.data();
+
+    if (vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, nullptr, &hiZReduceDescriptorSetLayout) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create descriptor set layout");
+    }
+
+    // Culling passes: the camera the pyramid was rendered with and the pyramid
+    VkDescriptorSetLayoutBinding uboLayoutBinding = {};
+    uboLayoutBinding.binding = 0;
+    uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+    uboLayoutBinding.descriptorCount = 1;
+    uboLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    uboLayoutBinding.pImmutableSamplers = nullptr;
+
+    VkDescriptorSetLayoutBinding pyramidLayoutBinding = {};
+    pyramidLayoutBinding.binding = 1;
+    pyramidLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    pyramidLayoutBinding.descriptorCount = 1;
+    pyramidLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    pyramidLayoutBinding.pImmutableSamplers = nullptr;
+
+    std::vector<VkDescriptorSetLayoutBinding> bindings = { uboLayoutBinding, pyramidLayoutBinding };
+
+    layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+    layoutInfo.pBindings = bindings.data();
+
+    if (vkCreateDescriptorSetLayout(logicalDevice, &layoutInfo, nullptr, &hiZDescriptorSetLayout) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create descriptor set layout");
+    }
+}
+
 void Renderer::CreateDescriptorPool() {
     // Describe which descriptor types that the descriptor sets will contain
     std::vector<VkDescriptorPoolSize> poolSizes = {
-        // Camera
-        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , 1 },
+        // Camera and shadow cascades, from the camera and from each cascade, and the shadow map per frame in flight
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , 2 * (1 + NUM_SHADOW_CASCADES) * MAX_FRAMES_IN_FLIGHT },
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER , MAX_FRAMES_IN_FLIGHT },
 
         // Models + Blades
         { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER , static_cast<uint32_t>(scene->GetModels().size() + scene->GetBlades().size()) },
@@ -246,87 +686,153 @@ void Renderer::CreateDescriptorPool() {
         // Models + Blades
         { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , static_cast<uint32_t>(scene->GetModels().size() + scene->GetBlades().size()) },
 
-        // Time (compute)
-        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , 1 },
+        // Time (compute) per frame in flight
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER , MAX_FRAMES_IN_FLIGHT },
 
         // TODO: Add any additional types and counts of descriptors you will need to allocate
-		// Input blades buffer, output blades buffer, and num blades buffer. 3 in total
-		/*{ VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3 }*/
-        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 3 * static_cast<uint32_t>(scene->GetBlades().size()) }
+		// Control points, output blades, num blades, tiles, visible tiles, tile dispatch, counters, tile sleep,
+		// the 3 rest pose buffers, the density map and the tile visibility. 13 in total
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 13 * MAX_FRAMES_IN_FLIGHT * static_cast<uint32_t>(scene->GetBlades().size()) },
+
+        // Tiles and culled blades (grass)
+        { VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 2 * MAX_FRAMES_IN_FLIGHT * static_cast<uint32_t>(scene->GetBlades().size()) },
+
+        // Depth pyramid: source and destination of each level, then the pyramid and its camera per frame in flight
+        { VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, HIZ_MAX_LEVELS + MAX_FRAMES_IN_FLIGHT },
+        { VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, HIZ_MAX_LEVELS },
+        { VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, MAX_FRAMES_IN_FLIGHT }
     };
 
     VkDescriptorPoolCreateInfo poolInfo = {};
     poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
     poolInfo.pPoolSizes = poolSizes.data();
-    poolInfo.maxSets = 5;
+    // Camera and the cascade cameras and time per frame in flight, models + blades, one compute and one grass set
+    // per blades per frame in flight and the depth pyramid sets
+    poolInfo.maxSets = static_cast<uint32_t>((2 + NUM_SHADOW_CASCADES) * MAX_FRAMES_IN_FLIGHT + scene->GetModels().size() + scene->GetBlades().size() + 2 * MAX_FRAMES_IN_FLIGHT * scene->GetBlades().size() + HIZ_MAX_LEVELS + MAX_FRAMES_IN_FLIGHT);
 
     if (vkCreateDescriptorPool(logicalDevice, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create descriptor pool");
     }
 }
 
-void Renderer::CreateCameraDescriptorSet() {
+void Renderer::CreateCameraDescriptorSets() {
     // Describe the desciptor set
-    VkDescriptorSetLayout layouts[] = { cameraDescriptorSetLayout };
+    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, cameraDescriptorSetLayout);
     VkDescriptorSetAllocateInfo allocInfo = {};
     allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     allocInfo.descriptorPool = descriptorPool;
-    allocInfo.descriptorSetCount = 1;
-    allocInfo.pSetLayouts = layouts;
+    allocInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
+    allocInfo.pSetLayouts = layouts.data();
 
     // Allocate descriptor sets
-    if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, &cameraDescriptorSet) != VK_SUCCESS) {
+    if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, cameraDescriptorSets.data()) != VK_SUCCESS) {
         throw std::runtime_error("Failed to allocate descriptor set");
     }
 
-    // Configure the descriptors to refer to buffers
-    VkDescriptorBufferInfo cameraBufferInfo = {};
-    cameraBufferInfo.buffer = camera->GetBuffer();
-    cameraBufferInfo.offset = 0;
-    cameraBufferInfo.range = sizeof(CameraBufferObject);
+    // The shadow pass draws with the same shaders as the camera, seen from each cascade
+    std::vector<VkDescriptorSetLayout> shadowLayouts(NUM_SHADOW_CASCADES, cameraDescriptorSetLayout);
+    allocInfo.descriptorSetCount = NUM_SHADOW_CASCADES;
+    allocInfo.pSetLayouts = shadowLayouts.data();
 
-    std::array<VkWriteDescriptorSet, 1> descriptorWrites = {};
-    descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWrites[0].dstSet = cameraDescriptorSet;
-    descriptorWrites[0].dstBinding = 0;
-    descriptorWrites[0].dstArrayElement = 0;
-    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    descriptorWrites[0].descriptorCount = 1;
-    descriptorWrites[0].pBufferInfo = &cameraBufferInfo;
-    descriptorWrites[0].pImageInfo = nullptr;
-    descriptorWrites[0].pTexelBufferView = nullptr;
+    for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, shadowCameraDescriptorSets[frame].data()) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate descriptor set");
+        }
+    }
 
-    // Update descriptor sets
-    vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    VkDescriptorImageInfo shadowMapInfo = {};
+    shadowMapInfo.sampler = shadowSampler;
+    shadowMapInfo.imageView = shadowImageView;
+    shadowMapInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+    // Each frame in flight reads its own copies of the uniforms
+    for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        // Configure the descriptors to refer to buffers
+        VkDescriptorBufferInfo cameraBufferInfo = {};
+        cameraBufferInfo.buffer = camera->GetBuffer(frame);
+        cameraBufferInfo.offset = 0;
+        cameraBufferInfo.range = sizeof(CameraBufferObject);
+
+        VkDescriptorBufferInfo shadowBufferInfo = {};
+        shadowBufferInfo.buffer = shadowCascades->GetBuffer(frame);
+        shadowBufferInfo.offset = 0;
+        shadowBufferInfo.range = sizeof(ShadowBufferObject);
+
+        std::array<VkDescriptorBufferInfo, NUM_SHADOW_CASCADES> cascadeBufferInfos = {};
+        std::vector<VkWriteDescriptorSet> descriptorWrites(3 + 2 * NUM_SHADOW_CASCADES);
+        for (uint32_t i = 0; i < descriptorWrites.size(); ++i) {
+            descriptorWrites[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrites[i].dstArrayElement = 0;
+            descriptorWrites[i].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+            descriptorWrites[i].descriptorCount = 1;
+            descriptorWrites[i].pBufferInfo = nullptr;
+            descriptorWrites[i].pImageInfo = nullptr;
+            descriptorWrites[i].pTexelBufferView = nullptr;
+        }
+
+        descriptorWrites[0].dstSet = cameraDescriptorSets[frame];
+        descriptorWrites[0].dstBinding = 0;
+        descriptorWrites[0].pBufferInfo = &cameraBufferInfo;
+
+        descriptorWrites[1].dstSet = cameraDescriptorSets[frame];
+        descriptorWrites[1].dstBinding = 1;
+        descriptorWrites[1].pBufferInfo = &shadowBufferInfo;
+
+        descriptorWrites[2].dstSet = cameraDescriptorSets[frame];
+        descriptorWrites[2].dstBinding = 2;
+        descriptorWrites[2].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrites[2].pImageInfo = &shadowMapInfo;
+
+        // The cascade sets leave the shadow map out, the shadow pass has no fragment shader to sample it
+        for (uint32_t cascade = 0; cascade < NUM_SHADOW_CASCADES; ++cascade) {
+            cascadeBufferInfos[cascade] = { shadowCascades->GetCameraBuffer(frame, cascade), 0, sizeof(CameraBufferObject) };
+
+            descriptorWrites[3 + 2 * cascade].dstSet = shadowCameraDescriptorSets[frame][cascade];
+            descriptorWrites[3 + 2 * cascade].dstBinding = 0;
+            descriptorWrites[3 + 2 * cascade].pBufferInfo = &cascadeBufferInfos[cascade];
+
+            descriptorWrites[4 + 2 * cascade].dstSet = shadowCameraDescriptorSets[frame][cascade];
+            descriptorWrites[4 + 2 * cascade].dstBinding = 1;
+            descriptorWrites[4 + 2 * cascade].pBufferInfo = &shadowBufferInfo;
+        }
+
+        // Update descriptor sets
+        vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+    }
 }
 
 void Renderer::CreateModelDescriptorSets() {
-    modelDescriptorSets.resize(scene->GetModels().size());
+    // The blades have sets of their own, so that the grass is not drawn with the transform of the last model
+    const uint32_t numModels = static_cast<uint32_t>(scene->GetModels().size());
+    modelDescriptorSets.resize(numModels + scene->GetBlades().size());
 
     // Describe the desciptor set
-    VkDescriptorSetLayout layouts[] = { modelDescriptorSetLayout };
+    std::vector<VkDescriptorSetLayout> layouts(modelDescriptorSets.size(), modelDescriptorSetLayout);
     VkDescriptorSetAllocateInfo allocInfo = {};
     allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     allocInfo.descriptorPool = descriptorPool;
     allocInfo.descriptorSetCount = static_cast<uint32_t>(modelDescriptorSets.size());
-    allocInfo.pSetLayouts = layouts;
+    allocInfo.pSetLayouts = layouts.data();
 
     // Allocate descriptor sets
     if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, modelDescriptorSets.data()) != VK_SUCCESS) {
         throw std::runtime_error("Failed to allocate descriptor set");
     }
 
-    std::vector<VkWriteDescriptorSet> descriptorWrites(2 * modelDescriptorSets.size());
+    // Models write the transform and the texture, blades only the transform
+    std::vector<VkWriteDescriptorSet> descriptorWrites(2 * numModels + scene->GetBlades().size());
+    std::vector<VkDescriptorBufferInfo> modelBufferInfos(modelDescriptorSets.size());
+    std::vector<VkDescriptorImageInfo> imageInfos(numModels);
 
-    for (uint32_t i = 0; i < scene->GetModels().size(); ++i) {
-        VkDescriptorBufferInfo modelBufferInfo = {};
+    for (uint32_t i = 0; i < numModels; ++i) {
+        VkDescriptorBufferInfo& modelBufferInfo = modelBufferInfos[i];
         modelBufferInfo.buffer = scene->GetModels()[i]->GetModelBuffer();
         modelBufferInfo.offset = 0;
         modelBufferInfo.range = sizeof(ModelBufferObject);
 
         // Bind image and sampler resources to the descriptor
-        VkDescriptorImageInfo imageInfo = {};
+        VkDescriptorImageInfo& imageInfo = imageInfos[i];
         imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
         imageInfo.imageView = scene->GetModels()[i]->GetTextureView();
         imageInfo.sampler = scene->GetModels()[i]->GetTextureSampler();
@@ -350,40 +856,58 @@ void Renderer::CreateModelDescriptorSets() {
         descriptorWrites[2 * i + 1].pImageInfo = &imageInfo;
     }
 
+    for (uint32_t i = 0; i < scene->GetBlades().size(); ++i) {
+        VkDescriptorBufferInfo& modelBufferInfo = modelBufferInfos[numModels + i];
+        modelBufferInfo.buffer = scene->GetBlades()[i]->GetModelBuffer();
+        modelBufferInfo.offset = 0;
+        modelBufferInfo.range = sizeof(ModelBufferObject);
+
+        VkWriteDescriptorSet& descriptorWrite = descriptorWrites[2 * numModels + i];
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = modelDescriptorSets[numModels + i];
+        descriptorWrite.dstBinding = 0;
+        descriptorWrite.dstArrayElement = 0;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.pBufferInfo = &modelBufferInfo;
+    }
+
     // Update descriptor sets
     vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 }
 
-void Renderer::CreateTimeDescriptorSet() {
+void Renderer::CreateTimeDescriptorSets() {
     // Describe the desciptor set
-    VkDescriptorSetLayout layouts[] = { timeDescriptorSetLayout };
+    std::vector<VkDescriptorSetLayout> layouts(MAX_FRAMES_IN_FLIGHT, timeDescriptorSetLayout);
     VkDescriptorSetAllocateInfo allocInfo = {};
     allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     allocInfo.descriptorPool = descriptorPool;
-    allocInfo.descriptorSetCount = 1;
-    allocInfo.pSetLayouts = layouts;
+    allocInfo.descriptorSetCount = MAX_FRAMES_IN_FLIGHT;
+    allocInfo.pSetLayouts = layouts.data();
 
     // Allocate descriptor sets
-    if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, &timeDescriptorSet) != VK_SUCCESS) {
+    if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, timeDescriptorSets.data()) != VK_SUCCESS) {
         throw std::runtime_error("Failed to allocate descriptor set");
     }
 
-    // Configure the descriptors to refer to buffers
-    VkDescriptorBufferInfo timeBufferInfo = {};
-    timeBufferInfo.buffer = scene->GetTimeBuffer();
-    timeBufferInfo.offset = 0;
-    timeBufferInfo.range = sizeof(Time);
-
-    std::array<VkWriteDescriptorSet, 1> descriptorWrites = {};
-    descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-    descriptorWrites[0].dstSet = timeDescriptorSet;
-    descriptorWrites[0].dstBinding = 0;
-    descriptorWrites[0].dstArrayElement = 0;
-    descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-    descriptorWrites[0].descriptorCount = 1;
-    descriptorWrites[0].pBufferInfo = &timeBufferInfo;
-    descriptorWrites[0].pImageInfo = nullptr;
-    descriptorWrites[0].pTexelBufferView = nullptr;
+    // Configure the descriptors to refer to the time of each frame in flight
+    std::array<VkDescriptorBufferInfo, MAX_FRAMES_IN_FLIGHT> timeBufferInfos = {};
+    std::array<VkWriteDescriptorSet, MAX_FRAMES_IN_FLIGHT> descriptorWrites = {};
+    for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        timeBufferInfos[frame].buffer = scene->GetTimeBuffer(frame);
+        timeBufferInfos[frame].offset = 0;
+        timeBufferInfos[frame].range = sizeof(Time);
+
+        descriptorWrites[frame].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[frame].dstSet = timeDescriptorSets[frame];
+        descriptorWrites[frame].dstBinding = 0;
+        descriptorWrites[frame].dstArrayElement = 0;
+        descriptorWrites[frame].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        descriptorWrites[frame].descriptorCount = 1;
+        descriptorWrites[frame].pBufferInfo = &timeBufferInfos[frame];
+        descriptorWrites[frame].pImageInfo = nullptr;
+        descriptorWrites[frame].pTexelBufferView = nullptr;
+    }
 
     // Update descriptor sets
     vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
@@ -392,15 +916,17 @@ void Renderer::CreateTimeDescriptorSet() {
 void Renderer::CreateComputeDescriptorSets() {
     // TODO: Create Descriptor sets for the compute pipeline
     // The descriptors should point to Storage buffers which will hold the grass blades, the culled grass blades, and the output number of grass blades 
-    computeDescriptorSets.resize(scene->GetBlades().size());
+    // One set per blades per frame in flight, set frame * numBlades + i writes the culled output of frame
+    const uint32_t numBlades = static_cast<uint32_t>(scene->GetBlades().size());
+    computeDescriptorSets.resize(MAX_FRAMES_IN_FLIGHT * numBlades);
 
     // Describe the desciptor set
-	VkDescriptorSetLayout layouts[] = { computeDescriptorSetLayout };
+	std::vector<VkDescriptorSetLayout> layouts(computeDescriptorSets.size(), computeDescriptorSetLayout);
     VkDescriptorSetAllocateInfo allocInfo = {};
     allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
     allocInfo.descriptorPool = descriptorPool;
     allocInfo.descriptorSetCount = static_cast<uint32_t>(computeDescriptorSets.size());
-    allocInfo.pSetLayouts = layouts;
+    allocInfo.pSetLayouts = layouts.data();
 
     // Allocate descriptor sets
     if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, computeDescriptorSets.data()) != VK_SUCCESS) {
@@ -411,55 +937,154 @@ void Renderer::CreateComputeDescriptorSets() {
 
     }
 
-	std::vector<VkWriteDescriptorSet> descriptorWrites(3 * computeDescriptorSets.size());
+	const uint32_t numBindings = 13;
+	std::vector<VkWriteDescriptorSet> descriptorWrites(numBindings * computeDescriptorSets.size());
+	std::vector<VkDescriptorBufferInfo> bufferInfos(numBindings * computeDescriptorSets.size());
+
+    for (uint32_t i = 0; i < computeDescriptorSets.size(); ++i) {
+		const uint32_t frame = i / numBlades;
+		const auto curBlades = scene->GetBlades()[i % numBlades];
+
+		// In binding order: control point states, culled blades, num blades, tiles, visible tiles, tile dispatch, counters, tile sleep,
+		// rest pose, density map, tile visibility
+		bufferInfos[numBindings * i + 0] = { curBlades->GetControlPointsBuffer(), 0, NUM_BLADE_STATES * NUM_STORED_BLADES * sizeof(BladeControlPoints) };
+		bufferInfos[numBindings * i + 1] = { curBlades->GetCulledBladesBuffer(frame), 0, NUM_CULLED_LISTS * MAX_CULLED_BLADES * sizeof(DeviceBlade) };
+		bufferInfos[numBindings * i + 2] = { curBlades->GetNumBladesBuffer(frame), 0, sizeof(BladeDrawArguments) };
+		bufferInfos[numBindings * i + 3] = { curBlades->GetTilesBuffer(), 0, NUM_TILES * sizeof(BladeTile) };
+		bufferInfos[numBindings * i + 4] = { curBlades->GetVisibleTilesBuffer(), 0, NUM_TILES * sizeof(uint32_t) };
+		bufferInfos[numBindings * i + 5] = { curBlades->GetTileDispatchBuffer(), 0, sizeof(VkDispatchIndirectCommand) };
+		bufferInfos[numBindings * i + 6] = { curBlades->GetCountersBuffer(), 0, sizeof(BladeCounters) };
+		bufferInfos[numBindings * i + 7] = { curBlades->GetTileSleepBuffer(), 0, NUM_TILES * sizeof(TileSleep) };
+		bufferInfos[numBindings * i + 8] = { curBlades->GetRestPositionsBuffer(), 0, NUM_STORED_BLADES * sizeof(RestPosition) };
+		bufferInfos[numBindings * i + 9] = { curBlades->GetRestUpsBuffer(), 0, NUM_STORED_BLADES * sizeof(RestUp) };
+		bufferInfos[numBindings * i + 10] = { curBlades->GetRestShapesBuffer(), 0, NUM_STORED_BLADES * sizeof(RestShape) };
+		bufferInfos[numBindings * i + 11] = { curBlades->GetDensityMapBuffer(), 0, VK_WHOLE_SIZE };
+		bufferInfos[numBindings * i + 12] = { curBlades->GetTileVisibilityBuffer(), 0, NUM_TILES * TILE_VISIBILITY_WORDS * sizeof(uint32_t) };
+
+		for (uint32_t j = 0; j < numBindings; ++j) {
+			VkWriteDescriptorSet& descriptorWrite = descriptorWrites[numBindings * i + j];
+			descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrite.dstSet = computeDescriptorSets[i];
+			descriptorWrite.dstBinding = j;
+			descriptorWrite.dstArrayElement = 0;
+			descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrite.descriptorCount = 1;
+			descriptorWrite.pBufferInfo = &bufferInfos[numBindings * i + j];
+			descriptorWrite.pImageInfo = nullptr;
+			descriptorWrite.pTexelBufferView = nullptr;
+		}
+    }
 
-    for (uint32_t i = 0; i < scene->GetBlades().size(); ++i) {
-		const auto curBlades = scene->GetBlades()[i];
-
-		VkDescriptorBufferInfo inputBladesBufferInfo = {};
-		inputBladesBufferInfo.buffer = curBlades->GetBladesBuffer();
-		inputBladesBufferInfo.offset = 0;
-		inputBladesBufferInfo.range = NUM_BLADES * sizeof(Blade);
-
-		VkDescriptorBufferInfo outputBladesBufferInfo = {};
-		outputBladesBufferInfo.buffer = curBlades->GetCulledBladesBuffer();
-		outputBladesBufferInfo.offset = 0;
-		outputBladesBufferInfo.range = NUM_BLADES * sizeof(Blade);
-
-		VkDescriptorBufferInfo numBladesBufferInfo = {};
-		numBladesBufferInfo.buffer = curBlades->GetNumBladesBuffer();
-		numBladesBufferInfo.offset = 0;
-		numBladesBufferInfo.range = sizeof(BladeDrawIndirect);
-
-		descriptorWrites[3 * i + 0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[3 * i + 0].dstSet = computeDescriptorSets[i];
-		descriptorWrites[3 * i + 0].dstBinding = 0;
-		descriptorWrites[3 * i + 0].dstArrayElement = 0;
-		descriptorWrites[3 * i + 0].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		descriptorWrites[3 * i + 0].descriptorCount = 1;
-		descriptorWrites[3 * i + 0].pBufferInfo = &inputBladesBufferInfo;
-		descriptorWrites[3 * i + 0].pImageInfo = nullptr;
-		descriptorWrites[3 * i + 0].pTexelBufferView = nullptr;
-
-		descriptorWrites[3 * i + 1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[3 * i + 1].dstSet = computeDescriptorSets[i];
-		descriptorWrites[3 * i + 1].dstBinding = 1;
-		descriptorWrites[3 * i + 1].dstArrayElement = 0;
-		descriptorWrites[3 * i + 1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		descriptorWrites[3 * i + 1].descriptorCount = 1;
-		descriptorWrites[3 * i + 1].pBufferInfo = &outputBladesBufferInfo;
-		descriptorWrites[3 * i + 1].pImageInfo = nullptr;
-		descriptorWrites[3 * i + 1].pTexelBufferView = nullptr;
-
-		descriptorWrites[3 * i + 2].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[3 * i + 2].dstSet = computeDescriptorSets[i];
-		descriptorWrites[3 * i + 2].dstBinding = 2;
-		descriptorWrites[3 * i + 2].dstArrayElement = 0;
-		descriptorWrites[3 * i + 2].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		descriptorWrites[3 * i + 2].descriptorCount = 1;
-		descriptorWrites[3 * i + 2].pBufferInfo = &numBladesBufferInfo;
-		descriptorWrites[3 * i + 2].pImageInfo = nullptr;
-		descriptorWrites[3 * i + 2].pTexelBufferView = nullptr;
+    // Update descriptor sets
+    vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+}
+
+void Renderer::CreateGrassDescriptorSets() {
+    // Set frame * numBlades + i reads the culled blades of frame
+    const uint32_t numBlades = static_cast<uint32_t>(scene->GetBlades().size());
+    grassDescriptorSets.resize(MAX_FRAMES_IN_FLIGHT * numBlades);
+
+    // Describe the desciptor sets
+    std::vector<VkDescriptorSetLayout> layouts(grassDescriptorSets.size(), grassDescriptorSetLayout);
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = static_cast<uint32_t>(grassDescriptorSets.size());
+    allocInfo.pSetLayouts = layouts.data();
+
+    // Allocate descriptor sets
+    if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, grassDescriptorSets.data()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate descriptor set");
+    }
+
+    std::vector<VkWriteDescriptorSet> descriptorWrites(2 * grassDescriptorSets.size());
+    std::vector<VkDescriptorBufferInfo> bufferInfos(2 * grassDescriptorSets.size());
+
+    for (uint32_t i = 0; i < grassDescriptorSets.size(); ++i) {
+        const uint32_t frame = i / numBlades;
+        const auto curBlades = scene->GetBlades()[i % numBlades];
+        bufferInfos[2 * i] = { curBlades->GetTilesBuffer(), 0, NUM_TILES * sizeof(BladeTile) };
+        bufferInfos[2 * i + 1] = { curBlades->GetCulledBladesBuffer(frame), 0, NUM_CULLED_LISTS * MAX_CULLED_BLADES * sizeof(DeviceBlade) };
+
+        for (uint32_t j = 0; j < 2; ++j) {
+            VkWriteDescriptorSet& descriptorWrite = descriptorWrites[2 * i + j];
+            descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrite.dstSet = grassDescriptorSets[i];
+            descriptorWrite.dstBinding = j;
+            descriptorWrite.dstArrayElement = 0;
+            descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+            descriptorWrite.descriptorCount = 1;
+            descriptorWrite.pBufferInfo = &bufferInfos[2 * i + j];
+            descriptorWrite.pImageInfo = nullptr;
+            descriptorWrite.pTexelBufferView = nullptr;
+        }
+    }
+
+    // Update descriptor sets
+    vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+}
+
+void Renderer::CreateHiZDescriptorSets() {
+    // Nearest filtering so that sampling a level returns one of its texels as is
+    VkSamplerCreateInfo samplerInfo = {};
+    samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+    samplerInfo.magFilter = VK_FILTER_NEAREST;
+    samplerInfo.minFilter = VK_FILTER_NEAREST;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.anisotropyEnable = VK_FALSE;
+    samplerInfo.maxAnisotropy = 1.0f;
+    samplerInfo.compareEnable = VK_FALSE;
+    samplerInfo.minLod = 0.0f;
+    samplerInfo.maxLod = static_cast<float>(HIZ_MAX_LEVELS);
+    samplerInfo.unnormalizedCoordinates = VK_FALSE;
+
+    if (vkCreateSampler(logicalDevice, &samplerInfo, nullptr, &hiZSampler) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create depth pyramid sampler");
+    }
+
+    hiZReduceDescriptorSets.resize(HIZ_MAX_LEVELS);
+    std::vector<VkDescriptorSetLayout> reduceLayouts(hiZReduceDescriptorSets.size(), hiZReduceDescriptorSetLayout);
+    VkDescriptorSetAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    allocInfo.descriptorPool = descriptorPool;
+    allocInfo.descriptorSetCount = static_cast<uint32_t>(hiZReduceDescriptorSets.size());
+    allocInfo.pSetLayouts = reduceLayouts.data();
+
+    if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, hiZReduceDescriptorSets.data()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate descriptor set");
+    }
+
+    std::vector<VkDescriptorSetLayout> layouts(hiZDescriptorSets.size(), hiZDescriptorSetLayout);
+    allocInfo.descriptorSetCount = static_cast<uint32_t>(hiZDescriptorSets.size());
+    allocInfo.pSetLayouts = layouts.data();
+
+    if (vkAllocateDescriptorSets(logicalDevice, &allocInfo, hiZDescriptorSets.data()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate descriptor set");
+    }
+
+    // The camera of the pyramid is written every frame, the pyramid itself by CreateHiZResources
+    std::array<VkWriteDescriptorSet, MAX_FRAMES_IN_FLIGHT> descriptorWrites = {};
+    std::array<VkDescriptorBufferInfo, MAX_FRAMES_IN_FLIGHT> bufferInfos = {};
+    HiZBufferObject hiZ = {};
+    for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        BufferUtils::CreateBuffer(device, sizeof(HiZBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, hiZBuffers[frame], hiZBufferMemories[frame]);
+        hiZMappedData[frame] = hiZBufferMemories[frame].mappedData;
+        memcpy(hiZMappedData[frame], &hiZ, sizeof(HiZBufferObject));
+
+        bufferInfos[frame] = { hiZBuffers[frame], 0, sizeof(HiZBufferObject) };
+
+        descriptorWrites[frame].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrites[frame].dstSet = hiZDescriptorSets[frame];
+        descriptorWrites[frame].dstBinding = 0;
+        descriptorWrites[frame].dstArrayElement = 0;
+        descriptorWrites[frame].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+        descriptorWrites[frame].descriptorCount = 1;
+        descriptorWrites[frame].pBufferInfo = &bufferInfos[frame];
+        descriptorWrites[frame].pImageInfo = nullptr;
+        descriptorWrites[frame].pTexelBufferView = nullptr;
     }
 
     // Update descriptor sets
@@ -626,11 +1251,43 @@ void Renderer::CreateGraphicsPipeline() {
 }
 
 void Renderer::CreateGrassPipeline() {
+    std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { cameraDescriptorSetLayout, modelDescriptorSetLayout, grassDescriptorSetLayout };
+
+    // Pipeline layout: used to specify uniform values
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
+    pipelineLayoutInfo.pSetLayouts = descriptorSetLayouts.data();
+    pipelineLayoutInfo.pushConstantRangeCount = 0;
+    pipelineLayoutInfo.pPushConstantRanges = 0;
+
+    if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &grassPipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create pipeline layout");
+    }
+
+    // One pipeline per LOD tier, all reading the culled blades of their tier: near blades are tessellated,
+    // mid range blades are fixed strips and far blades are camera facing cards standing for a clump
+    if (vertexPulling) {
+        grassPipeline = CreateGrassShaderPipeline("shaders/grass_pull.vert.spv", "", "", "shaders/grass.frag.spv", VK_VERTEX_INPUT_RATE_VERTEX, false);
+    } else {
+        grassPipeline = CreateGrassShaderPipeline("shaders/grass.vert.spv", "shaders/grass.tesc.spv", "shaders/grass.tese.spv", "shaders/grass.frag.spv", VK_VERTEX_INPUT_RATE_VERTEX, true);
+    }
+    bladeStripPipeline = CreateGrassShaderPipeline("shaders/blade_strip.vert.spv", "", "", "shaders/grass.frag.spv", VK_VERTEX_INPUT_RATE_INSTANCE, true);
+    bladeCardPipeline = CreateGrassShaderPipeline("shaders/blade_card.vert.spv", "", "", "shaders/blade_card.frag.spv", VK_VERTEX_INPUT_RATE_INSTANCE, true);
+    // Shadow casters of every tier are drawn as mid tier strips, coarse enough at shadow map resolution
+    shadowPipeline = CreateGrassShaderPipeline("shaders/blade_strip.vert.spv", "", "", "", VK_VERTEX_INPUT_RATE_INSTANCE, true);
+}
+
+VkPipeline Renderer::CreateGrassShaderPipeline(const std::string& vertPath, const std::string& tescPath, const std::string& tesePath, const std::string& fragPath, VkVertexInputRate inputRate, bool bladeAttributes) {
     // --- Set up programmable shaders ---
-    VkShaderModule vertShaderModule = ShaderModule::Create("shaders/grass.vert.spv", logicalDevice);
-    VkShaderModule tescShaderModule = ShaderModule::Create("shaders/grass.tesc.spv", logicalDevice);
-    VkShaderModule teseShaderModule = ShaderModule::Create("shaders/grass.tese.spv", logicalDevice);
-    VkShaderModule fragShaderModule = ShaderModule::Create("shaders/grass.frag.spv", logicalDevice);
+    // Without tessellation shaders the vertex shader expands each blade itself, as a triangle strip
+    const bool tessellated = !tescPath.empty();
+    // Without a fragment shader only depth is written, for the shadow map
+    const bool depthOnly = fragPath.empty();
+    VkShaderModule vertShaderModule = ShaderModule::Create(vertPath, logicalDevice);
+    VkShaderModule tescShaderModule = tessellated ? ShaderModule::Create(tescPath, logicalDevice) : VK_NULL_HANDLE;
+    VkShaderModule teseShaderModule = tessellated ? ShaderModule::Create(tesePath, logicalDevice) : VK_NULL_HANDLE;
+    VkShaderModule fragShaderModule = depthOnly ? VK_NULL_HANDLE : ShaderModule::Create(fragPath, logicalDevice);
 
     // Assign each shader module to the appropriate stage in the pipeline
     VkPipelineShaderStageCreateInfo vertShaderStageInfo = {};
@@ -657,7 +1314,14 @@ void Renderer::CreateGrassPipeline() {
     fragShaderStageInfo.module = fragShaderModule;
     fragShaderStageInfo.pName = "main";
 
-    VkPipelineShaderStageCreateInfo shaderStages[] = { vertShaderStageInfo, tescShaderStageInfo, teseShaderStageInfo, fragShaderStageInfo };
+    std::vector<VkPipelineShaderStageCreateInfo> shaderStages = { vertShaderStageInfo };
+    if (tessellated) {
+        shaderStages.push_back(tescShaderStageInfo);
+        shaderStages.push_back(teseShaderStageInfo);
+    }
+    if (!depthOnly) {
+        shaderStages.push_back(fragShaderStageInfo);
+    }
 
     // --- Set up fixed-function stages ---
 
@@ -665,18 +1329,20 @@ void Renderer::CreateGrassPipeline() {
     VkPipelineVertexInputStateCreateInfo vertexInputInfo = {};
     vertexInputInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
 
-    auto bindingDescription = Blade::getBindingDescription();
-    auto attributeDescriptions = Blade::getAttributeDescriptions();
+    // Per vertex for tessellation patches, per instance when every blade is drawn as its own strip
+    auto bindingDescription = DeviceBlade::getBindingDescription();
+    bindingDescription.inputRate = inputRate;
+    auto attributeDescriptions = DeviceBlade::getAttributeDescriptions();
 
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
-    vertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(attributeDescriptions.size());
-    vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
+    vertexInputInfo.vertexBindingDescriptionCount = bladeAttributes ? 1 : 0;
+    vertexInputInfo.pVertexBindingDescriptions = bladeAttributes ? &bindingDescription : nullptr;
+    vertexInputInfo.vertexAttributeDescriptionCount = bladeAttributes ? static_cast<uint32_t>(attributeDescriptions.size()) : 0;
+    vertexInputInfo.pVertexAttributeDescriptions = bladeAttributes ? attributeDescriptions.data() : nullptr;
 
     // Input Assembly
     VkPipelineInputAssemblyStateCreateInfo inputAssembly = {};
     inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
-    inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_PATCH_LIST;
+    inputAssembly.topology = tessellated ? VK_PRIMITIVE_TOPOLOGY_PATCH_LIST : VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
     inputAssembly.primitiveRestartEnable = VK_FALSE;
 
     // Viewports and Scissors (rectangles that define in which regions pixels are stored)
@@ -697,10 +1363,11 @@ void Renderer::CreateGrassPipeline() {
     rasterizer.lineWidth = 1.0f;
     rasterizer.cullMode = VK_CULL_MODE_NONE;
     rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
-    rasterizer.depthBiasEnable = VK_FALSE;
-    rasterizer.depthBiasConstantFactor = 0.0f;
+    // Shadow casters are pushed away from the light so that blades do not shadow themselves
+    rasterizer.depthBiasEnable = depthOnly ? VK_TRUE : VK_FALSE;
+    rasterizer.depthBiasConstantFactor = depthOnly ? 1.25f : 0.0f;
     rasterizer.depthBiasClamp = 0.0f;
-    rasterizer.depthBiasSlopeFactor = 0.0f;
+    rasterizer.depthBiasSlopeFactor = depthOnly ? 1.75f : 0.0f;
 
     // Multisampling (turned off here)
     VkPipelineMultisampleStateCreateInfo multisampling = {};
@@ -740,27 +1407,13 @@ void Renderer::CreateGrassPipeline() {
     colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
     colorBlending.logicOpEnable = VK_FALSE;
     colorBlending.logicOp = VK_LOGIC_OP_COPY;
-    colorBlending.attachmentCount = 1;
+    colorBlending.attachmentCount = depthOnly ? 0 : 1;
     colorBlending.pAttachments = &colorBlendAttachment;
     colorBlending.blendConstants[0] = 0.0f;
     colorBlending.blendConstants[1] = 0.0f;
     colorBlending.blendConstants[2] = 0.0f;
     colorBlending.blendConstants[3] = 0.0f;
 
-    std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { cameraDescriptorSetLayout, modelDescriptorSetLayout };
-
-    // Pipeline layout: used to specify uniform values
-    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
-    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-    pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
-    pipelineLayoutInfo.pSetLayouts = descriptorSetLayouts.data();
-    pipelineLayoutInfo.pushConstantRangeCount = 0;
-    pipelineLayoutInfo.pPushConstantRanges = 0;
-
-    if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &grassPipelineLayout) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to create pipeline layout");
-    }
-
     // Tessellation state
     VkPipelineTessellationStateCreateInfo tessellationInfo = {};
     tessellationInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_TESSELLATION_STATE_CREATE_INFO;
@@ -782,8 +1435,8 @@ void Renderer::CreateGrassPipeline() {
     // --- Create graphics pipeline ---
     VkGraphicsPipelineCreateInfo pipelineInfo = {};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
-    pipelineInfo.stageCount = 4;
-    pipelineInfo.pStages = shaderStages;
+    pipelineInfo.stageCount = static_cast<uint32_t>(shaderStages.size());
+    pipelineInfo.pStages = shaderStages.data();
     pipelineInfo.pVertexInputState = &vertexInputInfo;
     pipelineInfo.pInputAssemblyState = &inputAssembly;
     pipelineInfo.pViewportState = &viewportState;
@@ -791,39 +1444,37 @@ void Renderer::CreateGrassPipeline() {
     pipelineInfo.pMultisampleState = &multisampling;
     pipelineInfo.pDepthStencilState = &depthStencil;
     pipelineInfo.pColorBlendState = &colorBlending;
-    pipelineInfo.pTessellationState = &tessellationInfo;
+    pipelineInfo.pTessellationState = tessellated ? &tessellationInfo : nullptr;
     pipelineInfo.pDynamicState = &dynamicState;
     pipelineInfo.layout = grassPipelineLayout;
-    pipelineInfo.renderPass = renderPass;
+    pipelineInfo.renderPass = depthOnly ? shadowRenderPass : renderPass;
     pipelineInfo.subpass = 0;
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
     pipelineInfo.basePipelineIndex = -1;
 
-    if (vkCreateGraphicsPipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &grassPipeline) != VK_SUCCESS) {
+    VkPipeline pipeline;
+    if (vkCreateGraphicsPipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create graphics pipeline");
     }
 
     // No need for the shader modules anymore
     vkDestroyShaderModule(logicalDevice, vertShaderModule, nullptr);
-    vkDestroyShaderModule(logicalDevice, tescShaderModule, nullptr);
-    vkDestroyShaderModule(logicalDevice, teseShaderModule, nullptr);
-    vkDestroyShaderModule(logicalDevice, fragShaderModule, nullptr);
+    if (tessellated) {
+        vkDestroyShaderModule(logicalDevice, tescShaderModule, nullptr);
+        vkDestroyShaderModule(logicalDevice, teseShaderModule, nullptr);
+    }
+    if (!depthOnly) {
+        vkDestroyShaderModule(logicalDevice, fragShaderModule, nullptr);
+    }
+
+    return pipeline;
 }
 
 void Renderer::CreateComputePipeline() {
-    // Set up programmable shaders
-    VkShaderModule computeShaderModule = ShaderModule::Create("shaders/compute.comp.spv", logicalDevice);
-
-    VkPipelineShaderStageCreateInfo computeShaderStageInfo = {};
-    computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-    computeShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
-    computeShaderStageInfo.module = computeShaderModule;
-    computeShaderStageInfo.pName = "main";
-
     // TODO: Add the compute dsecriptor set layout you create to this list
-    std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { cameraDescriptorSetLayout, timeDescriptorSetLayout, computeDescriptorSetLayout };
+    std::vector<VkDescriptorSetLayout> descriptorSetLayouts = { cameraDescriptorSetLayout, timeDescriptorSetLayout, computeDescriptorSetLayout, hiZDescriptorSetLayout };
 
-    // Create pipeline layout
+    // Create pipeline layout, shared by every compute pass
     VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
     pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
     pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
@@ -835,6 +1486,57 @@ void Renderer::CreateComputePipeline() {
         throw std::runtime_error("Failed to create pipeline layout");
     }
 
+    // One pipeline per pass, recorded in this order by RecordComputeCommandBuffer
+    tileCullPipeline = CreateComputeShaderPipeline("shaders/tile_cull.comp.spv");
+    simulatePipeline = CreateComputeShaderPipeline("shaders/simulate.comp.spv");
+    cullPipeline = CreateComputeShaderPipeline(subgroupCompaction ? "shaders/cull_subgroup.comp.spv" : "shaders/cull.comp.spv");
+    finalizePipeline = CreateComputeShaderPipeline(vertexPulling ? "shaders/finalize_pull.comp.spv" : "shaders/finalize.comp.spv");
+}
+
+void Renderer::CreateHiZPipeline() {
+    VkPipelineLayoutCreateInfo pipelineLayoutInfo = {};
+    pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipelineLayoutInfo.setLayoutCount = 1;
+    pipelineLayoutInfo.pSetLayouts = &hiZReduceDescriptorSetLayout;
+    pipelineLayoutInfo.pushConstantRangeCount = 0;
+    pipelineLayoutInfo.pPushConstantRanges = 0;
+
+    if (vkCreatePipelineLayout(logicalDevice, &pipelineLayoutInfo, nullptr, &hiZReducePipelineLayout) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create pipeline layout");
+    }
+
+    VkShaderModule computeShaderModule = ShaderModule::Create("shaders/hiz.comp.spv", logicalDevice);
+
+    VkPipelineShaderStageCreateInfo computeShaderStageInfo = {};
+    computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    computeShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    computeShaderStageInfo.module = computeShaderModule;
+    computeShaderStageInfo.pName = "main";
+
+    VkComputePipelineCreateInfo pipelineInfo = {};
+    pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipelineInfo.stage = computeShaderStageInfo;
+    pipelineInfo.layout = hiZReducePipelineLayout;
+    pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
+    pipelineInfo.basePipelineIndex = -1;
+
+    if (vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &hiZReducePipeline) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create compute pipeline");
+    }
+
+    vkDestroyShaderModule(logicalDevice, computeShaderModule, nullptr);
+}
+
+VkPipeline Renderer::CreateComputeShaderPipeline(const std::string& shaderPath) {
+    // Set up programmable shaders
+    VkShaderModule computeShaderModule = ShaderModule::Create(shaderPath, logicalDevice);
+
+    VkPipelineShaderStageCreateInfo computeShaderStageInfo = {};
+    computeShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    computeShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    computeShaderStageInfo.module = computeShaderModule;
+    computeShaderStageInfo.pName = "main";
+
     // Create compute pipeline
     VkComputePipelineCreateInfo pipelineInfo = {};
     pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
@@ -845,12 +1547,15 @@ void Renderer::CreateComputePipeline() {
     pipelineInfo.basePipelineHandle = VK_NULL_HANDLE;
     pipelineInfo.basePipelineIndex = -1;
 
-    if (vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &computePipeline) != VK_SUCCESS) {
+    VkPipeline pipeline;
+    if (vkCreateComputePipelines(logicalDevice, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS) {
         throw std::runtime_error("Failed to create compute pipeline");
     }
 
     // No need for shader modules anymore
     vkDestroyShaderModule(logicalDevice, computeShaderModule, nullptr);
+
+    return pipeline;
 }
 
 void Renderer::CreateFrameResources() {
@@ -892,7 +1597,7 @@ void Renderer::CreateFrameResources() {
         swapChain->GetVkExtent().height,
         depthFormat,
         VK_IMAGE_TILING_OPTIMAL,
-        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+        VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
         depthImage,
         depthImageMemory
@@ -926,6 +1631,138 @@ void Renderer::CreateFrameResources() {
         }
 
     }
+
+    CreateHiZResources();
+}
+
+void Renderer::CreateHiZResources() {
+    // The first level is half the depth attachment, every level halves the one below down to 1x1
+    hiZExtent.width = std::max(swapChain->GetVkExtent().width / 2, 1u);
+    hiZExtent.height = std::max(swapChain->GetVkExtent().height / 2, 1u);
+    uint32_t levels = 1;
+    while (levels < HIZ_MAX_LEVELS && std::max(hiZExtent.width >> (levels - 1), hiZExtent.height >> (levels - 1)) > 1) {
+        ++levels;
+    }
+
+    // Written on the graphics queue and read by the culling passes on the compute queue
+    std::array<uint32_t, 2> queueFamilies = { device->GetQueueIndex(QueueFlags::Graphics), device->GetQueueIndex(QueueFlags::Compute) };
+    bool concurrent = !cpuSimulation && queueFamilies[0] != queueFamilies[1];
+
+    VkImageCreateInfo imageInfo = {};
+    imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+    imageInfo.imageType = VK_IMAGE_TYPE_2D;
+    imageInfo.extent.width = hiZExtent.width;
+    imageInfo.extent.height = hiZExtent.height;
+    imageInfo.extent.depth = 1;
+    imageInfo.mipLevels = levels;
+    imageInfo.arrayLayers = 1;
+    imageInfo.format = VK_FORMAT_R32_SFLOAT;
+    imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    imageInfo.usage = VK_IMAGE_USAGE_STORAGE_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+    imageInfo.sharingMode = concurrent ? VK_SHARING_MODE_CONCURRENT : VK_SHARING_MODE_EXCLUSIVE;
+    imageInfo.queueFamilyIndexCount = concurrent ? static_cast<uint32_t>(queueFamilies.size()) : 0;
+    imageInfo.pQueueFamilyIndices = concurrent ? queueFamilies.data() : nullptr;
+
+    if (vkCreateImage(logicalDevice, &imageInfo, nullptr, &hiZImage) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create depth pyramid");
+    }
+
+    VkMemoryRequirements memRequirements;
+    vkGetImageMemoryRequirements(logicalDevice, hiZImage, &memRequirements);
+
+    hiZImageMemory = device->GetAllocator()->Allocate(memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false);
+    vkBindImageMemory(logicalDevice, hiZImage, hiZImageMemory.memory, hiZImageMemory.offset);
+
+    VkImageViewCreateInfo viewInfo = {};
+    viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+    viewInfo.image = hiZImage;
+    viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+    viewInfo.format = VK_FORMAT_R32_SFLOAT;
+    viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    viewInfo.subresourceRange.baseMipLevel = 0;
+    viewInfo.subresourceRange.levelCount = levels;
+    viewInfo.subresourceRange.baseArrayLayer = 0;
+    viewInfo.subresourceRange.layerCount = 1;
+
+    if (vkCreateImageView(logicalDevice, &viewInfo, nullptr, &hiZImageView) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create depth pyramid view");
+    }
+
+    hiZLevelViews.resize(levels);
+    for (uint32_t level = 0; level < levels; ++level) {
+        viewInfo.subresourceRange.baseMipLevel = level;
+        viewInfo.subresourceRange.levelCount = 1;
+        if (vkCreateImageView(logicalDevice, &viewInfo, nullptr, &hiZLevelViews[level]) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create depth pyramid view");
+        }
+    }
+
+    // Each level reads the one below, the first one the depth attachment
+    std::vector<VkDescriptorImageInfo> imageInfos(2 * levels + MAX_FRAMES_IN_FLIGHT);
+    std::vector<VkWriteDescriptorSet> descriptorWrites(2 * levels + MAX_FRAMES_IN_FLIGHT);
+    for (uint32_t level = 0; level < levels; ++level) {
+        imageInfos[2 * level + 0].sampler = hiZSampler;
+        imageInfos[2 * level + 0].imageView = level == 0 ? depthImageView : hiZLevelViews[level - 1];
+        imageInfos[2 * level + 0].imageLayout = level == 0 ? VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL;
+        imageInfos[2 * level + 1].sampler = VK_NULL_HANDLE;
+        imageInfos[2 * level + 1].imageView = hiZLevelViews[level];
+        imageInfos[2 * level + 1].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        for (uint32_t binding = 0; binding < 2; ++binding) {
+            VkWriteDescriptorSet& descriptorWrite = descriptorWrites[2 * level + binding];
+            descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            descriptorWrite.dstSet = hiZReduceDescriptorSets[level];
+            descriptorWrite.dstBinding = binding;
+            descriptorWrite.dstArrayElement = 0;
+            descriptorWrite.descriptorType = binding == 0 ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER : VK_DESCRIPTOR_TYPE_STORAGE_IMAGE;
+            descriptorWrite.descriptorCount = 1;
+            descriptorWrite.pBufferInfo = nullptr;
+            descriptorWrite.pImageInfo = &imageInfos[2 * level + binding];
+            descriptorWrite.pTexelBufferView = nullptr;
+        }
+    }
+
+    // The culling passes sample the whole pyramid
+    for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        imageInfos[2 * levels + frame].sampler = hiZSampler;
+        imageInfos[2 * levels + frame].imageView = hiZImageView;
+        imageInfos[2 * levels + frame].imageLayout = VK_IMAGE_LAYOUT_GENERAL;
+
+        VkWriteDescriptorSet& descriptorWrite = descriptorWrites[2 * levels + frame];
+        descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        descriptorWrite.dstSet = hiZDescriptorSets[frame];
+        descriptorWrite.dstBinding = 1;
+        descriptorWrite.dstArrayElement = 0;
+        descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        descriptorWrite.descriptorCount = 1;
+        descriptorWrite.pBufferInfo = nullptr;
+        descriptorWrite.pImageInfo = &imageInfos[2 * levels + frame];
+        descriptorWrite.pTexelBufferView = nullptr;
+    }
+
+    vkUpdateDescriptorSets(logicalDevice, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+
+    // Nothing has been rendered into the new pyramid yet
+    hiZValid = false;
+}
+
+void Renderer::DestroyHiZResources() {
+    for (VkImageView view : hiZLevelViews) {
+        vkDestroyImageView(logicalDevice, view, nullptr);
+    }
+    hiZLevelViews.clear();
+
+    if (hiZImageView != VK_NULL_HANDLE) {
+        vkDestroyImageView(logicalDevice, hiZImageView, nullptr);
+        hiZImageView = VK_NULL_HANDLE;
+    }
+    if (hiZImage != VK_NULL_HANDLE) {
+        vkDestroyImage(logicalDevice, hiZImage, nullptr);
+        hiZImage = VK_NULL_HANDLE;
+    }
+    device->GetAllocator()->Free(hiZImageMemory);
 }
 
 void Renderer::DestroyFrameResources() {
@@ -941,14 +1778,11 @@ void Renderer::DestroyFrameResources() {
         vkDestroyImageView(logicalDevice, depthImageView, nullptr);
         depthImageView = VK_NULL_HANDLE;
     }
-    if (depthImageMemory != VK_NULL_HANDLE) {
-        vkFreeMemory(logicalDevice, depthImageMemory, nullptr);
-        depthImageMemory = VK_NULL_HANDLE;
-    }
     if (depthImage != VK_NULL_HANDLE) {
         vkDestroyImage(logicalDevice, depthImage, nullptr);
         depthImage = VK_NULL_HANDLE;
     }
+    device->GetAllocator()->Free(depthImageMemory);
 
     for (size_t i = 0; i < framebuffers.size(); i++) {
         if (framebuffers[i] != VK_NULL_HANDLE) {
@@ -957,11 +1791,13 @@ void Renderer::DestroyFrameResources() {
         }
     }
     framebuffers.clear();
+
+    DestroyHiZResources();
 }
 
 void Renderer::RecreateFrameResources() {
-    // Wait for all operations to complete before recreating
-    vkDeviceWaitIdle(logicalDevice);
+    // Wait for every submitted frame to complete before recreating
+    WaitForFrame(submittedFrames);
     
     // Destroy pipelines (safe to call with VK_NULL_HANDLE)
     if (graphicsPipeline != VK_NULL_HANDLE) {
@@ -972,6 +1808,18 @@ void Renderer::RecreateFrameResources() {
         vkDestroyPipeline(logicalDevice, grassPipeline, nullptr);
         grassPipeline = VK_NULL_HANDLE;
     }
+    if (bladeStripPipeline != VK_NULL_HANDLE) {
+        vkDestroyPipeline(logicalDevice, bladeStripPipeline, nullptr);
+        bladeStripPipeline = VK_NULL_HANDLE;
+    }
+    if (bladeCardPipeline != VK_NULL_HANDLE) {
+        vkDestroyPipeline(logicalDevice, bladeCardPipeline, nullptr);
+        bladeCardPipeline = VK_NULL_HANDLE;
+    }
+    if (shadowPipeline != VK_NULL_HANDLE) {
+        vkDestroyPipeline(logicalDevice, shadowPipeline, nullptr);
+        shadowPipeline = VK_NULL_HANDLE;
+    }
     if (graphicsPipelineLayout != VK_NULL_HANDLE) {
         vkDestroyPipelineLayout(logicalDevice, graphicsPipelineLayout, nullptr);
         graphicsPipelineLayout = VK_NULL_HANDLE;
@@ -992,48 +1840,378 @@ void Renderer::RecreateFrameResources() {
     CreateGraphicsPipeline();
     CreateGrassPipeline();
     RecordCommandBuffers();
+
+    // The compute command buffers use the depth pyramid descriptors, which now point at the new pyramid
+    if (!cpuSimulation) {
+        vkFreeCommandBuffers(logicalDevice, computeCommandPool, static_cast<uint32_t>(computeCommandBuffers.size()), computeCommandBuffers.data());
+        RecordComputeCommandBuffer();
+    }
 }
 
 void Renderer::RecordComputeCommandBuffer() {
+    if (cpuSimulation) {
+        computeCommandBuffers.fill(VK_NULL_HANDLE);
+        return;
+    }
+
     // Specify the command pool and number of buffers to allocate
     VkCommandBufferAllocateInfo allocInfo = {};
     allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     allocInfo.commandPool = computeCommandPool;
     allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    allocInfo.commandBufferCount = 1;
+    allocInfo.commandBufferCount = static_cast<uint32_t>(computeCommandBuffers.size());
 
-    if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, &computeCommandBuffer) != VK_SUCCESS) {
+    if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, computeCommandBuffers.data()) != VK_SUCCESS) {
         throw std::runtime_error("Failed to allocate command buffers");
     }
 
+    // The command buffers only differ in the frame whose uniforms they read and whose culled blades they write
+    const uint32_t numBlades = static_cast<uint32_t>(scene->GetBlades().size());
+    for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        VkCommandBuffer computeCommandBuffer = computeCommandBuffers[frame];
+
+        VkCommandBufferBeginInfo beginInfo = {};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+        beginInfo.pInheritanceInfo = nullptr;
+
+        // ~ Start recording ~
+        if (vkBeginCommandBuffer(computeCommandBuffer, &beginInfo) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to begin recording compute command buffer");
+        }
+
+        // Two timestamps per group of blades, written again by every submission of the command buffer
+        const uint32_t firstQuery = 2 * frame * numBlades;
+        if (cullQueryPool != VK_NULL_HANDLE) {
+            vkCmdResetQueryPool(computeCommandBuffer, cullQueryPool, firstQuery, 2 * numBlades);
+        }
+
+        // Bind camera descriptor set
+        vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 0, 1, &cameraDescriptorSets[frame], 0, nullptr);
+
+        // Bind descriptor set for time uniforms
+        vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 1, 1, &timeDescriptorSets[frame], 0, nullptr);
+
+        // Bind the depth pyramid of the previous frame
+        vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 3, 1, &hiZDescriptorSets[frame], 0, nullptr);
+
+        // TODO: For each group of blades bind its descriptor set and dispatch
+        for (uint32_t i = 0; i < numBlades; ++i) {
+            Blades* blades = scene->GetBlades()[i];
+            vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 2, 1, &computeDescriptorSets[frame * numBlades + i], 0, nullptr);
+
+            RecordClearPass(computeCommandBuffer, blades);
+            RecordTileCullPass(computeCommandBuffer, blades);
+#if !USE_DENSITY_SPAWNING
+            // Spawned blades are posed by the cull pass that spawns them
+            RecordSimulatePass(computeCommandBuffer, blades);
+#endif
+            if (cullQueryPool != VK_NULL_HANDLE) {
+                vkCmdWriteTimestamp(computeCommandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, cullQueryPool, firstQuery + 2 * i);
+            }
+            RecordCullPass(computeCommandBuffer, blades);
+            if (cullQueryPool != VK_NULL_HANDLE) {
+                vkCmdWriteTimestamp(computeCommandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, cullQueryPool, firstQuery + 2 * i + 1);
+            }
+            RecordFinalizePass(computeCommandBuffer, blades, frame);
+        }
+
+        // ~ End recording ~
+        if (vkEndCommandBuffer(computeCommandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to record compute command buffer");
+        }
+    }
+}
+
+void Renderer::CreateStreamingCommandBuffers() {
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = cpuSimulation ? graphicsCommandPool : computeCommandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = static_cast<uint32_t>(streamingCommandBuffers.size());
+
+    if (vkAllocateCommandBuffers(logicalDevice, &allocInfo, streamingCommandBuffers.data()) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to allocate command buffers");
+    }
+}
+
+bool Renderer::RecordStreamingCommandBuffer(uint32_t frame) {
+    VkCommandBuffer commandBuffer = streamingCommandBuffers[frame];
+    vkResetCommandBuffer(commandBuffer, 0);
+
     VkCommandBufferBeginInfo beginInfo = {};
     beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
-    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
     beginInfo.pInheritanceInfo = nullptr;
 
-    // ~ Start recording ~
-    if (vkBeginCommandBuffer(computeCommandBuffer, &beginInfo) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to begin recording compute command buffer");
+    if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to begin recording streaming command buffer");
     }
 
-    // Bind to the compute pipeline
-    vkCmdBindPipeline(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipeline);
+    // The passes of the previous submission on this queue may still be reading the slots.
+    // Without a compute queue only the grass shaders read the tiles
+    VkPipelineStageFlags readStages = cpuSimulation ? VK_PIPELINE_STAGE_VERTEX_SHADER_BIT : VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    vkCmdPipelineBarrier(commandBuffer, readStages, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
 
-    // Bind camera descriptor set
-    vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 0, 1, &cameraDescriptorSet, 0, nullptr);
+    uint32_t streamedTiles = 0;
+    for (Blades* blades : scene->GetBlades()) {
+        blades->Stream(camera->GetTarget());
+        streamedTiles += blades->RecordStreaming(commandBuffer, frame);
+    }
 
-    // Bind descriptor set for time uniforms
-    vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 1, 1, &timeDescriptorSet, 0, nullptr);
+    VkMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, readStages, 0, 1, &barrier, 0, nullptr, 0, nullptr);
 
-    // TODO: For each group of blades bind its descriptor set and dispatch
-    for (uint32_t i = 0; i < scene->GetBlades().size(); ++i) {
-		vkCmdBindDescriptorSets(computeCommandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, computePipelineLayout, 2, 1, &computeDescriptorSets[i], 0, nullptr);
-		vkCmdDispatch(computeCommandBuffer, (NUM_BLADES + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+    if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to record streaming command buffer");
     }
+    return streamedTiles > 0;
+}
 
-    // ~ End recording ~
-    if (vkEndCommandBuffer(computeCommandBuffer) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to record compute command buffer");
+void Renderer::CreateFences() {
+    if (timelineSemaphores) {
+        frameFences.fill(VK_NULL_HANDLE);
+        return;
+    }
+
+    // Signaled so that the first wait on each frame returns immediately
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+
+    for (VkFence& fence : frameFences) {
+        if (vkCreateFence(logicalDevice, &fenceInfo, nullptr, &fence) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create fence");
+        }
+    }
+}
+
+void Renderer::CreateSemaphores() {
+    computeFinishedSemaphores.fill(VK_NULL_HANDLE);
+    graphicsFinishedSemaphore = VK_NULL_HANDLE;
+    computeTimeline = VK_NULL_HANDLE;
+    graphicsTimeline = VK_NULL_HANDLE;
+
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    if (timelineSemaphores) {
+        // Both start at frame 0, which every wait before the first frame asks for
+        VkSemaphoreTypeCreateInfoKHR typeInfo = {};
+        typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+        typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+        typeInfo.initialValue = 0;
+        semaphoreInfo.pNext = &typeInfo;
+
+        if (vkCreateSemaphore(logicalDevice, &semaphoreInfo, nullptr, &graphicsTimeline) != VK_SUCCESS ||
+            (!cpuSimulation && vkCreateSemaphore(logicalDevice, &semaphoreInfo, nullptr, &computeTimeline) != VK_SUCCESS)) {
+            throw std::runtime_error("Failed to create semaphores");
+        }
+        return;
+    }
+
+    if (cpuSimulation) {
+        return;
+    }
+
+    for (VkSemaphore& semaphore : computeFinishedSemaphores) {
+        if (vkCreateSemaphore(logicalDevice, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create semaphores");
+        }
+    }
+    if (vkCreateSemaphore(logicalDevice, &semaphoreInfo, nullptr, &graphicsFinishedSemaphore) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create semaphores");
+    }
+}
+
+// --- Compute passes ---
+// Each pass ends with the barrier that makes its output visible to the next one
+
+void Renderer::RecordClearPass(VkCommandBuffer commandBuffer, Blades* blades) {
+    // The previous submission may still be reading the dispatch arguments and the counters
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+
+    // Zero the visible tile count (the x of the tile dispatch) and all the counters
+    vkCmdFillBuffer(commandBuffer, blades->GetTileDispatchBuffer(), 0, sizeof(uint32_t), 0);
+    vkCmdFillBuffer(commandBuffer, blades->GetCountersBuffer(), 0, VK_WHOLE_SIZE, 0);
+
+    std::array<VkBufferMemoryBarrier, 2> barriers = {
+        bufferBarrier(blades->GetTileDispatchBuffer(), VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT),
+        bufferBarrier(blades->GetCountersBuffer(), VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT)
+    };
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+}
+
+void Renderer::RecordTileCullPass(VkCommandBuffer commandBuffer, Blades* blades) {
+    // Reject whole tiles against the frustum and the culling distance
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, tileCullPipeline);
+    vkCmdDispatch(commandBuffer, (NUM_TILES + WORKGROUP_SIZE - 1) / WORKGROUP_SIZE, 1, 1);
+
+    // The visible tile count is the dispatch size of the per-tile passes
+    std::array<VkBufferMemoryBarrier, 2> barriers = {
+        bufferBarrier(blades->GetTileDispatchBuffer(), VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT),
+        bufferBarrier(blades->GetVisibleTilesBuffer(), VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT)
+    };
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+}
+
+void Renderer::RecordSimulatePass(VkCommandBuffer commandBuffer, Blades* blades) {
+    // Step the blades of the visible tiles that are awake from one copy of the state to the other,
+    // one workgroup per tile
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, simulatePipeline);
+    vkCmdDispatchIndirect(commandBuffer, blades->GetTileDispatchBuffer(), 0);
+
+    // The new state and the flipped tile state indices are read by the cull pass,
+    // and by the passes of the next submissions like the tile sleep state
+    std::array<VkBufferMemoryBarrier, 3> barriers = {
+        bufferBarrier(blades->GetControlPointsBuffer(), VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT),
+        bufferBarrier(blades->GetTilesBuffer(), VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT),
+        bufferBarrier(blades->GetTileSleepBuffer(), VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT)
+    };
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+}
+
+void Renderer::RecordCullPass(VkCommandBuffer commandBuffer, Blades* blades) {
+    // Cull the blades of the visible tiles and compact the survivors into the culled blades buffer
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+    vkCmdDispatchIndirect(commandBuffer, blades->GetTileDispatchBuffer(), 0);
+
+    // The counters are read by the finalize pass and copied out for reporting, the visible sets
+    // by the cull pass of the next submission, or rewritten by its streaming copies
+    std::array<VkBufferMemoryBarrier, 2> barriers = {
+        bufferBarrier(blades->GetCountersBuffer(), VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT),
+        bufferBarrier(blades->GetTileVisibilityBuffer(), VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT)
+    };
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+}
+
+void Renderer::RecordFinalizePass(VkCommandBuffer commandBuffer, Blades* blades, uint32_t frame) {
+    // Write the indirect draw arguments from the culled blade count,
+    // the graphics command buffers wait for numBladesBuffer before drawing
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, finalizePipeline);
+    vkCmdDispatch(commandBuffer, 1, 1, 1);
+
+    // Keep the counters of this frame for Frame to read once the submission has completed
+    VkBufferCopy copyRegion = {};
+    copyRegion.size = sizeof(BladeCounters);
+    vkCmdCopyBuffer(commandBuffer, blades->GetCountersBuffer(), blades->GetCounterReadbackBuffer(frame), 1, &copyRegion);
+
+    VkBufferMemoryBarrier barrier = bufferBarrier(blades->GetCounterReadbackBuffer(frame), VK_ACCESS_TRANSFER_WRITE_BIT, VK_ACCESS_HOST_READ_BIT);
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &barrier, 0, nullptr);
+
+    // Release the culled blades and the draw arguments to the graphics family, which acquires them in
+    // RecordCommandBuffers. They are not handed back, the next frame to use them rewrites them entirely
+    if (queueOwnershipTransfer) {
+        std::array<VkBufferMemoryBarrier, 2> releases = {
+            bufferBarrier(blades->GetCulledBladesBuffer(frame), VK_ACCESS_SHADER_WRITE_BIT, 0),
+            bufferBarrier(blades->GetNumBladesBuffer(frame), VK_ACCESS_SHADER_WRITE_BIT, 0)
+        };
+        for (VkBufferMemoryBarrier& release : releases) {
+            release.srcQueueFamilyIndex = device->GetQueueIndex(QueueFlags::Compute);
+            release.dstQueueFamilyIndex = device->GetQueueIndex(QueueFlags::Graphics);
+        }
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, static_cast<uint32_t>(releases.size()), releases.data(), 0, nullptr);
+    }
+}
+
+void Renderer::RecordHiZPass(VkCommandBuffer commandBuffer) {
+    // The render pass leaves the depth read only, make its writes visible to hiz.comp.
+    // Every level is rewritten, so the previous contents of the pyramid are discarded
+    std::array<VkImageMemoryBarrier, 2> barriers = {};
+    barriers[0].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barriers[0].srcAccessMask = VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
+    barriers[0].dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barriers[0].oldLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    barriers[0].newLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL;
+    barriers[0].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[0].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[0].image = depthImage;
+    barriers[0].subresourceRange = { VK_IMAGE_ASPECT_DEPTH_BIT, 0, 1, 0, 1 };
+
+    barriers[1].sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barriers[1].srcAccessMask = 0;
+    barriers[1].dstAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barriers[1].oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barriers[1].newLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barriers[1].srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[1].dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barriers[1].image = hiZImage;
+    barriers[1].subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, static_cast<uint32_t>(hiZLevelViews.size()), 0, 1 };
+
+    vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data());
+
+    vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hiZReducePipeline);
+    for (uint32_t level = 0; level < hiZLevelViews.size(); ++level) {
+        uint32_t width = std::max(hiZExtent.width >> level, 1u);
+        uint32_t height = std::max(hiZExtent.height >> level, 1u);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, hiZReducePipelineLayout, 0, 1, &hiZReduceDescriptorSets[level], 0, nullptr);
+        vkCmdDispatch(commandBuffer, (width + HIZ_WORKGROUP_SIZE - 1) / HIZ_WORKGROUP_SIZE, (height + HIZ_WORKGROUP_SIZE - 1) / HIZ_WORKGROUP_SIZE, 1);
+
+        // The next level reads this one
+        VkImageMemoryBarrier levelBarrier = barriers[1];
+        levelBarrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+        levelBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        levelBarrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        levelBarrier.subresourceRange.baseMipLevel = level;
+        levelBarrier.subresourceRange.levelCount = 1;
+        vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &levelBarrier);
+    }
+}
+
+void Renderer::RecordBladesDraw(VkCommandBuffer commandBuffer, Blades* blades, uint32_t frame, uint32_t list) {
+    VkBuffer vertexBuffers[] = { blades->GetCulledBladesBuffer(frame) };
+    VkDeviceSize offsets[] = { list * MAX_CULLED_BLADES * sizeof(DeviceBlade) };
+    vkCmdBindVertexBuffers(commandBuffer, 0, 1, vertexBuffers, offsets);
+
+    // The draw count written by finalize.comp drops the draws of empty lists on the device. Without it they are
+    // drawn with no vertices or instances, either way the recorded commands do not depend on what was culled
+    VkDeviceSize drawOffset = offsetof(BladeDrawArguments, draws) + list * sizeof(BladeDrawIndirect);
+    if (drawIndirectCount) {
+        VkDeviceSize countOffset = offsetof(BladeDrawArguments, drawCounts) + list * sizeof(uint32_t);
+        cmdDrawIndirectCount(commandBuffer, blades->GetNumBladesBuffer(frame), drawOffset, blades->GetNumBladesBuffer(frame), countOffset, 1, sizeof(BladeDrawIndirect));
+    } else {
+        vkCmdDrawIndirect(commandBuffer, blades->GetNumBladesBuffer(frame), drawOffset, 1, sizeof(BladeDrawIndirect));
+    }
+}
+
+void Renderer::RecordShadowPass(VkCommandBuffer commandBuffer, uint32_t frame) {
+    VkViewport viewport = { 0.0f, 0.0f, static_cast<float>(SHADOW_MAP_DIM), static_cast<float>(SHADOW_MAP_DIM), 0.0f, 1.0f };
+    VkRect2D scissor = { { 0, 0 }, { SHADOW_MAP_DIM, SHADOW_MAP_DIM } };
+    vkCmdSetViewport(commandBuffer, 0, 1, &viewport);
+    vkCmdSetScissor(commandBuffer, 0, 1, &scissor);
+
+    VkClearValue clearValue = {};
+    clearValue.depthStencil = { 1.0f, 0 };
+
+    const uint32_t numModels = static_cast<uint32_t>(scene->GetModels().size());
+    const uint32_t numBlades = static_cast<uint32_t>(scene->GetBlades().size());
+
+    for (uint32_t cascade = 0; cascade < NUM_SHADOW_CASCADES; ++cascade) {
+        VkRenderPassBeginInfo renderPassInfo = {};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = shadowRenderPass;
+        renderPassInfo.framebuffer = shadowFramebuffers[cascade];
+        renderPassInfo.renderArea = scissor;
+        renderPassInfo.clearValueCount = 1;
+        renderPassInfo.pClearValues = &clearValue;
+
+        vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+
+        // The cascade stands in for the camera, the grass shaders are unchanged
+        vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, shadowPipeline);
+        vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, grassPipelineLayout, 0, 1, &shadowCameraDescriptorSets[frame][cascade], 0, nullptr);
+
+        for (uint32_t j = 0; j < numBlades; ++j) {
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, grassPipelineLayout, 1, 1, &modelDescriptorSets[numModels + j], 0, nullptr);
+            vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, grassPipelineLayout, 2, 1, &grassDescriptorSets[frame * numBlades + j], 0, nullptr);
+
+            RecordBladesDraw(commandBuffer, scene->GetBlades()[j], frame, NUM_LOD_TIERS + cascade);
+        }
+
+        vkCmdEndRenderPass(commandBuffer);
     }
 }
 
@@ -1049,7 +2227,8 @@ void Renderer::RecordCommandBuffers() {
         throw std::runtime_error("Swap chain has no images");
     }
     
-    commandBuffers.resize(swapChainImageCount);
+    // Command buffer frame * swapChainImageCount + image draws the culled blades of frame into image
+    commandBuffers.resize(MAX_FRAMES_IN_FLIGHT * swapChainImageCount);
 
     // Specify the command pool and number of buffers to allocate
     VkCommandBufferAllocateInfo allocInfo = {};
@@ -1064,6 +2243,9 @@ void Renderer::RecordCommandBuffers() {
 
     // Start command buffer recording
     for (size_t i = 0; i < commandBuffers.size(); i++) {
+        const uint32_t frame = static_cast<uint32_t>(i) / swapChainImageCount;
+        const uint32_t image = static_cast<uint32_t>(i) % swapChainImageCount;
+
         VkCommandBufferBeginInfo beginInfo = {};
         beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
         beginInfo.flags = VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT;
@@ -1087,14 +2269,11 @@ void Renderer::RecordCommandBuffers() {
         scissor.offset = { 0, 0 };
         scissor.extent = swapChain->GetVkExtent();
 
-        vkCmdSetViewport(commandBuffers[i], 0, 1, &viewport);
-        vkCmdSetScissor(commandBuffers[i], 0, 1, &scissor);
-
         // Begin the render pass
         VkRenderPassBeginInfo renderPassInfo = {};
         renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
         renderPassInfo.renderPass = renderPass;
-        renderPassInfo.framebuffer = framebuffers[i];
+        renderPassInfo.framebuffer = framebuffers[image];
         renderPassInfo.renderArea.offset = { 0, 0 };
         renderPassInfo.renderArea.extent = swapChain->GetVkExtent();
 
@@ -1104,22 +2283,27 @@ void Renderer::RecordCommandBuffers() {
         renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
         renderPassInfo.pClearValues = clearValues.data();
 
-        std::vector<VkBufferMemoryBarrier> barriers(scene->GetBlades().size());
-        for (uint32_t j = 0; j < barriers.size(); ++j) {
-            barriers[j].sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
-            barriers[j].srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
-            barriers[j].dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT;
-            barriers[j].srcQueueFamilyIndex = device->GetQueueIndex(QueueFlags::Compute);
-            barriers[j].dstQueueFamilyIndex = device->GetQueueIndex(QueueFlags::Graphics);
-            barriers[j].buffer = scene->GetBlades()[j]->GetNumBladesBuffer();
-            barriers[j].offset = 0;
-            barriers[j].size = sizeof(BladeDrawIndirect);
+        // Acquire what the finalize pass released, a plain barrier when the queues are of the same family
+        std::vector<VkBufferMemoryBarrier> barriers;
+        for (Blades* blades : scene->GetBlades()) {
+            barriers.push_back(bufferBarrier(blades->GetNumBladesBuffer(frame), VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT));
+            barriers.push_back(bufferBarrier(blades->GetCulledBladesBuffer(frame), VK_ACCESS_SHADER_WRITE_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_SHADER_READ_BIT));
+        }
+        for (VkBufferMemoryBarrier& barrier : barriers) {
+            barrier.srcQueueFamilyIndex = queueOwnershipTransfer ? device->GetQueueIndex(QueueFlags::Compute) : VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = queueOwnershipTransfer ? device->GetQueueIndex(QueueFlags::Graphics) : VK_QUEUE_FAMILY_IGNORED;
         }
 
-        vkCmdPipelineBarrier(commandBuffers[i], VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, 0, 0, nullptr, barriers.size(), barriers.data(), 0, nullptr);
+        vkCmdPipelineBarrier(commandBuffers[i], VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 0, nullptr, static_cast<uint32_t>(barriers.size()), barriers.data(), 0, nullptr);
+
+        // The shadow map is drawn first, the graphics pass samples it
+        RecordShadowPass(commandBuffers[i], frame);
+
+        vkCmdSetViewport(commandBuffers[i], 0, 1, &viewport);
+        vkCmdSetScissor(commandBuffers[i], 0, 1, &scissor);
 
         // Bind the camera descriptor set. This is set 0 in all pipelines so it will be inherited
-        vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineLayout, 0, 1, &cameraDescriptorSet, 0, nullptr);
+        vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, graphicsPipelineLayout, 0, 1, &cameraDescriptorSets[frame], 0, nullptr);
 
         vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
 
@@ -1142,23 +2326,30 @@ void Renderer::RecordCommandBuffers() {
             vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(indices.size()), 1, 0, 0, 0);
         }
 
-        // Bind the grass pipeline
-        vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, grassPipeline);
-
-        for (uint32_t j = 0; j < scene->GetBlades().size(); ++j) {
-            VkBuffer vertexBuffers[] = { scene->GetBlades()[j]->GetCulledBladesBuffer() };
-            VkDeviceSize offsets[] = { 0 };
-            // TODO: Uncomment this when the buffers are populated
-            vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);
-
-            // Draw
-            // TODO: Uncomment this when the buffers are populated
-            vkCmdDrawIndirect(commandBuffers[i], scene->GetBlades()[j]->GetNumBladesBuffer(), 0, 1, sizeof(BladeDrawIndirect));
+        // Bind the grass pipeline of each LOD tier, the tiers share the pipeline layout so the descriptor sets stay bound
+        const VkPipeline lodPipelines[NUM_LOD_TIERS] = { grassPipeline, bladeStripPipeline, bladeCardPipeline };
+        for (uint32_t lod = 0; lod < NUM_LOD_TIERS; ++lod) {
+            vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, lodPipelines[lod]);
+
+            for (uint32_t j = 0; j < scene->GetBlades().size(); ++j) {
+                // Bind the transform of the blades, and the tiles the blade positions are relative to
+                const uint32_t numModels = static_cast<uint32_t>(scene->GetModels().size());
+                const uint32_t numBlades = static_cast<uint32_t>(scene->GetBlades().size());
+                vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, grassPipelineLayout, 1, 1, &modelDescriptorSets[numModels + j], 0, nullptr);
+                vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, grassPipelineLayout, 2, 1, &grassDescriptorSets[frame * numBlades + j], 0, nullptr);
+
+                // Draw, each tier has its own list in the culled blades buffer
+                RecordBladesDraw(commandBuffers[i], scene->GetBlades()[j], frame, lod);
+            }
         }
 
         // End render pass
         vkCmdEndRenderPass(commandBuffers[i]);
 
+        if (occlusionCulling) {
+            RecordHiZPass(commandBuffers[i]);
+        }
+
         // ~ End recording ~
         if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS) {
             throw std::runtime_error("Failed to record command buffer");
@@ -1166,81 +2357,357 @@ void Renderer::RecordCommandBuffers() {
     }
 }
 
-void Renderer::Frame() {
+uint32_t Renderer::GetSleepingBlades() const {
+    return sleepingBlades;
+}
 
-    VkSubmitInfo computeSubmitInfo = {};
-    computeSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+float Renderer::GetReusedBladeShare() const {
+    uint32_t culled = retestedBlades + reusedBlades;
+    return culled > 0 ? static_cast<float>(reusedBlades) / culled : 0.0f;
+}
 
-    computeSubmitInfo.commandBufferCount = 1;
-    computeSubmitInfo.pCommandBuffers = &computeCommandBuffer;
+float Renderer::GetCullTime() const {
+    return cullTime;
+}
 
-    if (vkQueueSubmit(device->GetQueue(QueueFlags::Compute), 1, &computeSubmitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to submit draw command buffer");
+void Renderer::SetVertexPulling(bool enabled) {
+    if (enabled == vertexPulling) {
+        return;
     }
+    vertexPulling = enabled;
+    std::cout << "Drawing near blades with " << (vertexPulling ? "vertex pulling" : "tessellation") << std::endl;
+
+    // The two paths count the near tier draw in patches or in strip vertices
+    WaitForFrame(submittedFrames);
+    vkDestroyPipeline(logicalDevice, finalizePipeline, nullptr);
+    finalizePipeline = CreateComputeShaderPipeline(vertexPulling ? "shaders/finalize_pull.comp.spv" : "shaders/finalize.comp.spv");
+
+    // Rebuilds the grass pipelines and records the command buffers again
+    RecreateFrameResources();
+}
+
+bool Renderer::GetVertexPulling() const {
+    return vertexPulling;
+}
+
+void Renderer::SetOcclusionTests(bool enabled) {
+    occlusionTests = enabled;
+}
 
-    if (!swapChain->Acquire()) {
+void Renderer::SetVisibleSetReuse(bool enabled) {
+    visibleSetReuse = enabled;
+}
+
+bool Renderer::GetVisibleSetReuse() const {
+    return visibleSetReuse;
+}
+
+const ShadowBufferObject& Renderer::GetShadowBufferObject() const {
+    return shadowCascades->GetBufferObject();
+}
+
+void Renderer::Frame() {
+    // Everything of this frame was last used MAX_FRAMES_IN_FLIGHT frames ago. Waiting for that frame is what
+    // keeps the CPU from running further ahead of the GPU
+    const uint64_t frame = submittedFrames + 1;
+    WaitForFrame(frame > MAX_FRAMES_IN_FLIGHT ? frame - MAX_FRAMES_IN_FLIGHT : 0);
+
+    // Acquire before submitting anything, so that every compute submission is followed by the
+    // graphics submission that waits for it
+    if (!swapChain->Acquire(frameIndex)) {
         RecreateFrameResources();
         return;
     }
 
     // Ensure we have valid command buffers and the index is valid
     uint32_t imageIndex = swapChain->GetIndex();
-    if (imageIndex >= commandBuffers.size() || commandBuffers.empty()) {
+    if (imageIndex >= swapChain->GetCount() || commandBuffers.size() != MAX_FRAMES_IN_FLIGHT * swapChain->GetCount()) {
         RecreateFrameResources();
         return;
     }
 
+    // Reset only once the frame is sure to be submitted, or the next wait on it would never return
+    if (!timelineSemaphores) {
+        vkResetFences(logicalDevice, 1, &frameFences[frameIndex]);
+    }
+
+    // The uniform copies of this frame are free again, and the cascades are refitted to where the camera moved
+    camera->UploadBuffer(frameIndex);
+    scene->UploadTime(frameIndex);
+    shadowCascades->Update(camera->GetBufferObject(), camera->GetTarget(), frameIndex);
+
+    // Uploads recorded since the last frame go out in one batch, which the first submission of the frame waits for.
+    // The graphics submission waits for the compute one, and so for the uploads too
+    device->GetStagingRing()->Flush();
+    VkSemaphore uploadSemaphore = device->GetStagingRing()->TakeSemaphore();
+
+    bool streamed = false;
+    if (cpuSimulation) {
+        // The host blades of regenerated slots are replaced right away, the device tiles before the frame is drawn
+        streamed = RecordStreamingCommandBuffer(frameIndex);
+
+        for (Blades* blades : scene->GetBlades()) {
+            BladeDrawIndirect indirectDraw = bladeSimulator->Step(blades->GetHostBlades(), blades->GetHostTiles(), scene->GetTime(), camera->GetBufferObject(), hostCulledBlades);
+            blades->UploadCulledBlades(frameIndex, hostCulledBlades.data(), indirectDraw.vertexCount, vertexPulling ? PULL_VERTICES_PER_BLADE : 1);
+        }
+    }
+    else {
+        // The staging buffers of this frame are free again, regenerate the slots the ring moved past
+        streamed = RecordStreamingCommandBuffer(frameIndex);
+
+        // Wait for the previous graphics submission to finish building the pyramid, and drawing from the tiles
+        // that the streaming copies overwrite
+        bool waitForGraphics = occlusionCulling;
+#if USE_PACKED_BLADES
+        // Packed culled blades are drawn relative to the bounds of their tile, which must not change under the
+        // previous graphics submission. Binary semaphores only link the queues for occlusion culling
+        waitForGraphics |= streamed;
+        if (streamed && !occlusionCulling && !timelineSemaphores) {
+            vkQueueWaitIdle(device->GetQueue(QueueFlags::Graphics));
+        }
+#endif
+
+        sleepingBlades = 0;
+        retestedBlades = 0;
+        reusedBlades = 0;
+        for (Blades* blades : scene->GetBlades()) {
+            BladeCounters counters = blades->ReadCounters(frameIndex);
+            sleepingBlades += counters.sleepingBlades;
+            retestedBlades += counters.retestedBlades;
+            reusedBlades += counters.reusedBlades;
+        }
+
+        // The queries of this frame were last written by the submission waited for above. Until every frame in
+        // flight was submitted once, some were never written
+        if (cullQueryPool != VK_NULL_HANDLE && submittedFrames >= MAX_FRAMES_IN_FLIGHT) {
+            const uint32_t numBlades = static_cast<uint32_t>(scene->GetBlades().size());
+            std::vector<uint64_t> timestamps(2 * numBlades);
+            if (vkGetQueryPoolResults(logicalDevice, cullQueryPool, 2 * frameIndex * numBlades, 2 * numBlades, timestamps.size() * sizeof(uint64_t),
+                                      timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) == VK_SUCCESS) {
+                uint64_t ticks = 0;
+                for (uint32_t i = 0; i < numBlades; ++i) {
+                    ticks += timestamps[2 * i + 1] - timestamps[2 * i];
+                }
+                cullTime = static_cast<float>(ticks) * timestampPeriod * 1e-6f;
+            }
+        }
+
+        // The pyramid holds the depth of the last graphics submission, seen from the camera it was drawn with
+        HiZBufferObject hiZ;
+        hiZ.viewProj = hiZCamera.viewProjectionMatrix;
+        hiZ.size = glm::vec2(static_cast<float>(hiZExtent.width), static_cast<float>(hiZExtent.height));
+        hiZ.levels = static_cast<uint32_t>(hiZLevelViews.size());
+        hiZ.valid = occlusionCulling && occlusionTests && hiZValid ? 1 : 0;
+        hiZ.reuseVisibleSet = visibleSetReuse ? 1 : 0;
+        memcpy(hiZMappedData[frameIndex], &hiZ, sizeof(HiZBufferObject));
+
+        VkSubmitInfo computeSubmitInfo = {};
+        computeSubmitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        VkTimelineSemaphoreSubmitInfoKHR computeTimelineInfo = {};
+        computeTimelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+
+        // Values only matter for the timelines
+        std::array<VkSemaphore, 2> computeWaitSemaphores;
+        std::array<uint64_t, 2> computeWaitValues = {};
+        uint32_t computeWaitCount = 0;
+        if (uploadSemaphore != VK_NULL_HANDLE) {
+            computeWaitSemaphores[computeWaitCount++] = uploadSemaphore;
+        }
+
+        const std::array<VkPipelineStageFlags, 2> computeWaitStages = { VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT };
+        if (timelineSemaphores) {
+            // The previous frame on the graphics queue, and this frame on the compute queue
+            if (waitForGraphics) {
+                computeWaitValues[computeWaitCount] = submittedFrames;
+                computeWaitSemaphores[computeWaitCount++] = graphicsTimeline;
+            }
+            computeTimelineInfo.waitSemaphoreValueCount = computeWaitCount;
+            computeTimelineInfo.pWaitSemaphoreValues = computeWaitValues.data();
+            computeTimelineInfo.signalSemaphoreValueCount = 1;
+            computeTimelineInfo.pSignalSemaphoreValues = &frame;
+            computeSubmitInfo.pNext = &computeTimelineInfo;
+
+            computeSubmitInfo.signalSemaphoreCount = 1;
+            computeSubmitInfo.pSignalSemaphores = &computeTimeline;
+        }
+        else {
+            if (occlusionCulling && graphicsFinishedPending) {
+                computeWaitSemaphores[computeWaitCount++] = graphicsFinishedSemaphore;
+                graphicsFinishedPending = false;
+            }
+            computeSubmitInfo.signalSemaphoreCount = 1;
+            computeSubmitInfo.pSignalSemaphores = &computeFinishedSemaphores[frameIndex];
+        }
+        computeSubmitInfo.waitSemaphoreCount = computeWaitCount;
+        computeSubmitInfo.pWaitSemaphores = computeWaitSemaphores.data();
+        computeSubmitInfo.pWaitDstStageMask = computeWaitStages.data();
+
+        std::array<VkCommandBuffer, 2> computeCommands = { streamingCommandBuffers[frameIndex], computeCommandBuffers[frameIndex] };
+        computeSubmitInfo.commandBufferCount = streamed ? 2 : 1;
+        computeSubmitInfo.pCommandBuffers = streamed ? computeCommands.data() : &computeCommandBuffers[frameIndex];
+
+        if (vkQueueSubmit(device->GetQueue(QueueFlags::Compute), 1, &computeSubmitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to submit draw command buffer");
+        }
+    }
+
     // Submit the command buffer
     VkSubmitInfo submitInfo = {};
     submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-    VkSemaphore waitSemaphores[] = { swapChain->GetImageAvailableVkSemaphore() };
-    VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
-    submitInfo.waitSemaphoreCount = 1;
+    // The culled blades are drawn, and the pyramid rewritten, only once the compute pass is done with them
+    // Without a compute queue the graphics submission waits for the uploads itself
+    VkSemaphore waitSemaphores[] = { swapChain->GetImageAvailableVkSemaphore(frameIndex), cpuSimulation ? uploadSemaphore : timelineSemaphores ? computeTimeline : computeFinishedSemaphores[frameIndex] };
+    VkPipelineStageFlags secondWaitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    if (!cpuSimulation) {
+        secondWaitStage = VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    }
+    VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, secondWaitStage };
+    submitInfo.waitSemaphoreCount = waitSemaphores[1] != VK_NULL_HANDLE ? 2 : 1;
     submitInfo.pWaitSemaphores = waitSemaphores;
     submitInfo.pWaitDstStageMask = waitStages;
 
-    submitInfo.commandBufferCount = 1;
-    submitInfo.pCommandBuffers = &commandBuffers[imageIndex];
-
-    VkSemaphore signalSemaphores[] = { swapChain->GetRenderFinishedVkSemaphore() };
-    submitInfo.signalSemaphoreCount = 1;
+    // The timelines are signaled for every frame, the CPU waits on them. Values of binary semaphores are ignored
+    VkSemaphore signalSemaphores[] = { swapChain->GetRenderFinishedVkSemaphore(), timelineSemaphores ? graphicsTimeline : graphicsFinishedSemaphore };
+    submitInfo.signalSemaphoreCount = occlusionCulling || timelineSemaphores ? 2 : 1;
     submitInfo.pSignalSemaphores = signalSemaphores;
 
-    if (vkQueueSubmit(device->GetQueue(QueueFlags::Graphics), 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+    const uint64_t timelineValues[] = { 0, frame };
+    VkTimelineSemaphoreSubmitInfoKHR timelineInfo = {};
+    timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+    timelineInfo.waitSemaphoreValueCount = submitInfo.waitSemaphoreCount;
+    timelineInfo.pWaitSemaphoreValues = timelineValues;
+    timelineInfo.signalSemaphoreValueCount = submitInfo.signalSemaphoreCount;
+    timelineInfo.pSignalSemaphoreValues = timelineValues;
+    if (timelineSemaphores) {
+        submitInfo.pNext = &timelineInfo;
+    }
+
+    // Without a compute queue the streaming copies run right before the frame is drawn
+    std::array<VkCommandBuffer, 2> graphicsCommands = { streamingCommandBuffers[frameIndex], commandBuffers[frameIndex * swapChain->GetCount() + imageIndex] };
+    bool graphicsStreamed = streamed && cpuSimulation;
+    submitInfo.commandBufferCount = graphicsStreamed ? 2 : 1;
+    submitInfo.pCommandBuffers = graphicsStreamed ? graphicsCommands.data() : &graphicsCommands[1];
+
+    if (vkQueueSubmit(device->GetQueue(QueueFlags::Graphics), 1, &submitInfo, frameFences[frameIndex]) != VK_SUCCESS) {
         throw std::runtime_error("Failed to submit draw command buffer");
     }
+    submittedFrames = frame;
+
+    if (occlusionCulling) {
+        graphicsFinishedPending = !timelineSemaphores;
+        hiZValid = true;
+        hiZCamera = camera->GetBufferObject();
+    }
+
+    // The next frame prepares its own resources while this one runs
+    frameIndex = (frameIndex + 1) % MAX_FRAMES_IN_FLIGHT;
 
     if (!swapChain->Present()) {
         RecreateFrameResources();
     }
 }
 
+void Renderer::WaitForFrame(uint64_t frame) {
+    if (frame == 0) {
+        return;
+    }
+
+    if (timelineSemaphores) {
+        VkSemaphoreWaitInfoKHR waitInfo = {};
+        waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+        waitInfo.semaphoreCount = 1;
+        waitInfo.pSemaphores = &graphicsTimeline;
+        waitInfo.pValues = &frame;
+        waitTimelineSemaphores(logicalDevice, &waitInfo, std::numeric_limits<uint64_t>::max());
+        return;
+    }
+
+    // Fences do not signal in submission order, wait for every tracked frame up to this one
+    std::vector<VkFence> fences;
+    for (uint64_t f = frame; f > 0 && f + MAX_FRAMES_IN_FLIGHT > submittedFrames; --f) {
+        fences.push_back(frameFences[(f - 1) % MAX_FRAMES_IN_FLIGHT]);
+    }
+    if (!fences.empty()) {
+        vkWaitForFences(logicalDevice, static_cast<uint32_t>(fences.size()), fences.data(), VK_TRUE, std::numeric_limits<uint64_t>::max());
+    }
+}
+
+uint64_t Renderer::GetSubmittedFrames() const {
+    return submittedFrames;
+}
+
 Renderer::~Renderer() {
     vkDeviceWaitIdle(logicalDevice);
 
     // TODO: destroy any resources you created
 
     vkFreeCommandBuffers(logicalDevice, graphicsCommandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
-    vkFreeCommandBuffers(logicalDevice, computeCommandPool, 1, &computeCommandBuffer);
+    vkFreeCommandBuffers(logicalDevice, cpuSimulation ? graphicsCommandPool : computeCommandPool, static_cast<uint32_t>(streamingCommandBuffers.size()), streamingCommandBuffers.data());
+    if (!cpuSimulation) {
+        vkFreeCommandBuffers(logicalDevice, computeCommandPool, static_cast<uint32_t>(computeCommandBuffers.size()), computeCommandBuffers.data());
+    }
+    // Fences and semaphores that were not created are null, which destroying ignores
+    for (VkSemaphore semaphore : computeFinishedSemaphores) {
+        vkDestroySemaphore(logicalDevice, semaphore, nullptr);
+    }
+    vkDestroySemaphore(logicalDevice, graphicsFinishedSemaphore, nullptr);
+    vkDestroySemaphore(logicalDevice, computeTimeline, nullptr);
+    vkDestroySemaphore(logicalDevice, graphicsTimeline, nullptr);
+    for (VkFence fence : frameFences) {
+        vkDestroyFence(logicalDevice, fence, nullptr);
+    }
+    vkDestroyQueryPool(logicalDevice, cullQueryPool, nullptr);
     
     vkDestroyPipeline(logicalDevice, graphicsPipeline, nullptr);
     vkDestroyPipeline(logicalDevice, grassPipeline, nullptr);
-    vkDestroyPipeline(logicalDevice, computePipeline, nullptr);
+    vkDestroyPipeline(logicalDevice, bladeStripPipeline, nullptr);
+    vkDestroyPipeline(logicalDevice, bladeCardPipeline, nullptr);
+    vkDestroyPipeline(logicalDevice, shadowPipeline, nullptr);
+    vkDestroyPipeline(logicalDevice, tileCullPipeline, nullptr);
+    vkDestroyPipeline(logicalDevice, simulatePipeline, nullptr);
+    vkDestroyPipeline(logicalDevice, cullPipeline, nullptr);
+    vkDestroyPipeline(logicalDevice, finalizePipeline, nullptr);
+    vkDestroyPipeline(logicalDevice, hiZReducePipeline, nullptr);
 
     vkDestroyPipelineLayout(logicalDevice, graphicsPipelineLayout, nullptr);
     vkDestroyPipelineLayout(logicalDevice, grassPipelineLayout, nullptr);
     vkDestroyPipelineLayout(logicalDevice, computePipelineLayout, nullptr);
+    vkDestroyPipelineLayout(logicalDevice, hiZReducePipelineLayout, nullptr);
 
     vkDestroyDescriptorSetLayout(logicalDevice, cameraDescriptorSetLayout, nullptr);
     vkDestroyDescriptorSetLayout(logicalDevice, modelDescriptorSetLayout, nullptr);
     vkDestroyDescriptorSetLayout(logicalDevice, timeDescriptorSetLayout, nullptr);
 	vkDestroyDescriptorSetLayout(logicalDevice, computeDescriptorSetLayout, nullptr);
+    vkDestroyDescriptorSetLayout(logicalDevice, grassDescriptorSetLayout, nullptr);
+    vkDestroyDescriptorSetLayout(logicalDevice, hiZReduceDescriptorSetLayout, nullptr);
+    vkDestroyDescriptorSetLayout(logicalDevice, hiZDescriptorSetLayout, nullptr);
+
+    vkDestroySampler(logicalDevice, hiZSampler, nullptr);
+    for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        vkDestroyBuffer(logicalDevice, hiZBuffers[frame], nullptr);
+        device->GetAllocator()->Free(hiZBufferMemories[frame]);
+    }
+
+    vkDestroySampler(logicalDevice, shadowSampler, nullptr);
+    for (uint32_t cascade = 0; cascade < NUM_SHADOW_CASCADES; ++cascade) {
+        vkDestroyFramebuffer(logicalDevice, shadowFramebuffers[cascade], nullptr);
+        vkDestroyImageView(logicalDevice, shadowLayerViews[cascade], nullptr);
+    }
+    vkDestroyImageView(logicalDevice, shadowImageView, nullptr);
+    vkDestroyImage(logicalDevice, shadowImage, nullptr);
+    device->GetAllocator()->Free(shadowImageMemory);
+    delete shadowCascades;
 
     vkDestroyDescriptorPool(logicalDevice, descriptorPool, nullptr);
 
     vkDestroyRenderPass(logicalDevice, renderPass, nullptr);
+    vkDestroyRenderPass(logicalDevice, shadowRenderPass, nullptr);
     DestroyFrameResources();
-    vkDestroyCommandPool(logicalDevice, computeCommandPool, nullptr);
+    if (!cpuSimulation) {
+        vkDestroyCommandPool(logicalDevice, computeCommandPool, nullptr);
+    }
     vkDestroyCommandPool(logicalDevice, graphicsCommandPool, nullptr);
+
+    delete bladeSimulator;
 }
@@ -1,84 +1,274 @@
 #pragma once
 
+#include <array>
 #include <iostream>
+#include <string>
 #include "Device.h"
 #include "SwapChain.h"
 #include "Scene.h"
 #include "Camera.h"
+#include "ShadowCascades.h"
+
+class BladeSimulator;
+
+// What the depth pyramid holds, layout matches the HiZ uniform block in shaders/blades.glsl
+struct HiZBufferObject {
+    glm::mat4 viewProj;
+    glm::vec2 size;
+    uint32_t levels;
+    uint32_t valid;
+    uint32_t reuseVisibleSet;
+};
 
 class Renderer {
 public:
     Renderer() = delete;
-    Renderer(Device* device, SwapChain* swapChain, Scene* scene, Camera* camera);
+    // With vertexPulling, near blades are drawn without tessellation shaders
+    Renderer(Device* device, SwapChain* swapChain, Scene* scene, Camera* camera, bool vertexPulling);
     ~Renderer();
 
     void CreateCommandPools();
 
     void CreateRenderPass();
+    // Shadow map with one layer per cascade, and the depth-only render pass drawing into it
+    void CreateShadowResources();
 
     void CreateCameraDescriptorSetLayout();
     void CreateModelDescriptorSetLayout();
     void CreateTimeDescriptorSetLayout();
     void CreateComputeDescriptorSetLayout();
+    void CreateGrassDescriptorSetLayout();
+    void CreateHiZDescriptorSetLayouts();
 
     void CreateDescriptorPool();
 
-    void CreateCameraDescriptorSet();
+    void CreateCameraDescriptorSets();
     void CreateModelDescriptorSets();
-    void CreateTimeDescriptorSet();
+    void CreateTimeDescriptorSets();
     void CreateComputeDescriptorSets();
+    void CreateGrassDescriptorSets();
+    void CreateHiZDescriptorSets();
 
     void CreateGraphicsPipeline();
     void CreateGrassPipeline();
+    // Without tescPath and tesePath the pipeline draws triangle strips from the vertex shader alone
+    // Without bladeAttributes the vertex shader reads the blades from a storage buffer itself
+    // Without fragPath the pipeline only writes depth, into the shadow map
+    VkPipeline CreateGrassShaderPipeline(const std::string& vertPath, const std::string& tescPath, const std::string& tesePath, const std::string& fragPath, VkVertexInputRate inputRate, bool bladeAttributes);
     void CreateComputePipeline();
+    VkPipeline CreateComputeShaderPipeline(const std::string& shaderPath);
+    void CreateHiZPipeline();
 
     void CreateFrameResources();
     void DestroyFrameResources();
     void RecreateFrameResources();
 
+    // Depth pyramid sized after the depth attachment, rebuilt with the frame resources
+    void CreateHiZResources();
+    void DestroyHiZResources();
+
     void RecordCommandBuffers();
     void RecordComputeCommandBuffer();
+    // Streaming copies run on the compute queue, or on the graphics queue without one
+    void CreateStreamingCommandBuffers();
+    // Move the tile rings of the blades to the camera target and record the regenerated slots of the frame.
+    // Returns false when there was nothing to regenerate and the command buffer must not be submitted
+    bool RecordStreamingCommandBuffer(uint32_t frame);
+    // Fences of the graphics submission of each frame in flight, only used without timeline semaphores
+    void CreateFences();
+    void CreateSemaphores();
+
+    void RecordClearPass(VkCommandBuffer commandBuffer, Blades* blades);
+    void RecordTileCullPass(VkCommandBuffer commandBuffer, Blades* blades);
+    void RecordSimulatePass(VkCommandBuffer commandBuffer, Blades* blades);
+    void RecordCullPass(VkCommandBuffer commandBuffer, Blades* blades);
+    void RecordFinalizePass(VkCommandBuffer commandBuffer, Blades* blades, uint32_t frame);
+    // Reduce the depth attachment into the depth pyramid, at the end of the graphics pass
+    void RecordHiZPass(VkCommandBuffer commandBuffer);
+    // Draw one culled list of the blades, with the pipeline and descriptor sets already bound
+    void RecordBladesDraw(VkCommandBuffer commandBuffer, Blades* blades, uint32_t frame, uint32_t list);
+    // Draw the shadow casters culled for each cascade into its layer of the shadow map, ahead of the graphics pass
+    void RecordShadowPass(VkCommandBuffer commandBuffer, uint32_t frame);
 
     void Frame();
 
+    // Block until the graphics submission of a frame is done, and with it the compute submission it waited for.
+    // Frames count from 1, frame 0 is done from the start. Without timeline semaphores only the last
+    // MAX_FRAMES_IN_FLIGHT frames are tracked, earlier ones are done already
+    void WaitForFrame(uint64_t frame);
+    // Frames submitted so far, the last one waited for by WaitForFrame(GetSubmittedFrames())
+    uint64_t GetSubmittedFrames() const;
+
+    // Switch the near blades between tessellation and vertex pulling, rebuilding the pipelines and command buffers.
+    // Switching to tessellation requires the tessellationShader feature
+    void SetVertexPulling(bool enabled);
+    bool GetVertexPulling() const;
+
+    // Skip the tests of tiles and blades against the depth pyramid, which is still built. Used while comparing
+    // with BladeKernel, which has no pyramid to test against
+    void SetOcclusionTests(bool enabled);
+    // Let blades in the visible set of the previous frame skip the view dependent tests, see USE_TEMPORAL_CULLING
+    void SetVisibleSetReuse(bool enabled);
+    bool GetVisibleSetReuse() const;
+
+    // Cascades the last frame culled its shadow casters against
+    const ShadowBufferObject& GetShadowBufferObject() const;
+
+    // Blades of visible tiles that were asleep in the last frame read back
+    uint32_t GetSleepingBlades() const;
+    // Share of the blades culled in the last frame read back that skipped the orientation, frustum and depth
+    // pyramid tests for being in the visible set of the frame before, 0 when blades are culled on the CPU.
+    // They are still posed, assigned a LOD and compacted, GetCullTime shows what the skipped tests save
+    float GetReusedBladeShare() const;
+    // GPU time in milliseconds of the cull passes of the last frame read back, 0 when blades are culled on the CPU
+    // or the compute queue does not write timestamps
+    float GetCullTime() const;
+
 private:
     Device* device;
     VkDevice logicalDevice;
     SwapChain* swapChain;
     Scene* scene;
     Camera* camera;
+    ShadowCascades* shadowCascades;
 
     VkCommandPool graphicsCommandPool;
     VkCommandPool computeCommandPool;
 
     VkRenderPass renderPass;
+    VkRenderPass shadowRenderPass;
 
     VkDescriptorSetLayout cameraDescriptorSetLayout;
     VkDescriptorSetLayout modelDescriptorSetLayout;
     VkDescriptorSetLayout timeDescriptorSetLayout;
 	VkDescriptorSetLayout computeDescriptorSetLayout;
+    VkDescriptorSetLayout grassDescriptorSetLayout;
+    VkDescriptorSetLayout hiZReduceDescriptorSetLayout;
+    VkDescriptorSetLayout hiZDescriptorSetLayout;
     
     VkDescriptorPool descriptorPool;
 
-    VkDescriptorSet cameraDescriptorSet;
+    // Camera and time sets per frame in flight, each reading the uniform copies of its frame
+    std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> cameraDescriptorSets;
+    // Camera sets seen from each shadow cascade, bound by the shadow pass in place of cameraDescriptorSets
+    std::array<std::array<VkDescriptorSet, NUM_SHADOW_CASCADES>, MAX_FRAMES_IN_FLIGHT> shadowCameraDescriptorSets;
+    // One per model, then one per blades
     std::vector<VkDescriptorSet> modelDescriptorSets;
-    VkDescriptorSet timeDescriptorSet;
+    std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> timeDescriptorSets;
     std::vector<VkDescriptorSet> computeDescriptorSets;
+    // One per blades per frame in flight, like computeDescriptorSets
+    std::vector<VkDescriptorSet> grassDescriptorSets;
+    // One per pyramid level, reading the level below (or the depth attachment) and writing the level
+    std::vector<VkDescriptorSet> hiZReduceDescriptorSets;
+    // Pyramid and the camera it was rendered with, one per frame in flight
+    std::array<VkDescriptorSet, MAX_FRAMES_IN_FLIGHT> hiZDescriptorSets;
 
     VkPipelineLayout graphicsPipelineLayout;
     VkPipelineLayout grassPipelineLayout;
     VkPipelineLayout computePipelineLayout;
+    VkPipelineLayout hiZReducePipelineLayout;
 
     VkPipeline graphicsPipeline;
+    // Near, mid and far LOD tiers of the blades
     VkPipeline grassPipeline;
-    VkPipeline computePipeline;
+    VkPipeline bladeStripPipeline;
+    VkPipeline bladeCardPipeline;
+    // Depth-only mid tier strips, for every shadow caster whatever its tier
+    VkPipeline shadowPipeline;
+    VkPipeline tileCullPipeline;
+    VkPipeline simulatePipeline;
+    VkPipeline cullPipeline;
+    VkPipeline finalizePipeline;
+    VkPipeline hiZReducePipeline;
 
     std::vector<VkImageView> imageViews;
     VkImage depthImage;
-    VkDeviceMemory depthImageMemory;
+    MemoryAllocation depthImageMemory;
     VkImageView depthImageView;
     std::vector<VkFramebuffer> framebuffers;
 
+    VkImage hiZImage;
+    MemoryAllocation hiZImageMemory;
+    // Whole pyramid for sampling, and one view per level for writing
+    VkImageView hiZImageView;
+    std::vector<VkImageView> hiZLevelViews;
+    VkExtent2D hiZExtent;
+    VkSampler hiZSampler;
+    std::array<VkBuffer, MAX_FRAMES_IN_FLIGHT> hiZBuffers;
+    std::array<MemoryAllocation, MAX_FRAMES_IN_FLIGHT> hiZBufferMemories;
+    std::array<void*, MAX_FRAMES_IN_FLIGHT> hiZMappedData;
+
+    // Rendered and sampled in the same graphics submission. Its size does not follow the swap chain
+    VkImage shadowImage;
+    MemoryAllocation shadowImageMemory;
+    // Every cascade for sampling, and one view per cascade for drawing
+    VkImageView shadowImageView;
+    std::array<VkImageView, NUM_SHADOW_CASCADES> shadowLayerViews;
+    std::array<VkFramebuffer, NUM_SHADOW_CASCADES> shadowFramebuffers;
+    VkSampler shadowSampler;
+
     std::vector<VkCommandBuffer> commandBuffers;
-    VkCommandBuffer computeCommandBuffer;
+    std::array<VkCommandBuffer, MAX_FRAMES_IN_FLIGHT> computeCommandBuffers;
+    // Rerecorded every frame that regenerates tiles, submitted ahead of the frame's other command buffers
+    std::array<VkCommandBuffer, MAX_FRAMES_IN_FLIGHT> streamingCommandBuffers;
+    // Signaled by the graphics submission of each frame. Waited for before the frame's resources are reused,
+    // which caps the frames the CPU runs ahead of the GPU at MAX_FRAMES_IN_FLIGHT
+    std::array<VkFence, MAX_FRAMES_IN_FLIGHT> frameFences;
+    // The graphics pass waits for the culled blades of its frame, and with occlusion culling the compute pass
+    // waits for the depth pyramid of the previous graphics pass
+    std::array<VkSemaphore, MAX_FRAMES_IN_FLIGHT> computeFinishedSemaphores;
+    VkSemaphore graphicsFinishedSemaphore;
+    bool graphicsFinishedPending;
+
+    // Set when the queues are synchronized through VK_KHR_timeline_semaphore. Each queue then counts the frames
+    // it finished on its own semaphore, in place of the fences and binary semaphores above
+    bool timelineSemaphores;
+    VkSemaphore computeTimeline;
+    VkSemaphore graphicsTimeline;
+    PFN_vkWaitSemaphoresKHR waitTimelineSemaphores;
+    uint64_t submittedFrames;
+
+    // Selects the culled blades buffers written by the compute pass and drawn by the graphics pass
+    uint32_t frameIndex;
+
+    // Sum of BladeCounters::sleepingBlades over all blades
+    uint32_t sleepingBlades;
+    // Sums of BladeCounters::retestedBlades and reusedBlades over all blades
+    uint32_t retestedBlades;
+    uint32_t reusedBlades;
+
+    // Set when the device has no compute queue, blades are then simulated on the CPU
+    bool cpuSimulation;
+    BladeSimulator* bladeSimulator;
+
+    // Set when near blades are drawn by grass_pull.vert instead of the tessellation shaders
+    bool vertexPulling;
+
+    // Set when the draws read their count from the numBlades buffers, through VK_KHR_draw_indirect_count
+    bool drawIndirectCount;
+    PFN_vkCmdDrawIndirectCountKHR cmdDrawIndirectCount;
+
+    // Set when the device supports the subgroup operations used by cull_subgroup.comp
+    bool subgroupCompaction;
+
+    // Set when the compute queue is of another family than the graphics queue. The culled blades and their draw
+    // arguments are then released by the compute pass and acquired by the graphics pass every frame
+    bool queueOwnershipTransfer;
+
+    // Set when blades are tested against the depth pyramid. The pyramid is built on the graphics queue,
+    // so its family has to support compute
+    bool occlusionCulling;
+    // Set once the pyramid holds a frame drawn with the current frame resources, and the camera it was drawn with
+    bool hiZValid;
+    bool occlusionTests;
+    bool visibleSetReuse;
+
+    // Timestamps before and after the cull pass of each group of blades in each frame in flight,
+    // null when the compute queue does not write timestamps
+    VkQueryPool cullQueryPool;
+    // Nanoseconds per timestamp tick
+    float timestampPeriod;
+    float cullTime;
+    CameraBufferObject hiZCamera;
+    std::vector<Blade> hostCulledBlades;
 };
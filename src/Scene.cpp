@@ -1,10 +1,17 @@
+#include <algorithm>
 #include "Scene.h"
 #include "BufferUtils.h"
 
 Scene::Scene(Device* device) : device(device) {
-    BufferUtils::CreateBuffer(device, sizeof(Time), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, timeBuffer, timeBufferMemory);
-    vkMapMemory(device->GetVkDevice(), timeBufferMemory, 0, sizeof(Time), 0, &mappedData);
-    memcpy(mappedData, &time, sizeof(Time));
+    time.deltaTime = FIXED_TIME_STEP;
+    time.substeps = 0;
+
+    for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        // Read by the simulate pass on the compute queue and by the draws on the graphics queue
+        BufferUtils::CreateBuffer(device, sizeof(Time), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, timeBuffers[frame], timeBufferMemories[frame], true);
+        mappedData[frame] = timeBufferMemories[frame].mappedData;
+        UploadTime(frame);
+    }
 }
 
 const std::vector<Model*>& Scene::GetModels() const {
@@ -28,18 +35,38 @@ void Scene::UpdateTime() {
     duration<float> nextDeltaTime = duration_cast<duration<float>>(currentTime - startTime);
     startTime = currentTime;
 
-    time.deltaTime = nextDeltaTime.count();
-    time.totalTime += time.deltaTime;
+    // Whole steps beyond maxSubsteps are dropped, only the fraction of a step is carried over
+    accumulator += nextDeltaTime.count();
+    unsigned int substeps = static_cast<unsigned int>(accumulator / FIXED_TIME_STEP);
+    accumulator = std::max(accumulator - substeps * FIXED_TIME_STEP, 0.0f);
+    substeps = std::min(substeps, maxSubsteps);
+
+    time.deltaTime = FIXED_TIME_STEP;
+    time.totalTime += substeps * FIXED_TIME_STEP;
+    time.substeps = substeps;
+    time.alpha = std::min(accumulator / FIXED_TIME_STEP, 1.0f);
+    ++time.frame;
+}
+
+void Scene::SetMaxSubsteps(unsigned int maxSubsteps) {
+    this->maxSubsteps = std::max(maxSubsteps, 1u);
+}
+
+VkBuffer Scene::GetTimeBuffer(uint32_t frame) const {
+    return timeBuffers[frame];
+}
 
-    memcpy(mappedData, &time, sizeof(Time));
+void Scene::UploadTime(uint32_t frame) {
+    memcpy(mappedData[frame], &time, sizeof(Time));
 }
 
-VkBuffer Scene::GetTimeBuffer() const {
-    return timeBuffer;
+const Time& Scene::GetTime() const {
+    return time;
 }
 
 Scene::~Scene() {
-    vkUnmapMemory(device->GetVkDevice(), timeBufferMemory);
-    vkDestroyBuffer(device->GetVkDevice(), timeBuffer, nullptr);
-    vkFreeMemory(device->GetVkDevice(), timeBufferMemory, nullptr);
+    for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        vkDestroyBuffer(device->GetVkDevice(), timeBuffers[frame], nullptr);
+        device->GetAllocator()->Free(timeBufferMemories[frame]);
+    }
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <array>
 #include <chrono>
 
 #include "Model.h"
@@ -8,24 +9,53 @@
 
 using namespace std::chrono;
 
+// The blades are integrated in steps of FIXED_TIME_STEP seconds, at most maxSubsteps per frame
+constexpr static float FIXED_TIME_STEP = 1.0f / 60.0f;
+constexpr static unsigned int DEFAULT_MAX_SUBSTEPS = 4;
+
+// Layout matches the Time uniform in shaders/blades.glsl
 struct Time {
+    // Length of one substep
     float deltaTime = 0.0f;
+    // Simulated time at the end of the last substep of the frame
     float totalTime = 0.0f;
+    // Number of substeps to run this frame, may be 0
+    uint32_t substeps = 1;
+    // How far the frame is between the last two simulated states, used to interpolate them
+    float alpha = 1.0f;
+    // Frames since the start, the cull pass revalidates the visible set of a few tiles each frame
+    uint32_t frame = 0;
+
+    // Time of one substep as a single step ending at its own total time
+    Time GetSubstep(uint32_t substep) const {
+        Time substepTime;
+        substepTime.deltaTime = deltaTime;
+        substepTime.totalTime = totalTime - static_cast<float>(substeps - 1 - substep) * deltaTime;
+        substepTime.substeps = 1;
+        substepTime.alpha = 1.0f;
+        substepTime.frame = frame;
+        return substepTime;
+    }
 };
 
 class Scene {
 private:
     Device* device;
     
-    VkBuffer timeBuffer;
-    VkDeviceMemory timeBufferMemory;
+    // One uniform copy per frame in flight, written by UploadTime
+    std::array<VkBuffer, MAX_FRAMES_IN_FLIGHT> timeBuffers;
+    std::array<MemoryAllocation, MAX_FRAMES_IN_FLIGHT> timeBufferMemories;
     Time time;
     
-    void* mappedData;
+    std::array<void*, MAX_FRAMES_IN_FLIGHT> mappedData;
 
     std::vector<Model*> models;
     std::vector<Blades*> blades;
 
+    // Frame time not simulated yet, always less than one step after UpdateTime
+    float accumulator = 0.0f;
+    unsigned int maxSubsteps = DEFAULT_MAX_SUBSTEPS;
+
 high_resolution_clock::time_point startTime = high_resolution_clock::now();
 
 public:
@@ -39,7 +69,15 @@ public:
     void AddModel(Model* model);
     void AddBlades(Blades* blades);
 
-    VkBuffer GetTimeBuffer() const;
+    VkBuffer GetTimeBuffer(uint32_t frame) const;
+    const Time& GetTime() const;
+    // Copy the time to the uniform copy of the frame, which the GPU must be done with
+    void UploadTime(uint32_t frame);
+
+    // Frames that would need more substeps drop the extra time, so a hitch slows the grass down
+    // instead of making it take one huge step
+    void SetMaxSubsteps(unsigned int maxSubsteps);
 
+    // Advance the accumulator by the frame time and work out this frame's substeps
     void UpdateTime();
 };
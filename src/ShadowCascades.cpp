@@ -0,0 +1,93 @@
+#include <cmath>
+#include <cstring>
+
+#define GLM_FORCE_RADIANS
+// Use Vulkan depth range of 0.0 to 1.0 instead of OpenGL
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "ShadowCascades.h"
+#include "BufferUtils.h"
+
+namespace {
+    // Late afternoon sun, low enough for the blades to cast long shadows
+    const glm::vec3 LIGHT_DIRECTION = glm::normalize(glm::vec3(0.5f, -0.6f, 0.3f));
+}
+
+ShadowCascades::ShadowCascades(Device* device, const CameraBufferObject& camera, const glm::vec3& target) : device(device) {
+    for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        // Read by the cull pass on the compute queue and by the shadow and grass draws on the graphics queue
+        BufferUtils::CreateBuffer(device, sizeof(ShadowBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffers[frame], bufferMemories[frame], true);
+        mappedData[frame] = bufferMemories[frame].mappedData;
+
+        for (uint32_t cascade = 0; cascade < NUM_SHADOW_CASCADES; ++cascade) {
+            BufferUtils::CreateBuffer(device, sizeof(CameraBufferObject), VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, cameraBuffers[frame][cascade], cameraBufferMemories[frame][cascade], true);
+            cameraMappedData[frame][cascade] = cameraBufferMemories[frame][cascade].mappedData;
+        }
+
+        Update(camera, target, frame);
+    }
+}
+
+CameraBufferObject ShadowCascades::CreateCascadeCamera(const glm::vec3& lightDirection, const glm::vec3& center, float radius) {
+    // Far enough back for every blade of the cascade to be in front of the near plane, even under a low light
+    const float distance = 2.0f * radius + MAX_HEIGHT;
+    const float texelSize = 2.0f * radius / SHADOW_MAP_DIM;
+
+    // Light space looks down -z along the light, snap the center there
+    glm::mat4 rotation = glm::lookAt(glm::vec3(0.0f), lightDirection, glm::vec3(0.0f, 1.0f, 0.0f));
+    glm::vec3 lightCenter = glm::vec3(rotation * glm::vec4(center, 1.0f));
+    lightCenter.x = std::floor(lightCenter.x / texelSize) * texelSize;
+    lightCenter.y = std::floor(lightCenter.y / texelSize) * texelSize;
+
+    CameraBufferObject bufferObject;
+    bufferObject.viewMatrix = glm::translate(glm::mat4(1.0f), -lightCenter - glm::vec3(0.0f, 0.0f, distance)) * rotation;
+    bufferObject.projectionMatrix = glm::ortho(-radius, radius, -radius, radius, 0.0f, 2.0f * distance);
+    bufferObject.viewport = glm::vec4(SHADOW_MAP_DIM, SHADOW_MAP_DIM, 1.0f / SHADOW_MAP_DIM, 1.0f / SHADOW_MAP_DIM);
+    Camera::UpdateDerived(bufferObject);
+    return bufferObject;
+}
+
+void ShadowCascades::Update(const CameraBufferObject& camera, const glm::vec3& target, uint32_t frame) {
+    for (uint32_t cascade = 0; cascade < NUM_SHADOW_CASCADES; ++cascade) {
+        // The last cascade has to hold every blade the camera can see, the others where the camera looks
+        glm::vec3 center = cascade + 1 == NUM_SHADOW_CASCADES ? glm::vec3(camera.position.x, 0.0f, camera.position.z) : target;
+        float radius = SHADOW_CASCADE_RADII[cascade];
+        cascadeCameras[cascade] = CreateCascadeCamera(LIGHT_DIRECTION, center, radius);
+
+        shadowBufferObject.viewProjectionMatrices[cascade] = cascadeCameras[cascade].viewProjectionMatrix;
+        for (int plane = 0; plane < 6; ++plane) {
+            shadowBufferObject.frustumPlanes[cascade][plane] = cascadeCameras[cascade].frustumPlanes[plane];
+        }
+        shadowBufferObject.extents[cascade] = glm::vec4(radius, 0.5f * SHADOW_MAP_DIM / radius, 0.0f, 0.0f);
+
+        memcpy(cameraMappedData[frame][cascade], &cascadeCameras[cascade], sizeof(CameraBufferObject));
+    }
+    shadowBufferObject.lightDirection = glm::vec4(LIGHT_DIRECTION, 0.0f);
+
+    memcpy(mappedData[frame], &shadowBufferObject, sizeof(ShadowBufferObject));
+}
+
+VkBuffer ShadowCascades::GetBuffer(uint32_t frame) const {
+    return buffers[frame];
+}
+
+VkBuffer ShadowCascades::GetCameraBuffer(uint32_t frame, uint32_t cascade) const {
+    return cameraBuffers[frame][cascade];
+}
+
+const ShadowBufferObject& ShadowCascades::GetBufferObject() const {
+    return shadowBufferObject;
+}
+
+ShadowCascades::~ShadowCascades() {
+    for (uint32_t frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        vkDestroyBuffer(device->GetVkDevice(), buffers[frame], nullptr);
+        device->GetAllocator()->Free(bufferMemories[frame]);
+
+        for (uint32_t cascade = 0; cascade < NUM_SHADOW_CASCADES; ++cascade) {
+            vkDestroyBuffer(device->GetVkDevice(), cameraBuffers[frame][cascade], nullptr);
+            device->GetAllocator()->Free(cameraBufferMemories[frame][cascade]);
+        }
+    }
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <array>
+#include <glm/glm.hpp>
+#include "Device.h"
+#include "Camera.h"
+#include "Blades.h"
+
+// Side of the layer of each cascade in the shadow map, in texels
+constexpr static unsigned int SHADOW_MAP_DIM = 2048;
+// Half the side of the square each cascade covers on the ground. The first one is around the camera target,
+// the last one around the camera and covers every blade left by CULLING_DISTANCE in shaders/blades.glsl
+constexpr static float SHADOW_CASCADE_RADII[NUM_SHADOW_CASCADES] = { 8.0f, 30.0f + MAX_HEIGHT };
+
+// What the cull pass and the fragment shaders know about the cascades.
+// Layout matches the ShadowCascades uniform in shaders/shadow.glsl
+struct ShadowBufferObject {
+    glm::mat4 viewProjectionMatrices[NUM_SHADOW_CASCADES];
+    // Frustum planes of each cascade, as in CameraBufferObject
+    glm::vec4 frustumPlanes[NUM_SHADOW_CASCADES][6];
+    // Half extent of each cascade in world units, then the texels of its layer per world unit
+    glm::vec4 extents[NUM_SHADOW_CASCADES];
+    // Direction the light travels in, w = 0
+    glm::vec4 lightDirection;
+};
+
+// Orthographic views of a fixed directional light, refitted around the camera every frame
+class ShadowCascades {
+private:
+    Device* device;
+
+    ShadowBufferObject shadowBufferObject;
+    // Each cascade seen as a camera, so that the shadow pass draws with the grass shaders
+    std::array<CameraBufferObject, NUM_SHADOW_CASCADES> cascadeCameras;
+
+    // One uniform copy of each per frame in flight
+    std::array<VkBuffer, MAX_FRAMES_IN_FLIGHT> buffers;
+    std::array<MemoryAllocation, MAX_FRAMES_IN_FLIGHT> bufferMemories;
+    std::array<void*, MAX_FRAMES_IN_FLIGHT> mappedData;
+
+    std::array<std::array<VkBuffer, NUM_SHADOW_CASCADES>, MAX_FRAMES_IN_FLIGHT> cameraBuffers;
+    std::array<std::array<MemoryAllocation, NUM_SHADOW_CASCADES>, MAX_FRAMES_IN_FLIGHT> cameraBufferMemories;
+    std::array<std::array<void*, NUM_SHADOW_CASCADES>, MAX_FRAMES_IN_FLIGHT> cameraMappedData;
+
+public:
+    ShadowCascades(Device* device, const CameraBufferObject& camera, const glm::vec3& target);
+    ~ShadowCascades();
+
+    // Camera looking at center from the light, covering radius around it. The center is snapped to the texels
+    // of the layer so that the shadows do not shimmer as the camera moves
+    static CameraBufferObject CreateCascadeCamera(const glm::vec3& lightDirection, const glm::vec3& center, float radius);
+
+    // Refit the cascades to the camera and the point it orbits, and upload them to the copies of the frame,
+    // which the GPU must be done with
+    void Update(const CameraBufferObject& camera, const glm::vec3& target, uint32_t frame);
+
+    // ShadowBufferObject of every cascade
+    VkBuffer GetBuffer(uint32_t frame) const;
+    // CameraBufferObject of a single cascade
+    VkBuffer GetCameraBuffer(uint32_t frame, uint32_t cascade) const;
+    const ShadowBufferObject& GetBufferObject() const;
+};
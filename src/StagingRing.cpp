@@ -0,0 +1,240 @@
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include "StagingRing.h"
+#include "BufferUtils.h"
+#include "Device.h"
+#include "Instance.h"
+
+namespace {
+    // Largest piece staged at once, small enough for a piece to always fit once the ring is drained
+    constexpr VkDeviceSize MAX_STAGED_SIZE = STAGING_RING_SIZE / 4;
+
+    VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+        return (value + alignment - 1) / alignment * alignment;
+    }
+}
+
+StagingRing::StagingRing(Device* device)
+  : device(device), submittedBatches(0), retiredBatches(0), recording(false), pendingSemaphore(VK_NULL_HANDLE), head(0), tail(0) {
+    VkPhysicalDeviceProperties deviceProperties;
+    vkGetPhysicalDeviceProperties(device->GetInstance()->GetPhysicalDevice(), &deviceProperties);
+    copyAlignment = std::max<VkDeviceSize>(deviceProperties.limits.optimalBufferCopyOffsetAlignment, 16);
+
+    VkCommandPoolCreateInfo poolInfo = {};
+    poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+    poolInfo.queueFamilyIndex = device->GetInstance()->GetQueueFamilyIndices()[QueueFlags::Transfer];
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+
+    if (vkCreateCommandPool(device->GetVkDevice(), &poolInfo, nullptr, &commandPool) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to create staging command pool");
+    }
+
+    // Only the transfer queue reads the ring
+    BufferUtils::CreateBuffer(device, STAGING_RING_SIZE, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, buffer, bufferMemory);
+
+    VkCommandBufferAllocateInfo allocInfo = {};
+    allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+    allocInfo.commandPool = commandPool;
+    allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    allocInfo.commandBufferCount = 1;
+
+    VkFenceCreateInfo fenceInfo = {};
+    fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+    VkSemaphoreCreateInfo semaphoreInfo = {};
+    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+    for (Batch& batch : batches) {
+        if (vkAllocateCommandBuffers(device->GetVkDevice(), &allocInfo, &batch.commandBuffer) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to allocate staging command buffer");
+        }
+        if (vkCreateFence(device->GetVkDevice(), &fenceInfo, nullptr, &batch.fence) != VK_SUCCESS ||
+            vkCreateSemaphore(device->GetVkDevice(), &semaphoreInfo, nullptr, &batch.semaphore) != VK_SUCCESS) {
+            throw std::runtime_error("Failed to create staging synchronization objects");
+        }
+        batch.end = 0;
+    }
+}
+
+VkCommandBuffer StagingRing::getCommandBuffer() {
+    Batch& batch = batches[submittedBatches % NUM_STAGING_BATCHES];
+    if (recording) {
+        return batch.commandBuffer;
+    }
+
+    // The batch last ran NUM_STAGING_BATCHES batches ago, it is done once every batch is in flight
+    if (submittedBatches - retiredBatches == NUM_STAGING_BATCHES) {
+        retireBatch();
+    }
+
+    VkCommandBufferBeginInfo beginInfo = {};
+    beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+    if (vkBeginCommandBuffer(batch.commandBuffer, &beginInfo) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to begin recording staging command buffer");
+    }
+    recording = true;
+    return batch.commandBuffer;
+}
+
+bool StagingRing::retireBatch() {
+    if (retiredBatches == submittedBatches) {
+        return false;
+    }
+
+    const Batch& batch = batches[retiredBatches % NUM_STAGING_BATCHES];
+    vkWaitForFences(device->GetVkDevice(), 1, &batch.fence, VK_TRUE, std::numeric_limits<uint64_t>::max());
+    tail = batch.end;
+    ++retiredBatches;
+    return true;
+}
+
+VkDeviceSize StagingRing::stage(VkDeviceSize size) {
+    while (true) {
+        // A piece does not wrap around the end of the buffer, it starts over at the beginning instead
+        VkDeviceSize position = alignUp(head, copyAlignment);
+        if (position % STAGING_RING_SIZE + size > STAGING_RING_SIZE) {
+            position = alignUp(position, STAGING_RING_SIZE);
+        }
+        if (position + size - tail <= STAGING_RING_SIZE) {
+            head = position + size;
+            return position % STAGING_RING_SIZE;
+        }
+
+        // Free the bytes of the oldest batch, or of the batch being recorded when it holds the whole ring
+        if (!retireBatch()) {
+            Flush();
+        }
+    }
+}
+
+void StagingRing::UploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size) {
+    const char* bytes = static_cast<const char*>(data);
+    for (VkDeviceSize copied = 0; copied < size;) {
+        const VkDeviceSize pieceSize = std::min(size - copied, MAX_STAGED_SIZE);
+        const VkDeviceSize offset = stage(pieceSize);
+        memcpy(static_cast<char*>(bufferMemory.mappedData) + offset, bytes + copied, static_cast<size_t>(pieceSize));
+
+        VkBufferCopy copyRegion = {};
+        copyRegion.srcOffset = offset;
+        copyRegion.dstOffset = dstOffset + copied;
+        copyRegion.size = pieceSize;
+        vkCmdCopyBuffer(getCommandBuffer(), buffer, dstBuffer, 1, &copyRegion);
+
+        copied += pieceSize;
+    }
+}
+
+void StagingRing::UploadImage(VkImage image, uint32_t width, uint32_t height, uint32_t texelSize, const void* data, VkImageLayout layout) {
+    const VkDeviceSize rowSize = static_cast<VkDeviceSize>(width) * texelSize;
+    if (rowSize > MAX_STAGED_SIZE) {
+        throw std::runtime_error("Image rows are too large for the staging ring");
+    }
+    const uint32_t rowsPerPiece = static_cast<uint32_t>(MAX_STAGED_SIZE / rowSize);
+
+    VkImageMemoryBarrier barrier = {};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = image;
+    barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    barrier.subresourceRange.baseMipLevel = 0;
+    barrier.subresourceRange.levelCount = 1;
+    barrier.subresourceRange.baseArrayLayer = 0;
+    barrier.subresourceRange.layerCount = 1;
+    barrier.srcAccessMask = 0;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    vkCmdPipelineBarrier(getCommandBuffer(), VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    // Whole rows at a time, a layout transition stays valid for the batches after the one recording it
+    const char* bytes = static_cast<const char*>(data);
+    for (uint32_t row = 0; row < height;) {
+        const uint32_t rows = std::min(height - row, rowsPerPiece);
+        const VkDeviceSize offset = stage(rows * rowSize);
+        memcpy(static_cast<char*>(bufferMemory.mappedData) + offset, bytes + row * rowSize, static_cast<size_t>(rows * rowSize));
+
+        VkBufferImageCopy region = {};
+        region.bufferOffset = offset;
+        region.bufferRowLength = 0;
+        region.bufferImageHeight = 0;
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageOffset = { 0, static_cast<int32_t>(row), 0 };
+        region.imageExtent = { width, rows, 1 };
+        vkCmdCopyBufferToImage(getCommandBuffer(), buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+        row += rows;
+    }
+
+    // The transfer queue may not support the stages that read the image, the semaphore of the batch orders them
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = layout;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = 0;
+    vkCmdPipelineBarrier(getCommandBuffer(), VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void StagingRing::Flush() {
+    if (!recording) {
+        return;
+    }
+
+    Batch& batch = batches[submittedBatches % NUM_STAGING_BATCHES];
+    if (vkEndCommandBuffer(batch.commandBuffer) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to record staging command buffer");
+    }
+
+    // A semaphore that nobody took is waited for here, so that it can be signaled again
+    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    VkSubmitInfo submitInfo = {};
+    submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submitInfo.waitSemaphoreCount = pendingSemaphore != VK_NULL_HANDLE ? 1 : 0;
+    submitInfo.pWaitSemaphores = &pendingSemaphore;
+    submitInfo.pWaitDstStageMask = &waitStage;
+    submitInfo.commandBufferCount = 1;
+    submitInfo.pCommandBuffers = &batch.commandBuffer;
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &batch.semaphore;
+
+    vkResetFences(device->GetVkDevice(), 1, &batch.fence);
+    if (vkQueueSubmit(device->GetQueue(QueueFlags::Transfer), 1, &submitInfo, batch.fence) != VK_SUCCESS) {
+        throw std::runtime_error("Failed to submit staging command buffer");
+    }
+
+    batch.end = head;
+    pendingSemaphore = batch.semaphore;
+    ++submittedBatches;
+    recording = false;
+}
+
+VkSemaphore StagingRing::TakeSemaphore() {
+    VkSemaphore semaphore = pendingSemaphore;
+    pendingSemaphore = VK_NULL_HANDLE;
+    return semaphore;
+}
+
+void StagingRing::Wait() {
+    Flush();
+    while (retireBatch()) {
+    }
+}
+
+StagingRing::~StagingRing() {
+    Wait();
+
+    for (Batch& batch : batches) {
+        vkDestroyFence(device->GetVkDevice(), batch.fence, nullptr);
+        vkDestroySemaphore(device->GetVkDevice(), batch.semaphore, nullptr);
+    }
+    vkDestroyCommandPool(device->GetVkDevice(), commandPool, nullptr);
+
+    vkDestroyBuffer(device->GetVkDevice(), buffer, nullptr);
+    device->GetAllocator()->Free(bufferMemory);
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <array>
+#include <vulkan/vulkan.h>
+#include "MemoryAllocator.h"
+
+class Device;
+
+// Size of the persistently mapped buffer uploads are staged in. Larger uploads are staged a piece at a time
+constexpr static VkDeviceSize STAGING_RING_SIZE = 16 * 1024 * 1024;
+// Batches of uploads that can be recorded or in flight on the transfer queue at once
+constexpr static unsigned int NUM_STAGING_BATCHES = 4;
+
+// Uploads buffers and images through one staging buffer used as a ring. Copies are recorded into a batch that
+// Flush submits to the transfer queue without waiting for it, and the staged bytes of a batch are reused once
+// its fence signals. Recording only blocks when the ring is full.
+// Buffers and images uploaded here must be shared with the families of the queues that use them
+class StagingRing {
+private:
+    struct Batch {
+        VkCommandBuffer commandBuffer;
+        VkFence fence;
+        // Signaled by the batch, and waited for by whoever uses its uploads first
+        VkSemaphore semaphore;
+        // Ring position past the last byte the batch staged
+        VkDeviceSize end;
+    };
+
+    Device* device;
+    VkCommandPool commandPool;
+    VkBuffer buffer;
+    MemoryAllocation bufferMemory;
+    VkDeviceSize copyAlignment;
+
+    std::array<Batch, NUM_STAGING_BATCHES> batches;
+    // Batches count from 0, batch n uses batches[n % NUM_STAGING_BATCHES]. Batches from retiredBatches to
+    // submittedBatches may still be running, batch submittedBatches is the one recorded when recording is set
+    uint64_t submittedBatches;
+    uint64_t retiredBatches;
+    bool recording;
+    // Semaphore of the last submitted batch until it is taken, the next batch waits for it otherwise
+    VkSemaphore pendingSemaphore;
+
+    // Positions only grow, the offset in the buffer is the position modulo STAGING_RING_SIZE.
+    // Bytes from tail to head are staged by batches that may not be done yet
+    VkDeviceSize head;
+    VkDeviceSize tail;
+
+    // Command buffer of the batch being recorded, begun if it was not
+    VkCommandBuffer getCommandBuffer();
+    // Wait for the oldest submitted batch and free what it staged. Returns false when no batch is in flight
+    bool retireBatch();
+    // Offset in the buffer of size contiguous bytes, submitting and waiting for batches when the ring is full
+    VkDeviceSize stage(VkDeviceSize size);
+
+public:
+    StagingRing(Device* device);
+    ~StagingRing();
+
+    void UploadBuffer(VkBuffer dstBuffer, VkDeviceSize dstOffset, const void* data, VkDeviceSize size);
+    // Upload every texel of a color image in undefined layout, which is left in layout
+    void UploadImage(VkImage image, uint32_t width, uint32_t height, uint32_t texelSize, const void* data, VkImageLayout layout);
+
+    // Submit the uploads recorded since the last flush, if any
+    void Flush();
+    // Semaphore to wait for before using the uploads flushed so far, or null when there are none.
+    // It must be waited for exactly once
+    VkSemaphore TakeSemaphore();
+    // Flush, and block until every upload is done
+    void Wait();
+};
@@ -72,20 +72,27 @@ namespace {
 
       return actualExtent;
   }
+
+  VkSemaphore createSemaphore(VkDevice device) {
+      VkSemaphoreCreateInfo semaphoreInfo = {};
+      semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+
+      VkSemaphore semaphore;
+      if (vkCreateSemaphore(device, &semaphoreInfo, nullptr, &semaphore) != VK_SUCCESS) {
+          throw std::runtime_error("Failed to create semaphores");
+      }
+      return semaphore;
+  }
 }
 
 SwapChain::SwapChain(Device* device, VkSurfaceKHR vkSurface, unsigned int numBuffers)
   : device(device), vkSurface(vkSurface), numBuffers(numBuffers) {
     
-    Create();
-
-    VkSemaphoreCreateInfo semaphoreInfo = {};
-    semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-
-    if (vkCreateSemaphore(device->GetVkDevice(), &semaphoreInfo, nullptr, &imageAvailableSemaphore) != VK_SUCCESS ||
-        vkCreateSemaphore(device->GetVkDevice(), &semaphoreInfo, nullptr, &renderFinishedSemaphore) != VK_SUCCESS) {
-        throw std::runtime_error("Failed to create semaphores");
+    for (unsigned int frame = 0; frame < MAX_FRAMES_IN_FLIGHT; ++frame) {
+        imageAvailableSemaphores.push_back(createSemaphore(device->GetVkDevice()));
     }
+
+    Create();
 }
 
 void SwapChain::Create(VkSwapchainKHR oldSwapChain) {
@@ -187,6 +194,11 @@ void SwapChain::Create(VkSwapchainKHR oldSwapChain) {
     vkSwapChainImages.resize(imageCount);
     vkGetSwapchainImagesKHR(device->GetVkDevice(), vkSwapChain, &imageCount, vkSwapChainImages.data());
 
+    // The swap chain may come back with more images than before
+    while (renderFinishedSemaphores.size() < imageCount) {
+        renderFinishedSemaphores.push_back(createSemaphore(device->GetVkDevice()));
+    }
+
     vkSwapChainImageFormat = surfaceFormat.format;
     vkSwapChainExtent = extent;
     
@@ -227,13 +239,12 @@ VkImage SwapChain::GetVkImage(uint32_t index) const {
     return vkSwapChainImages[index];
 }
 
-VkSemaphore SwapChain::GetImageAvailableVkSemaphore() const {
-    return imageAvailableSemaphore;
-
+VkSemaphore SwapChain::GetImageAvailableVkSemaphore(uint32_t frame) const {
+    return imageAvailableSemaphores[frame];
 }
 
 VkSemaphore SwapChain::GetRenderFinishedVkSemaphore() const {
-    return renderFinishedSemaphore;
+    return renderFinishedSemaphores[imageIndex];
 }
 
 void SwapChain::Recreate() {
@@ -243,18 +254,13 @@ void SwapChain::Recreate() {
     Create(oldSwapChain);  // Create will update vkSwapChain and destroy oldSwapChain if successful
 }
 
-bool SwapChain::Acquire() {
-    if (ENABLE_VALIDATION) {
-        // the validation layer implementation expects the application to explicitly synchronize with the GPU
-        vkQueueWaitIdle(device->GetQueue(QueueFlags::Present));
-    }
-    
+bool SwapChain::Acquire(uint32_t frame) {
     // Ensure swap chain is valid
     if (vkSwapChain == VK_NULL_HANDLE) {
         return false;
     }
     
-    VkResult result = vkAcquireNextImageKHR(device->GetVkDevice(), vkSwapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphore, VK_NULL_HANDLE, &imageIndex);
+    VkResult result = vkAcquireNextImageKHR(device->GetVkDevice(), vkSwapChain, std::numeric_limits<uint64_t>::max(), imageAvailableSemaphores[frame], VK_NULL_HANDLE, &imageIndex);
     
     if (result == VK_ERROR_OUT_OF_DATE_KHR) {
         // Wait for all operations to complete before recreating
@@ -276,7 +282,7 @@ bool SwapChain::Present() {
         return false;
     }
     
-    VkSemaphore signalSemaphores[] = { renderFinishedSemaphore };
+    VkSemaphore signalSemaphores[] = { renderFinishedSemaphores[imageIndex] };
 
     // Submit result back to swap chain for presentation
     VkPresentInfoKHR presentInfo = {};
@@ -307,7 +313,11 @@ bool SwapChain::Present() {
 }
 
 SwapChain::~SwapChain() {
-    vkDestroySemaphore(device->GetVkDevice(), imageAvailableSemaphore, nullptr);
-    vkDestroySemaphore(device->GetVkDevice(), renderFinishedSemaphore, nullptr);
+    for (VkSemaphore semaphore : imageAvailableSemaphores) {
+        vkDestroySemaphore(device->GetVkDevice(), semaphore, nullptr);
+    }
+    for (VkSemaphore semaphore : renderFinishedSemaphores) {
+        vkDestroySemaphore(device->GetVkDevice(), semaphore, nullptr);
+    }
     Destroy();
 }
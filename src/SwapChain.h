@@ -14,11 +14,14 @@ public:
     uint32_t GetIndex() const;
     uint32_t GetCount() const;
     VkImage GetVkImage(uint32_t index) const;
-    VkSemaphore GetImageAvailableVkSemaphore() const;
+    // Signaled once the image acquired by the frame in flight can be drawn to
+    VkSemaphore GetImageAvailableVkSemaphore(uint32_t frame) const;
+    // Waited on by the presentation of the acquired image
     VkSemaphore GetRenderFinishedVkSemaphore() const;
     
     void Recreate();
-    bool Acquire();
+    // Acquire the next image for the frame in flight, whose previous submission must be complete
+    bool Acquire(uint32_t frame);
     bool Present();
     ~SwapChain();
 
@@ -36,6 +39,8 @@ private:
     VkExtent2D vkSwapChainExtent;
     uint32_t imageIndex = 0;
 
-    VkSemaphore imageAvailableSemaphore;
-    VkSemaphore renderFinishedSemaphore;
+    // One per frame in flight. The present semaphores are one per image instead, as there is no way to know
+    // when a presentation is done waiting other than the image being acquired again
+    std::vector<VkSemaphore> imageAvailableSemaphores;
+    std::vector<VkSemaphore> renderFinishedSemaphores;
 };
@@ -0,0 +1,117 @@
+#include <algorithm>
+#include <cstdint>
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned int numThreads) : remainingTasks(0) {
+    numThreads = std::max(numThreads, 1u);
+
+    for (unsigned int i = 0; i < numThreads; ++i) {
+        queues.emplace_back(new WorkQueue());
+    }
+
+    for (unsigned int i = 1; i < numThreads; ++i) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+    }
+}
+
+unsigned int ThreadPool::GetThreadCount() const {
+    return static_cast<unsigned int>(queues.size());
+}
+
+void ThreadPool::ParallelFor(unsigned int taskCount, const std::function<void(unsigned int)>& task) {
+    if (taskCount == 0) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        remainingTasks = taskCount;
+
+        // Hand out contiguous ranges so that neighbouring tasks start on the same thread
+        unsigned int numQueues = GetThreadCount();
+        for (unsigned int q = 0; q < numQueues; ++q) {
+            unsigned int begin = static_cast<unsigned int>(static_cast<uint64_t>(taskCount) * q / numQueues);
+            unsigned int end = static_cast<unsigned int>(static_cast<uint64_t>(taskCount) * (q + 1) / numQueues);
+
+            std::lock_guard<std::mutex> queueLock(queues[q]->mutex);
+            for (unsigned int i = begin; i < end; ++i) {
+                queues[q]->tasks.push_back({ &task, i });
+            }
+        }
+
+        generation++;
+    }
+    wakeCondition.notify_all();
+
+    runTasks(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCondition.wait(lock, [this]() { return remainingTasks == 0; });
+}
+
+bool ThreadPool::popOrSteal(unsigned int queueIndex, Task& task) {
+    // Own queue first, newest task at the back
+    {
+        WorkQueue& own = *queues[queueIndex];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = own.tasks.back();
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+
+    // Then steal the oldest task of another queue
+    unsigned int numQueues = GetThreadCount();
+    for (unsigned int offset = 1; offset < numQueues; ++offset) {
+        WorkQueue& victim = *queues[(queueIndex + offset) % numQueues];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = victim.tasks.front();
+            victim.tasks.pop_front();
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void ThreadPool::runTasks(unsigned int queueIndex) {
+    Task task;
+    while (popOrSteal(queueIndex, task)) {
+        (*task.function)(task.index);
+
+        if (--remainingTasks == 0) {
+            std::lock_guard<std::mutex> lock(mutex);
+            doneCondition.notify_all();
+        }
+    }
+}
+
+void ThreadPool::workerLoop(unsigned int queueIndex) {
+    unsigned int seenGeneration = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wakeCondition.wait(lock, [&]() { return quit || generation != seenGeneration; });
+            if (quit) {
+                return;
+            }
+            seenGeneration = generation;
+        }
+
+        runTasks(queueIndex);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        quit = true;
+    }
+    wakeCondition.notify_all();
+
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads with one task queue each. A thread pops work from
+// the back of its own queue and steals from the front of the others when it runs dry.
+class ThreadPool {
+public:
+    ThreadPool() = delete;
+    // numThreads counts the calling thread, which also runs tasks in ParallelFor
+    explicit ThreadPool(unsigned int numThreads);
+    ~ThreadPool();
+
+    unsigned int GetThreadCount() const;
+
+    // Run task(i) for every i in [0, taskCount) and return once all of them have finished
+    void ParallelFor(unsigned int taskCount, const std::function<void(unsigned int)>& task);
+
+private:
+    struct Task {
+        const std::function<void(unsigned int)>* function;
+        unsigned int index;
+    };
+
+    struct WorkQueue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    bool popOrSteal(unsigned int queueIndex, Task& task);
+    void runTasks(unsigned int queueIndex);
+    void workerLoop(unsigned int queueIndex);
+
+    std::vector<std::thread> workers;
+    // Queue 0 belongs to the thread calling ParallelFor
+    std::vector<std::unique_ptr<WorkQueue>> queues;
+
+    std::mutex mutex;
+    std::condition_variable wakeCondition;
+    std::condition_variable doneCondition;
+    unsigned int generation = 0;
+    bool quit = false;
+
+    std::atomic<unsigned int> remainingTasks;
+};
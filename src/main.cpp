@@ -2,12 +2,16 @@
 #include <chrono>
 #include <iomanip>
 #include <sstream>
+#include <cstring>
+#include <glm/gtc/matrix_transform.hpp>
 #include "Instance.h"
 #include "Window.h"
 #include "Renderer.h"
 #include "Camera.h"
 #include "Scene.h"
 #include "Image.h"
+#include "BladeKernel.h"
+#include "BladeSimulator.h"
 
 Device* device;
 SwapChain* swapChain;
@@ -20,8 +24,7 @@ namespace {
 
         vkDeviceWaitIdle(device->GetVkDevice());
         
-        float aspectRatio = static_cast<float>(width) / static_cast<float>(height);
-        camera->UpdateAspectRatio(aspectRatio);
+        camera->UpdateAspectRatio(static_cast<float>(width), static_cast<float>(height));
         
         // Check if window is actually valid before proceeding
         // Sometimes GLFW reports non-zero but surface capabilities return zero
@@ -94,9 +97,76 @@ namespace {
             previousY = yPosition;
         }
     }
+
+    // Walk the camera target over the endless field with WASD, faster while shift is held
+    void panCamera(float deltaTime) {
+        GLFWwindow* window = GetGLFWWindow();
+        float forward = 0.0f;
+        float right = 0.0f;
+        if (glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS) forward += 1.0f;
+        if (glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS) forward -= 1.0f;
+        if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS) right += 1.0f;
+        if (glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS) right -= 1.0f;
+        if (forward == 0.0f && right == 0.0f) {
+            return;
+        }
+
+        float speed = glfwGetKey(window, GLFW_KEY_LEFT_SHIFT) == GLFW_PRESS ? 20.0f : 5.0f;
+        camera->Pan(forward * speed * deltaTime, right * speed * deltaTime);
+    }
 }
 
-int main() {
+int main(int argc, char** argv) {
+    // --compare-cpu N: after N frames, report how far the compute shader drifted from BladeKernel
+    // --cpu-benchmark [--blades N] [--steps N] [--threads N]: time the CPU simulator without opening a window
+    // --max-substeps N: cap on the fixed-length simulation steps run in one frame
+    // --vertex-pulling: draw near blades without tessellation shaders, the default when tessellation is not supported
+    // --grass-benchmark N: time N frames with tessellated near blades, then N with vertex pulling, and exit
+    // --cull-benchmark N: time the cull passes of N frames reusing the visible set of the previous frame, then N without, and exit
+    unsigned int compareSteps = 0;
+    unsigned int maxSubsteps = DEFAULT_MAX_SUBSTEPS;
+    bool cpuBenchmark = false;
+    unsigned int benchmarkBlades = NUM_BLADES;
+    unsigned int benchmarkSteps = 100;
+    unsigned int benchmarkThreads = 0;
+    bool vertexPulling = false;
+    unsigned int grassBenchmarkFrames = 0;
+    unsigned int cullBenchmarkFrames = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--compare-cpu") == 0 && i + 1 < argc) {
+            compareSteps = static_cast<unsigned int>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--cpu-benchmark") == 0) {
+            cpuBenchmark = true;
+        } else if (strcmp(argv[i], "--blades") == 0 && i + 1 < argc) {
+            benchmarkBlades = static_cast<unsigned int>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--steps") == 0 && i + 1 < argc) {
+            benchmarkSteps = static_cast<unsigned int>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            benchmarkThreads = static_cast<unsigned int>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--max-substeps") == 0 && i + 1 < argc) {
+            maxSubsteps = static_cast<unsigned int>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--vertex-pulling") == 0) {
+            vertexPulling = true;
+        } else if (strcmp(argv[i], "--grass-benchmark") == 0 && i + 1 < argc) {
+            grassBenchmarkFrames = static_cast<unsigned int>(atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--cull-benchmark") == 0 && i + 1 < argc) {
+            cullBenchmarkFrames = static_cast<unsigned int>(atoi(argv[++i]));
+        }
+    }
+
+#if USE_DENSITY_SPAWNING
+    if (compareSteps > 0) {
+        printf("Spawned blades are not simulated, ignoring --compare-cpu\n");
+        compareSteps = 0;
+    }
+#endif
+
+    if (cpuBenchmark) {
+        std::vector<Blade> benchmarkBladeData = Blades::Generate(15.f, benchmarkBlades);
+        BladeSimulator::ReportScaling(benchmarkBladeData, benchmarkSteps, benchmarkThreads, Camera::CreateBufferObject(640.f, 480.f));
+        return 0;
+    }
+
     static constexpr char* applicationName = "Vulkan Grass Rendering";
     InitializeWindow(640, 480, applicationName);
 
@@ -110,18 +180,36 @@ int main() {
         throw std::runtime_error("Failed to create window surface");
     }
 
-    instance->PickPhysicalDevice({ VK_KHR_SWAPCHAIN_EXTENSION_NAME }, QueueFlagBit::GraphicsBit | QueueFlagBit::TransferBit | QueueFlagBit::ComputeBit | QueueFlagBit::PresentBit, surface);
+    // Without VK_KHR_draw_indirect_count empty LOD tiers are still drawn, with zero instances.
+    // Without VK_KHR_timeline_semaphore the queues are synchronized with binary semaphores and fences
+    const std::vector<const char*> optionalExtensions = { VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME, VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME };
+    QueueFlagBits requiredQueues = QueueFlagBit::GraphicsBit | QueueFlagBit::TransferBit | QueueFlagBit::ComputeBit | QueueFlagBit::PresentBit;
+    try {
+        instance->PickPhysicalDevice({ VK_KHR_SWAPCHAIN_EXTENSION_NAME }, requiredQueues, surface, optionalExtensions);
+    } catch (const std::exception&) {
+        // Without a compute queue the renderer falls back to simulating blades on the CPU
+        requiredQueues = QueueFlagBit::GraphicsBit | QueueFlagBit::TransferBit | QueueFlagBit::PresentBit;
+        instance->PickPhysicalDevice({ VK_KHR_SWAPCHAIN_EXTENSION_NAME }, requiredQueues, surface, optionalExtensions);
+    }
+
+    // Near blades are drawn by grass_pull.vert when tessellation is not available
+    VkPhysicalDeviceFeatures supportedFeatures;
+    vkGetPhysicalDeviceFeatures(instance->GetPhysicalDevice(), &supportedFeatures);
+    const bool tessellationSupported = supportedFeatures.tessellationShader == VK_TRUE;
+    if (!tessellationSupported) {
+        vertexPulling = true;
+    }
 
     VkPhysicalDeviceFeatures deviceFeatures = {};
-    deviceFeatures.tessellationShader = VK_TRUE;
+    deviceFeatures.tessellationShader = supportedFeatures.tessellationShader;
     deviceFeatures.fillModeNonSolid = VK_TRUE;
     deviceFeatures.samplerAnisotropy = VK_TRUE;
 
-    device = instance->CreateDevice(QueueFlagBit::GraphicsBit | QueueFlagBit::TransferBit | QueueFlagBit::ComputeBit | QueueFlagBit::PresentBit, deviceFeatures);
+    device = instance->CreateDevice(requiredQueues, deviceFeatures);
 
     swapChain = device->CreateSwapChain(surface, 5);
 
-    camera = new Camera(device, 640.f / 480.f);
+    camera = new Camera(device, 640.f, 480.f);
 
     VkCommandPoolCreateInfo transferPoolInfo = {};
     transferPoolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
@@ -134,9 +222,8 @@ int main() {
     }
 
     VkImage grassImage;
-    VkDeviceMemory grassImageMemory;
+    MemoryAllocation grassImageMemory;
     Image::FromFile(device,
-        transferCommandPool,
         "images/grass.jpg",
         VK_FORMAT_R8G8B8A8_UNORM,
         VK_IMAGE_TILING_OPTIMAL,
@@ -149,7 +236,7 @@ int main() {
 
     float planeDim = 15.f;
     float halfWidth = planeDim * 0.5f;
-    Model* plane = new Model(device, transferCommandPool,
+    Model* plane = new Model(device,
         {
             { { -halfWidth, 0.0f, halfWidth }, { 1.0f, 0.0f, 0.0f },{ 1.0f, 0.0f } },
             { { halfWidth, 0.0f, halfWidth }, { 0.0f, 1.0f, 0.0f },{ 0.0f, 0.0f } },
@@ -160,15 +247,30 @@ int main() {
     );
     plane->SetTexture(grassImage);
     
-    Blades* blades = new Blades(device, transferCommandPool, planeDim);
+    Blades* blades = new Blades(device, planeDim);
 
-    vkDestroyCommandPool(device->GetVkDevice(), transferCommandPool, nullptr);
+    // Reference copy stepped on the CPU alongside the compute shader
+    std::vector<Blade> referenceBlades;
+    unsigned int comparedSteps = 0;
+    if (compareSteps > 0) {
+        referenceBlades = blades->GetHostBlades();
+    }
 
     Scene* scene = new Scene(device);
+    scene->SetMaxSubsteps(maxSubsteps);
     scene->AddModel(plane);
     scene->AddBlades(blades);
 
-    renderer = new Renderer(device, swapChain, scene, camera);
+    // The benchmark starts with the tessellated path, when there is one
+    renderer = new Renderer(device, swapChain, scene, camera, grassBenchmarkFrames > 0 ? !tessellationSupported : vertexPulling);
+    if (compareSteps > 0) {
+        // The reference steps every tile in view, occluded or not
+        renderer->SetOcclusionTests(false);
+    }
+
+    MemoryStats memoryStats = device->GetAllocator()->GetStats();
+    std::cout << "Device memory: " << memoryStats.allocationCount << " buffers and images in " << memoryStats.blockCount << " blocks, "
+              << memoryStats.usedBytes / (1024 * 1024) << " of " << memoryStats.blockBytes / (1024 * 1024) << " MiB used" << std::endl;
 
     glfwSetWindowSizeCallback(GetGLFWWindow(), resizeCallback);
     glfwSetMouseButtonCallback(GetGLFWWindow(), mouseDownCallback);
@@ -181,6 +283,14 @@ int main() {
     const float updateInterval = 0.25f; // Update every 0.25 seconds for smoother display
     std::string currentTitle = "Vulkan Grass Rendering - FPS: 60.0 | Frametime: 16.67 ms";
 
+    // Frames of the grass benchmark rendered with the current path, the first few are not timed
+    // as they include creating the pipelines
+    const unsigned int grassBenchmarkWarmup = 30;
+    unsigned int grassBenchmarkFrame = 0;
+    float grassBenchmarkTime = 0.0f;
+    unsigned int cullBenchmarkFrame = 0;
+    float cullBenchmarkTime = 0.0f;
+
     while (!ShouldQuit()) {
         auto currentTime = std::chrono::high_resolution_clock::now();
         auto frameDuration = std::chrono::duration<float, std::milli>(currentTime - lastTime);
@@ -188,8 +298,77 @@ int main() {
         lastTime = currentTime;
 
         glfwPollEvents();
+        panCamera(frametimeMs * 0.001f);
         scene->UpdateTime();
         renderer->Frame();
+        // The ground stays under the ring of tiles, which Frame moved after the camera target
+        plane->SetModelMatrix(glm::translate(glm::mat4(1.0f), blades->GetRingCenter()));
+
+        if (comparedSteps < compareSteps) {
+            // Wait for the compute pass so both sides step with the same time values.
+            // Slots regenerated by panning the camera are not followed by the reference copy
+            renderer->WaitForFrame(renderer->GetSubmittedFrames());
+            // Only blades in tiles that pass tile_cull.comp are simulated on the GPU, for the camera or a shadow
+            // cascade. Occlusion tests are off while comparing.
+            // Tiles asleep on the GPU are still stepped here, set USE_SLEEPING to 0 for an exact comparison
+            const Time& time = scene->GetTime();
+            for (const BladeTile& tile : blades->GetHostTiles()) {
+                if (BladeKernel::IsTileSimulated(tile, camera->GetBufferObject(), renderer->GetShadowBufferObject())) {
+                    for (uint32_t substep = 0; substep < time.substeps; ++substep) {
+                        BladeKernel::Simulate(referenceBlades.data() + tile.firstBlade, tile.bladeCount, time.GetSubstep(substep));
+                    }
+                }
+            }
+
+            if (++comparedSteps == compareSteps) {
+                std::vector<Blade> gpuBlades;
+                blades->ReadBladesBuffer(transferCommandPool, gpuBlades);
+                BladeKernel::Divergence divergence = BladeKernel::Compare(referenceBlades.data(), gpuBlades.data(), referenceBlades.size());
+
+                printf("CPU/GPU divergence after %u steps:\n", compareSteps);
+                printf("  v1 max |dx| %g |dy| %g |dz| %g\n", divergence.v1.x, divergence.v1.y, divergence.v1.z);
+                printf("  v2 max |dx| %g |dy| %g |dz| %g\n", divergence.v2.x, divergence.v2.y, divergence.v2.z);
+                printf("  worst blade %zu (%g)\n", divergence.worstBlade, divergence.worstDifference);
+            }
+        }
+
+        if (grassBenchmarkFrames > 0) {
+            // frametimeMs is the time the previous frame took
+            if (grassBenchmarkFrame > grassBenchmarkWarmup) {
+                grassBenchmarkTime += frametimeMs;
+            }
+
+            if (++grassBenchmarkFrame > grassBenchmarkWarmup + grassBenchmarkFrames) {
+                printf("%s: %.3f ms per frame over %u frames\n", renderer->GetVertexPulling() ? "Vertex pulling" : "Tessellation",
+                    grassBenchmarkTime / grassBenchmarkFrames, grassBenchmarkFrames);
+                if (renderer->GetVertexPulling()) {
+                    break;
+                }
+
+                renderer->SetVertexPulling(true);
+                grassBenchmarkFrame = 0;
+                grassBenchmarkTime = 0.0f;
+            }
+        }
+
+        if (cullBenchmarkFrames > 0) {
+            // The cull time is read back MAX_FRAMES_IN_FLIGHT frames late, which the warmup covers
+            if (cullBenchmarkFrame > grassBenchmarkWarmup) {
+                cullBenchmarkTime += renderer->GetCullTime();
+            }
+
+            if (++cullBenchmarkFrame > grassBenchmarkWarmup + cullBenchmarkFrames) {
+                printf("Cull pass %s the visible set: %.3f ms per frame over %u frames\n", renderer->GetVisibleSetReuse() ? "reusing" : "without",
+                    cullBenchmarkTime / cullBenchmarkFrames, cullBenchmarkFrames);
+                if (!renderer->GetVisibleSetReuse()) {
+                    break;
+                }
+
+                renderer->SetVisibleSetReuse(false);
+                cullBenchmarkFrame = 0;
+                cullBenchmarkTime = 0.0f;
+            }
+        }
 
         // Update window title with FPS and frametime at regular intervals
         auto timeSinceUpdate = std::chrono::duration<float>(currentTime - frameTimeUpdate).count();
@@ -201,7 +380,10 @@ int main() {
             // Always build the complete title string
             std::stringstream title;
             title << "Vulkan Grass Rendering - FPS: " << std::fixed << std::setprecision(1) << fps 
-                  << " | Frametime: " << std::setprecision(2) << averageFrametime << " ms";
+                  << " | Frametime: " << std::setprecision(2) << averageFrametime << " ms"
+                  << " | Sleeping blades: " << renderer->GetSleepingBlades()
+                  << " | Reused visibility: " << std::setprecision(0) << renderer->GetReusedBladeShare() * 100.0f << "%"
+                  << " | Cull: " << std::setprecision(2) << renderer->GetCullTime() << " ms";
             currentTitle = title.str();
             glfwSetWindowTitle(GetGLFWWindow(), currentTitle.c_str());
             
@@ -214,8 +396,10 @@ int main() {
 
     vkDeviceWaitIdle(device->GetVkDevice());
 
+    vkDestroyCommandPool(device->GetVkDevice(), transferCommandPool, nullptr);
+
     vkDestroyImage(device->GetVkDevice(), grassImage, nullptr);
-    vkFreeMemory(device->GetVkDevice(), grassImageMemory, nullptr);
+    device->GetAllocator()->Free(grassImageMemory);
 
     delete scene;
     delete plane;
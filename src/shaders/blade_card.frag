@@ -0,0 +1,37 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "blade_lod.glsl"
+
+#define SAMPLE_SHADOW_MAP
+#include "shadow.glsl"
+
+// Shortest blade of a card, relative to the card height
+#define MIN_CARD_BLADE_HEIGHT 0.6
+
+layout(location = 0) in vec2 inUV;
+layout(location = 1) flat in float inSeed;
+layout(location = 2) in vec3 inWorldPos;
+
+layout(location = 0) out vec4 outColor;
+
+float hash(float n) {
+    return fract(sin(n) * 43758.5453);
+}
+
+// A clump of FAR_CLUMP_BLADES triangular blades side by side, cut out of the card
+void main() {
+    float x = inUV.x * float(FAR_CLUMP_BLADES);
+    float bladeHeight = mix(MIN_CARD_BLADE_HEIGHT, 1.0, hash(floor(x) + 17.0 * inSeed));
+    float halfWidth = 0.5 * (1.0 - inUV.y / bladeHeight);
+    if (abs(fract(x) - 0.5) > halfWidth) {
+        discard;
+    }
+
+    // Same colors as grass.frag
+    vec3 grassLightColor = vec3(251, 196, 171) / 255.0;
+    vec3 grassDarkColor = vec3(240, 128, 128) / 255.0;
+    float gradient = smoothstep(0.2, 0.8, inUV.y);
+    outColor = vec4(mix(grassDarkColor, grassLightColor, gradient) * shadowLight(inWorldPos), 1.0);
+}
@@ -0,0 +1,75 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "blade_packing.glsl"
+#include "blade_lod.glsl"
+
+// Far tier cards, one instance per blade kept for its clump. The card turns around the blade's up vector
+// to face the camera and spans from the root to the tip of the blade, so it still sways in the wind
+
+#include "camera.glsl"
+
+layout(set = 1, binding = 0) uniform ModelBufferObject {
+    mat4 model;
+};
+
+#if USE_PACKED_BLADES
+// Leading fields of BladeTile in blades.glsl, positions are stored relative to the tile bounds
+struct TileBounds {
+    vec4 boundsMin;
+    vec4 boundsMax;
+    uvec4 range;
+};
+
+layout(set = 2, binding = 0) readonly buffer Tiles {
+    TileBounds tiles[];
+} tiles;
+
+layout(location = 0) in uvec2 inPositionTile; // PackedBlade position and tileOrientationUp
+layout(location = 1) in uvec3 inControlPoints;
+layout(location = 2) in uint inShape;
+#else
+layout(location = 0) in vec4 inV0;
+layout(location = 1) in vec4 inV1;
+layout(location = 2) in vec4 inV2;
+layout(location = 3) in vec4 inUp;
+#endif
+
+layout(location = 0) out vec2 outUV;
+// Varies the silhouette from card to card
+layout(location = 1) flat out float outSeed;
+// Where blade_card.frag looks the shadow map up
+layout(location = 2) out vec3 outWorldPos;
+
+void main() {
+#if USE_PACKED_BLADES
+    TileBounds tile = tiles.tiles[unpackTileIndex(inPositionTile.y)];
+    vec3 v0 = unpackBladePosition(inPositionTile.x, tile.boundsMin.xyz, tile.boundsMax.xyz);
+    vec3 v1;
+    vec3 v2;
+    unpackControlPoints(inControlPoints, v0, v1, v2);
+    vec3 up = unpackUp(inPositionTile.y);
+#else
+    vec3 v0 = inV0.xyz;
+    vec3 v2 = inV2.xyz;
+    vec3 up = inUp.xyz;
+#endif
+    v0 = (model * vec4(v0, 1.0)).xyz;
+    v2 = (model * vec4(v2, 1.0)).xyz;
+    up = normalize(mat3(model) * up);
+
+    vec3 right = cross(up, camera.position.xyz - v0);
+    // Looking straight down the up vector any direction will do
+    right = dot(right, right) > 1e-6 ? normalize(right) : vec3(1.0, 0.0, 0.0);
+
+    // Two vertices at the root, then two at the tip
+    float u = float(gl_VertexIndex & 1);
+    float v = float(gl_VertexIndex >> 1);
+    vec3 p = mix(v0, v2, v) + (u - 0.5) * CARD_WIDTH * right;
+    gl_Position = camera.viewProj * vec4(p, 1.0);
+
+    outUV = vec2(u, v);
+    outSeed = fract(sin(dot(v0.xz, vec2(12.9898, 78.233))) * 43758.5453);
+    outWorldPos = p;
+}
@@ -0,0 +1,53 @@
+// LOD tiers of the blades, shared by the cull pass and the grass shaders of each tier.
+// Tiers are picked by the distance of the blade to the camera, mirrors NUM_LOD_TIERS in Blades.h
+#define NUM_LOD_TIERS 3u
+#define LOD_NEAR 0u // Tessellated blades, grass.vert/tesc/tese
+#define LOD_MID 1u  // Fixed strips, blade_strip.vert
+#define LOD_FAR 2u  // Cards standing for a clump of blades, blade_card.vert/frag
+
+// Distances at which blades switch to the mid and the far tier
+#define LOD_MID_DISTANCE 10.0f
+#define LOD_FAR_DISTANCE 20.0f
+
+// A mid tier strip is evaluated at STRIP_SEGMENTS + 1 heights, two vertices per height and one at the tip
+#define STRIP_SEGMENTS 3u
+#define STRIP_VERTICES (2u * STRIP_SEGMENTS + 1u)
+
+// Only one blade out of FAR_CLUMP_BLADES is kept in the far tier, its card is CARD_WIDTH wide
+// and shows FAR_CLUMP_BLADES blades side by side
+#define FAR_CLUMP_BLADES 4u
+#define CARD_WIDTH 0.6f
+#define CARD_VERTICES 4u
+
+// Without tessellation grass_pull.vert draws near blades as strips of PULL_SEGMENTS segments, joined into
+// a single strip by repeating the first and last vertex of every blade. Mirrors PULL_VERTICES_PER_BLADE in Renderer.cpp
+#define PULL_SEGMENTS 7u
+#define PULL_VERTICES_PER_BLADE (2u * PULL_SEGMENTS + 3u)
+
+// Sub-pixel rejection, scaled by resolution and field of view. Blades shorter than MIN_BLADE_HEIGHT_PIXELS
+// are dropped. Blades narrower than MIN_BLADE_PIXELS are kept with the probability of their width over it,
+// and the ones kept are drawn MIN_BLADE_PIXELS wide so that the grass still covers as much of the screen.
+// Mirrored in BladeKernel.cpp
+#define USE_SUBPIXEL_CULLING 1
+#define MIN_BLADE_PIXELS 3.0
+#define MIN_BLADE_HEIGHT_PIXELS 2.0
+
+// Width to draw a blade with, given the pixels a world space unit covers at its root
+float drawnBladeWidth(float width, float pixelsPerUnit) {
+#if USE_SUBPIXEL_CULLING
+    return max(width, MIN_BLADE_PIXELS / pixelsPerUnit);
+#else
+    return width;
+#endif
+}
+
+// Uniform value in [0, 1) that stays the same for a blade from frame to frame, so thinning does not flicker
+float bladeRandom(uint bladeIdx) {
+    uint x = bladeIdx;
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    return float(x >> 8) / 16777216.0;
+}
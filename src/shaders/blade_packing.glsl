@@ -0,0 +1,67 @@
+// Optional quantized blade layout, 24 bytes per blade instead of 64.
+// Shared by the compute passes and the grass shaders, mirrors PackedBlade in Blades.h
+#define USE_PACKED_BLADES 0
+
+// Ranges of the quantized attributes, the same as in Blades.h
+#define MIN_HEIGHT 1.3
+#define MAX_HEIGHT 2.5
+#define MIN_WIDTH 0.1
+#define MAX_WIDTH 0.14
+#define MIN_BEND 7.0
+#define MAX_BEND 13.0
+// v1 and v2 are stored relative to v0, within this distance on each axis
+#define CONTROL_POINT_RANGE (2.0 * MAX_HEIGHT)
+
+#define TWO_PI 6.28318530718
+
+struct PackedBlade {
+    uint position;          // v0 within the bounds of its tile, unorm 11/10/11 bits for x/y/z
+    uint tileOrientationUp; // Tile index (12 bits), orientation (unorm 10 bits), up (hemi-octahedral snorm 5/5 bits)
+    uint controlPoints[3];  // v1 - v0 and v2 - v0 over CONTROL_POINT_RANGE, snorm 16 bits each
+    uint shape;             // Height, width and stiffness between their MIN and MAX, unorm 11/10/11 bits
+};
+
+float unpackUnorm(uint value, uint bits) {
+    return float(value & ((1u << bits) - 1u)) / float((1u << bits) - 1u);
+}
+
+vec3 unpackBladePosition(uint position, vec3 boundsMin, vec3 boundsMax) {
+    vec3 t = vec3(unpackUnorm(position, 11u), unpackUnorm(position >> 11, 10u), unpackUnorm(position >> 21, 11u));
+    return mix(boundsMin, boundsMax, t);
+}
+
+uint unpackTileIndex(uint tileOrientationUp) {
+    return tileOrientationUp & 0xFFFu;
+}
+
+float unpackOrientation(uint tileOrientationUp) {
+    return unpackUnorm(tileOrientationUp >> 12, 10u) * TWO_PI;
+}
+
+vec3 unpackUp(uint tileOrientationUp) {
+    // Snorm 5 bits are stored as 0..30 with 15 for 0, so that straight up is exact
+    vec2 e = (vec2(float((tileOrientationUp >> 22) & 0x1Fu), float(tileOrientationUp >> 27)) - 15.0) / 15.0;
+    vec2 p = vec2(e.x + e.y, e.x - e.y) * 0.5;
+    return normalize(vec3(p.x, 1.0 - abs(p.x) - abs(p.y), p.y));
+}
+
+void unpackControlPoints(uvec3 controlPoints, vec3 v0, out vec3 v1, out vec3 v2) {
+    vec2 a = unpackSnorm2x16(controlPoints.x);
+    vec2 b = unpackSnorm2x16(controlPoints.y);
+    vec2 c = unpackSnorm2x16(controlPoints.z);
+    v1 = v0 + vec3(a.x, a.y, b.x) * CONTROL_POINT_RANGE;
+    v2 = v0 + vec3(b.y, c.x, c.y) * CONTROL_POINT_RANGE;
+}
+
+uvec3 packControlPoints(vec3 v0, vec3 v1, vec3 v2) {
+    vec3 d1 = (v1 - v0) / CONTROL_POINT_RANGE;
+    vec3 d2 = (v2 - v0) / CONTROL_POINT_RANGE;
+    return uvec3(packSnorm2x16(d1.xy), packSnorm2x16(vec2(d1.z, d2.x)), packSnorm2x16(d2.yz));
+}
+
+// Returns height, width and stiffness
+vec3 unpackShape(uint shape) {
+    return vec3(mix(MIN_HEIGHT, MAX_HEIGHT, unpackUnorm(shape, 11u)),
+                mix(MIN_WIDTH, MAX_WIDTH, unpackUnorm(shape >> 11, 10u)),
+                mix(MIN_BEND, MAX_BEND, unpackUnorm(shape >> 21, 11u)));
+}
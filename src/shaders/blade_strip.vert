@@ -0,0 +1,90 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "blade_packing.glsl"
+#include "blade_lod.glsl"
+
+// Mid tier blades, one instance per blade expanded into a strip of STRIP_VERTICES vertices.
+// Same curve as grass.tese, but at a fixed number of heights and without tessellation
+
+#include "camera.glsl"
+
+layout(set = 1, binding = 0) uniform ModelBufferObject {
+    mat4 model;
+};
+
+#if USE_PACKED_BLADES
+// Leading fields of BladeTile in blades.glsl, positions are stored relative to the tile bounds
+struct TileBounds {
+    vec4 boundsMin;
+    vec4 boundsMax;
+    uvec4 range;
+};
+
+layout(set = 2, binding = 0) readonly buffer Tiles {
+    TileBounds tiles[];
+} tiles;
+
+layout(location = 0) in uvec2 inPositionTile; // PackedBlade position and tileOrientationUp
+layout(location = 1) in uvec3 inControlPoints;
+layout(location = 2) in uint inShape;
+#else
+layout(location = 0) in vec4 inV0;
+layout(location = 1) in vec4 inV1;
+layout(location = 2) in vec4 inV2;
+layout(location = 3) in vec4 inUp;
+#endif
+
+layout(location = 0) out vec2 outUV;
+// grass.frag can show the tessellation level, a strip is drawn as if tessellated at its segment count
+layout(location = 1) out float outTessLevel;
+layout(location = 2) out float outMinTessLevel;
+layout(location = 3) out float outMaxTessLevel;
+// Where grass.frag looks the shadow map up
+layout(location = 4) out vec3 outWorldPos;
+
+void main() {
+#if USE_PACKED_BLADES
+    TileBounds tile = tiles.tiles[unpackTileIndex(inPositionTile.y)];
+    vec3 v0 = unpackBladePosition(inPositionTile.x, tile.boundsMin.xyz, tile.boundsMax.xyz);
+    vec3 v1;
+    vec3 v2;
+    unpackControlPoints(inControlPoints, v0, v1, v2);
+    float o = unpackOrientation(inPositionTile.y);
+    float w = unpackShape(inShape).y;
+#else
+    vec3 v0 = inV0.xyz;
+    vec3 v1 = inV1.xyz;
+    vec3 v2 = inV2.xyz;
+    float o = inV0.w;
+    float w = inV2.w;
+#endif
+    v0 = (model * vec4(v0, 1.0)).xyz;
+    v1 = (model * vec4(v1, 1.0)).xyz;
+    v2 = (model * vec4(v2, 1.0)).xyz;
+    // Blades kept by sub-pixel thinning stand in for the ones dropped around them
+    w = drawnBladeWidth(w, pixelsPerUnit(v0));
+
+    // Vertices alternate between the two edges of the blade, bottom to top, and end at the tip
+    float u = float(gl_VertexIndex & 1);
+    float v = float(gl_VertexIndex / 2) / float(STRIP_SEGMENTS);
+
+    vec3 t1 = vec3(cos(o), 0.0f, sin(o));
+    vec3 a = v0 + v * (v1 - v0);
+    vec3 b = v1 + v * (v2 - v1);
+    vec3 c = a + v * (b - a);
+    vec3 c0 = c - w * t1;
+    vec3 c1 = c + w * t1;
+
+    // Triangle shape, both edges meet at the tip
+    float t = u + 0.5 * v - u * v;
+    vec3 p = (1.0f - t) * c0 + t * c1;
+    gl_Position = camera.viewProj * vec4(p, 1.0);
+
+    outUV = vec2(u, v);
+    outTessLevel = float(STRIP_SEGMENTS);
+    outMinTessLevel = 1.0;  // MIN_TESS_LEVEL of grass.tesc
+    outMaxTessLevel = 10.0; // MAX_TESS_LEVEL of grass.tesc
+    outWorldPos = p;
+}
@@ -0,0 +1,433 @@
+// Declarations shared by the blade compute passes:
+// tile_cull.comp -> simulate.comp -> cull.comp (or cull_subgroup.comp) -> finalize.comp (or finalize_pull.comp)
+// With USE_DENSITY_SPAWNING, simulate.comp is skipped and the cull pass spawns the blades it culls.
+// Every pass serves the camera and the shadow cascades at once, the blades are simulated once for all views
+
+#include "blade_packing.glsl"
+#include "blade_lod.glsl"
+
+#define WORKGROUP_SIZE 32
+#define USE_FORCES 1
+#define USE_CULLING 1
+// The derectives below are only meaningful when USE_CULLING is 1
+#define USE_ORIENTATION_CULLING 1
+#define USE_VIEW_FRUSTUM_CULLING 1
+#define USE_DISTANCE_CULLING 1
+// Test tiles and blades against the depth of the previous frame, mirrored in Renderer.cpp
+#define USE_OCCLUSION_CULLING 1
+// Blades that survived the previous cull of their tile are kept without the view dependent tests
+// (orientation, frustum and occlusion), only the others are tested. Every tile tests all of its blades
+// once every REVALIDATE_FRAMES frames, so blades that went out of view are dropped from the set
+#define USE_TEMPORAL_CULLING 1
+#define REVALIDATE_FRAMES 8u
+// Skip simulating tiles whose blades have settled
+#define USE_SLEEPING 1
+// Spawn the blades of visible tiles from the density map every frame instead of storing and simulating them,
+// mirrors USE_DENSITY_SPAWNING in Blades.h
+#define USE_DENSITY_SPAWNING 0
+
+#if USE_DENSITY_SPAWNING && USE_PACKED_BLADES
+#error "Spawned blades have no rest pose to pack the culled blades against"
+#endif
+
+// Parameters for the grass algorithm
+#define WIND_STRENGTH 5.0f
+#define WIND_FREQUENCY 1.0f
+#define WIND_TURBULENCE 6.5f
+#define CULLING_DISTANCE 30.0f
+// A tile falls asleep after SLEEP_STEPS substeps in which no blade tip moved more than SLEEP_DISPLACEMENT,
+// and wakes up when the wind on any of its blades may have changed by more than WAKE_WIND_CHANGE since
+#define SLEEP_DISPLACEMENT 0.0005f
+#define SLEEP_STEPS 30u
+#define WAKE_WIND_CHANGE 0.25f
+// Spawned tiles keep all of their blades up to SPAWN_FULL_DENSITY_DISTANCE from the camera,
+// down to SPAWN_MIN_DENSITY of them at CULLING_DISTANCE
+#define SPAWN_FULL_DENSITY_DISTANCE 8.0f
+#define SPAWN_MIN_DENSITY 0.4f
+// How far the bounds of a spawned tile reach past the cell its blades grow in, as in Blades::generateSlot
+#define SPAWN_REACH (MAX_HEIGHT + MAX_WIDTH)
+
+#include "camera.glsl"
+#include "shadow.glsl"
+
+// The culled blades hold one list per LOD tier, then one per shadow cascade. Mirrors NUM_CULLED_LISTS in Blades.h
+#define NUM_CULLED_LISTS (NUM_LOD_TIERS + NUM_SHADOW_CASCADES)
+#define SHADOW_LIST(cascade) (NUM_LOD_TIERS + (cascade))
+
+// Views a tile or a blade is tested against, as bits of a mask: the camera, then each shadow cascade
+#define VIEW_CAMERA 1u
+#define VIEW_SHADOW(cascade) (2u << (cascade))
+
+// Fixed-length substeps from Scene::UpdateTime
+layout(set = 1, binding = 0) uniform Time {
+    float deltaTime;  // Length of one substep
+    float totalTime;  // Simulated time at the end of the last substep
+    uint substeps;    // Substeps to run this frame, may be 0
+    float alpha;      // Interpolation factor between the last two simulated states
+    uint frame;       // Frames since the start
+} time;
+
+struct Blade {
+    vec4 v0;
+    vec4 v1;
+    vec4 v2;
+    vec4 up;
+};
+
+// Contiguous range of blades and the box they stay in
+struct BladeTile {
+    vec4 boundsMin;
+    vec4 boundsMax;
+    uint firstBlade;
+    uint bladeCount;
+    uint stateIndex; // Copy of the blade state holding the latest blades of the tile
+};
+
+// The project is using vkCmdDrawIndirect to use a buffer as the arguments for a draw call
+// This is sort of an advanced feature so we've showed you what this buffer should look like
+
+// 1. Store the input blades. Only the control points change, so they are kept apart from the rest pose:
+// NUM_BLADE_STATES copies of the control points one after the other, simulate.comp steps a tile
+// from its stateIndex copy to the other one
+#define NUM_BLADE_STATES 2u
+
+#if USE_PACKED_BLADES
+struct BladeControlPoints {
+    uint controlPoints[3]; // As in PackedBlade
+};
+#else
+struct BladeControlPoints {
+    vec4 v1; // w unused
+    vec4 v2; // w unused
+};
+#endif
+
+layout(set = 2, binding = 0) buffer BladeStates {
+    BladeControlPoints blades[];
+} bladeStates;
+
+// The rest pose, one array per attribute, written once by Blades
+layout(set = 2, binding = 8) readonly buffer RestPositions {
+#if USE_PACKED_BLADES
+    uint positions[]; // PackedBlade::position
+#else
+    vec4 positions[]; // v0 and orientation
+#endif
+} restPositions;
+
+layout(set = 2, binding = 9) readonly buffer RestUps {
+#if USE_PACKED_BLADES
+    uint ups[]; // PackedBlade::tileOrientationUp
+#else
+    vec4 ups[]; // Up vector and stiffness
+#endif
+} restUps;
+
+layout(set = 2, binding = 10) readonly buffer RestShapes {
+#if USE_PACKED_BLADES
+    uint shapes[]; // PackedBlade::shape
+#else
+    vec2 shapes[]; // Height and width
+#endif
+} restShapes;
+
+// Index of a blade's control points in the given copy of the state
+uint bladeStateIdx(uint stateIndex, uint bladeIdx) {
+    return stateIndex * uint(restPositions.positions.length()) + bladeIdx;
+}
+
+// 2. Write out the culled blades, one list of as many blades as there are per LOD tier and per shadow cascade
+layout(set = 2, binding = 1) buffer CulledBlades {
+#if USE_PACKED_BLADES
+    PackedBlade blades[];
+#else
+    Blade blades[];
+#endif
+} outputBlades;
+
+// Room for blades in each list
+uint culledListLength() {
+    return uint(outputBlades.blades.length()) / NUM_CULLED_LISTS;
+}
+
+// Index of the first blade of a list in outputBlades
+uint culledListStart(uint list) {
+    return list * culledListLength();
+}
+
+// 3. Indirect draw arguments of each LOD tier and shadow cascade, and how many of them to draw, written from the
+// culled blade counts by finalize.comp. Layout matches BladeDrawArguments in Blades.h
+struct DrawIndirect {
+    uint vertexCount;   // Write the number of blades remaining here (vertices per blade for the mid and far tiers)
+    uint instanceCount; // = 1 (number of blades remaining for the mid and far tiers)
+    uint firstVertex;   // = 0
+    uint firstInstance; // = 0
+};
+
+layout(set = 2, binding = 2) buffer NumBlades {
+    DrawIndirect draws[NUM_CULLED_LISTS];
+    uint drawCounts[NUM_CULLED_LISTS]; // 0 skips the draw of an empty list altogether
+} numBlades;
+
+// 4. All tiles, the ones that survived tile_cull.comp for at least one view and the dispatch arguments
+// for the per-tile passes (one workgroup per visible tile)
+layout(set = 2, binding = 3) buffer Tiles {
+    BladeTile tiles[];
+} tiles;
+
+layout(set = 2, binding = 4) buffer VisibleTiles {
+    uint indices[]; // Tile index, with the mask of the views that see the tile in the high bits
+} visibleTiles;
+
+#define VISIBLE_TILE_VIEW_SHIFT 16u
+
+uint visibleTileEntry(uint tileIdx, uint views) {
+    return tileIdx | (views << VISIBLE_TILE_VIEW_SHIFT);
+}
+
+uint visibleTileIndex(uint entry) {
+    return entry & ((1u << VISIBLE_TILE_VIEW_SHIFT) - 1u);
+}
+
+uint visibleTileViews(uint entry) {
+    return entry >> VISIBLE_TILE_VIEW_SHIFT;
+}
+
+layout(set = 2, binding = 5) buffer TileDispatch {
+    uint x;
+    uint y;
+    uint z;
+} tileDispatch;
+
+// 5. Number of culled blades of each list, of blades skipped by sleeping tiles and of blades the cull pass
+// tested or kept from the visible set, cleared with
+// a transfer fill before the passes run
+layout(set = 2, binding = 6) buffer Counters {
+    uint culledBlades[NUM_CULLED_LISTS];
+    uint sleepingBlades;
+    uint retestedBlades; // Blades that went through the view dependent tests
+    uint reusedBlades;   // Blades kept from the visible set of the previous frame without them
+} counters;
+
+// 6. Rest tracking of every tile, see SLEEP_STEPS
+struct TileSleep {
+    float simulatedTime; // Total time at which the tile was last simulated
+    uint restSteps;      // Substeps in a row without a blade tip moving more than SLEEP_DISPLACEMENT
+};
+
+layout(set = 2, binding = 7) buffer TileSleepStates {
+    TileSleep tiles[];
+} tileSleep;
+
+// 7. Share of the full tile density over the ground, dim x dim texels row by row along z covering the square
+// from origin to origin + 1 / inverseSize, and repeating outside of it
+layout(set = 2, binding = 11) readonly buffer DensityMap {
+    vec2 origin;
+    float inverseSize;
+    uint dim;
+    float texels[];
+} densityMap;
+
+// 8. Visible set of every tile, one bit per blade of the tile set when the blade survived the last cull.
+// Emptied when a tile is regenerated
+layout(set = 2, binding = 12) buffer TileVisibility {
+    uint words[];
+} tileVisibility;
+
+// Words of the visible set of each tile, TILE_VISIBILITY_WORDS in Blades.h
+uint tileVisibilityWords() {
+    return uint(tileVisibility.words.length()) / uint(tiles.tiles.length());
+}
+
+// 9. Depth pyramid of the previous frame, built by hiz.comp at the end of the graphics pass
+layout(set = 3, binding = 0) uniform HiZ {
+    mat4 viewProj; // Camera the depth was rendered with
+    vec2 size;     // Size of the first level
+    uint levels;
+    uint valid;    // 0 until the pyramid holds a frame rendered with the current frame resources
+    uint reuseVisibleSet; // 0 to put every blade through the view dependent tests, see USE_TEMPORAL_CULLING
+} hiZ;
+
+layout(set = 3, binding = 1) uniform sampler2D hiZPyramid;
+
+// Whether the box is hidden behind the depth of the previous frame. The box is projected with the
+// camera of that frame, so camera motion is accounted for and only moving occluders are a frame late
+bool boxOccluded(vec3 boundsMin, vec3 boundsMax) {
+    if (hiZ.valid == 0u) {
+        return false;
+    }
+
+    vec2 uvMin = vec2(1.0);
+    vec2 uvMax = vec2(0.0);
+    float nearest = 1.0;
+    for (int i = 0; i < 8; ++i) {
+        vec3 corner = vec3((i & 1) != 0 ? boundsMax.x : boundsMin.x,
+                           (i & 2) != 0 ? boundsMax.y : boundsMin.y,
+                           (i & 4) != 0 ? boundsMax.z : boundsMin.z);
+        vec4 clip = hiZ.viewProj * vec4(corner, 1.0);
+        // Boxes crossing the near plane cannot be tested
+        if (clip.z < 0.0) {
+            return false;
+        }
+        vec3 ndc = clip.xyz / clip.w;
+        uvMin = min(uvMin, ndc.xy * 0.5 + 0.5);
+        uvMax = max(uvMax, ndc.xy * 0.5 + 0.5);
+        nearest = min(nearest, ndc.z);
+    }
+
+    // Nothing is known about what the previous frame did not see
+    if (any(lessThan(uvMin, vec2(0.0))) || any(greaterThan(uvMax, vec2(1.0)))) {
+        return false;
+    }
+
+    // Pick the level where the box covers at most 2x2 texels and test against the farthest of them
+    vec2 extent = (uvMax - uvMin) * hiZ.size;
+    float level = min(ceil(log2(max(max(extent.x, extent.y), 1.0))), float(hiZ.levels - 1u));
+    float farthest = max(max(textureLod(hiZPyramid, uvMin, level).r, textureLod(hiZPyramid, vec2(uvMax.x, uvMin.y), level).r),
+                         max(textureLod(hiZPyramid, vec2(uvMin.x, uvMax.y), level).r, textureLod(hiZPyramid, uvMax, level).r));
+    return nearest > farthest;
+}
+
+// The box is outside when its corner furthest along the normal of one of the frustum planes
+// is outside that plane
+bool boxInPlanes(vec3 boundsMin, vec3 boundsMax, vec4 planes[6]) {
+    for (int i = 0; i < 6; ++i) {
+        vec4 plane = planes[i];
+        vec3 corner = mix(boundsMin, boundsMax, greaterThanEqual(plane.xyz, vec3(0.0)));
+        if (dot(plane.xyz, corner) + plane.w < 0.0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool boxInFrustum(vec3 boundsMin, vec3 boundsMax) {
+    return boxInPlanes(boundsMin, boundsMax, camera.frustumPlanes);
+}
+
+bool boxInCascade(vec3 boundsMin, vec3 boundsMax, uint cascade) {
+    vec4 planes[6];
+    for (uint i = 0u; i < 6u; ++i) {
+        planes[i] = shadow.frustumPlanes[cascade * 6u + i];
+    }
+    return boxInPlanes(boundsMin, boundsMax, planes);
+}
+
+// --- Blade model ---
+
+vec3 getWindVector(vec3 v, float totalTime) {
+    // Time-based oscillation for smooth wind variation
+    float windX = WIND_STRENGTH * sin(totalTime * WIND_FREQUENCY);
+    
+    // Turbulence using position-based noise to make wind vary per blade
+    float windZ = WIND_TURBULENCE * sin(dot(v.xz, vec2(12.9898, 78.233)) * 43758.5453 + totalTime * WIND_FREQUENCY);
+    
+    // Fixed Y component for consistent vertical influence
+    float windY = 0.2;
+
+    return vec3(windX, windY, windZ);
+}
+
+// Largest change of getWindVector at any position between two times. Only the turbulence depends on the
+// position, its sine moves by no more than its phase does and never by more than 2
+float windChangeBound(float fromTime, float toTime) {
+    float windX = WIND_STRENGTH * (sin(toTime * WIND_FREQUENCY) - sin(fromTime * WIND_FREQUENCY));
+    float windZ = WIND_TURBULENCE * min(2.0, abs(toTime - fromTime) * WIND_FREQUENCY);
+    return length(vec2(windX, windZ));
+}
+
+// Keep v2 above the ground, then place v1 and scale the curve so that the blade stays height long
+void validateBlade(vec3 v0, vec3 up, float height, out vec3 v1, inout vec3 v2) {
+    v2 -= up * min(0.0f, dot(v2 - v0, up)); // ensure v2 is always above the ground
+    vec3 v2_minus_v0 = v2 - v0; 
+    float l_proj = length(v2_minus_v0 - up * dot(up, v2_minus_v0));
+    float l_proj_div_height = l_proj / height; 
+    vec3 v1_tmp = v0 + height * up * max(1.0f - l_proj_div_height, 0.05 * max(l_proj_div_height, 1.0f)); // ensure the valid position for v1
+    float L0 = distance(v0, v2);
+    float L1 = distance(v0, v1_tmp) + distance(v1_tmp, v2);
+    float L = (2.0f * L0 + L1) / 3.0f;
+    float ratio = height / max(L, 0.0001f);
+    // ensure the length of the blade is always height
+    v1 = v0 + ratio * (v1_tmp - v0);
+    v2 = v1 + ratio * (v2 - v1_tmp);
+}
+
+// --- Blade access ---
+// The passes work on Blade whichever layout the buffers use
+
+// Rest pose of a blade, with v1 and v2 left at v0
+Blade readRestBlade(uint bladeIdx) {
+    Blade blade;
+#if USE_PACKED_BLADES
+    uint tileOrientationUp = restUps.ups[bladeIdx];
+    BladeTile tile = tiles.tiles[unpackTileIndex(tileOrientationUp)];
+    vec3 v0 = unpackBladePosition(restPositions.positions[bladeIdx], tile.boundsMin.xyz, tile.boundsMax.xyz);
+    vec3 shape = unpackShape(restShapes.shapes[bladeIdx]);
+
+    blade.v0 = vec4(v0, unpackOrientation(tileOrientationUp));
+    blade.v1 = vec4(v0, shape.x);
+    blade.v2 = vec4(v0, shape.y);
+    blade.up = vec4(unpackUp(tileOrientationUp), shape.z);
+#else
+    vec2 shape = restShapes.shapes[bladeIdx];
+    blade.v0 = restPositions.positions[bladeIdx];
+    blade.v1 = vec4(blade.v0.xyz, shape.x);
+    blade.v2 = vec4(blade.v0.xyz, shape.y);
+    blade.up = restUps.ups[bladeIdx];
+#endif
+    return blade;
+}
+
+// Control points of a blade rooted at v0 in the given copy of the state
+void readControlPoints(uint stateIndex, uint bladeIdx, vec3 v0, out vec3 v1, out vec3 v2) {
+    BladeControlPoints state = bladeStates.blades[bladeStateIdx(stateIndex, bladeIdx)];
+#if USE_PACKED_BLADES
+    unpackControlPoints(uvec3(state.controlPoints[0], state.controlPoints[1], state.controlPoints[2]), v0, v1, v2);
+#else
+    v1 = state.v1.xyz;
+    v2 = state.v2.xyz;
+#endif
+}
+
+// Read a blade from the given copy of the state
+Blade readBlade(uint stateIndex, uint bladeIdx) {
+    Blade blade = readRestBlade(bladeIdx);
+    vec3 v1;
+    vec3 v2;
+    readControlPoints(stateIndex, bladeIdx, blade.v0.xyz, v1, v2);
+    blade.v1.xyz = v1;
+    blade.v2.xyz = v2;
+    return blade;
+}
+
+// Write the simulated control points of a blade to the given copy of the state
+void writeControlPoints(uint stateIndex, uint bladeIdx, Blade blade, vec3 v1, vec3 v2) {
+    uint idx = bladeStateIdx(stateIndex, bladeIdx);
+#if USE_PACKED_BLADES
+    uvec3 controlPoints = packControlPoints(blade.v0.xyz, v1, v2);
+    bladeStates.blades[idx].controlPoints[0] = controlPoints.x;
+    bladeStates.blades[idx].controlPoints[1] = controlPoints.y;
+    bladeStates.blades[idx].controlPoints[2] = controlPoints.z;
+#else
+    bladeStates.blades[idx].v1.xyz = v1;
+    bladeStates.blades[idx].v2.xyz = v2;
+#endif
+}
+
+// Write a blade to the culled blades. Only its control points may differ from the rest pose,
+// so the packed layout copies the rest of the words as they are stored
+void writeCulledBlade(uint outputIdx, uint bladeIdx, Blade blade) {
+#if USE_PACKED_BLADES
+    uvec3 controlPoints = packControlPoints(blade.v0.xyz, blade.v1.xyz, blade.v2.xyz);
+    PackedBlade packed;
+    packed.position = restPositions.positions[bladeIdx];
+    packed.tileOrientationUp = restUps.ups[bladeIdx];
+    packed.controlPoints[0] = controlPoints.x;
+    packed.controlPoints[1] = controlPoints.y;
+    packed.controlPoints[2] = controlPoints.z;
+    packed.shape = restShapes.shapes[bladeIdx];
+    outputBlades.blades[outputIdx] = packed;
+#else
+    outputBlades.blades[outputIdx] = blade;
+#endif
+}
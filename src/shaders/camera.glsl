@@ -0,0 +1,16 @@
+// Camera uniform of the grass and compute shaders, layout matches CameraBufferObject in Camera.h.
+// Everything past view and proj is derived on the host once per camera change
+layout(set = 0, binding = 0) uniform CameraBufferObject {
+    mat4 view;
+    mat4 proj;
+    mat4 viewProj;
+    vec4 position;         // World space position, w = 1
+    vec4 frustumPlanes[6]; // Pointing inside, p is inside a plane when dot(plane.xyz, p) + plane.w >= 0
+    vec4 viewport;         // Size in pixels, then its inverse
+} camera;
+
+// Pixels covered by a world space unit at p, along the height of the viewport
+float pixelsPerUnit(vec3 p) {
+    float w = max((camera.viewProj * vec4(p, 1.0)).w, 1e-3);
+    return 0.5 * camera.viewport.y * abs(camera.proj[1][1]) / w;
+}
@@ -0,0 +1,335 @@
+// Culling and stream compaction of the simulated blades, shared by cull.comp and
+// cull_subgroup.comp which only differ in USE_SUBGROUP_COMPACTION.
+// Every blade is tested against the camera and each shadow cascade that sees its tile, and written to the
+// list of its LOD tier and to the list of every cascade it casts a shadow into
+
+#include "blades.glsl"
+#include "spawn.glsl"
+
+layout(local_size_x = WORKGROUP_SIZE, local_size_y = 1, local_size_z = 1) in;
+
+bool inBounds(float value, float bounds) {
+    return (value >= -bounds) && (value <= bounds);
+}
+
+// LOD tier the blade is drawn in
+uint bladeLod(Blade curBlade) {
+    float d = distance(curBlade.v0.xyz, camera.position.xyz);
+    return d < LOD_MID_DISTANCE ? LOD_NEAR : (d < LOD_FAR_DISTANCE ? LOD_MID : LOD_FAR);
+}
+
+// Return whether the blade survives orientation, frustum, distance, sub-pixel and occlusion culling.
+// Without retest the view dependent tests are skipped, the blade was visible in the previous frame
+bool cullBlade(uint bladeIdx, Blade curBlade, uint lod, bool retest) {
+    vec3 v0 = curBlade.v0.xyz;
+    vec3 v1 = curBlade.v1.xyz;
+    vec3 v2 = curBlade.v2.xyz;
+    vec3 up = curBlade.up.xyz;
+    float orientation = curBlade.v0.w;
+    vec3 s = vec3(cos(orientation), 0.0, sin(orientation));
+
+    bool culled = false;
+    
+    #if USE_CULLING
+        #if USE_ORIENTATION_CULLING
+            // Orientation Culling, cards always face the camera
+            vec4 side_vec = vec4(s, 0.0);
+            vec3 dir_b = normalize((camera.view * side_vec).xyz);
+            vec3 dir_c = normalize((camera.view * vec4(v0, 1.0)).xyz);
+            bool is_orientation_culled = retest && lod != LOD_FAR && abs(dot(dir_b, dir_c)) > 0.9f;
+            culled = culled || is_orientation_culled;
+        #endif
+
+        #if USE_VIEW_FRUSTUM_CULLING
+            // View Frustum Culling
+            if (retest) {
+                mat4 viewProj = camera.viewProj;
+                vec3 m = 0.25 * v0 + 0.5 * v1 + 0.25 * v2;
+                vec4 v0_clip = (viewProj * vec4(v0, 1.0));
+                vec4 v2_clip = (viewProj * vec4(v2, 1.0));
+                vec4 m_clip = (viewProj * vec4(m, 1.0));
+                float t = 0.01; 
+                float v0_tolerance = v0_clip.w + t;
+                float v2_tolerance = v2_clip.w + t;
+                float m_tolerance = m_clip.w + t;
+                bool in_frustum = inBounds(v0_clip.x, v0_tolerance) && inBounds(v0_clip.y, v0_tolerance) && inBounds(v0_clip.z, v0_tolerance) ||
+                                inBounds(v2_clip.x, v2_tolerance) && inBounds(v2_clip.y, v2_tolerance) && inBounds(v2_clip.z, v2_tolerance) ||
+                                inBounds(m_clip.x, m_tolerance) && inBounds(m_clip.y, m_tolerance) && inBounds(m_clip.z, m_tolerance);
+                culled = culled || !in_frustum;
+            }
+        #endif
+
+        #if USE_DISTANCE_CULLING   
+            // Distance Culling
+            vec3 c = camera.position.xyz;
+            vec3 camera_to_blade = v0 - c;
+            vec3 projected_up = dot(camera_to_blade, up) * up;
+            float d_proj = length(camera_to_blade - projected_up);
+            // Nothing survives past CULLING_DISTANCE, which lets tile_cull.comp drop whole tiles
+            bool is_out_of_range = d_proj >= CULLING_DISTANCE;
+            // The far tier keeps one blade per clump
+            bool is_thinned = lod == LOD_FAR && bladeIdx % FAR_CLUMP_BLADES != 0u;
+            bool is_too_far = is_out_of_range || is_thinned;
+            culled = culled || is_too_far;
+        #endif
+
+        #if USE_SUBPIXEL_CULLING
+            // Sub-pixel Culling, cards are far wider than a blade and are left alone
+            if (lod != LOD_FAR) {
+                float pixels = pixelsPerUnit(v0);
+                bool is_too_short = curBlade.v1.w * pixels < MIN_BLADE_HEIGHT_PIXELS;
+                bool is_too_thin = bladeRandom(bladeIdx) * MIN_BLADE_PIXELS >= curBlade.v2.w * pixels;
+                culled = culled || is_too_short || is_too_thin;
+            }
+        #endif
+
+        #if USE_OCCLUSION_CULLING
+            // The blade stays within the hull of its control points, widened by its width or that of its card
+            if (!culled && retest) {
+                vec3 halfWidth = vec3(0.5 * (lod == LOD_FAR ? CARD_WIDTH : curBlade.v2.w));
+                culled = boxOccluded(min(min(v0, v1), v2) - halfWidth, max(max(v0, v1), v2) + halfWidth);
+            }
+        #endif
+    #endif
+
+    return !culled;
+}
+
+// Return whether the blade casts a shadow into the cascade, after frustum, distance and sub-pixel culling
+// against the cascade. The light sees blades from every side and nothing occludes them from it
+bool cullBladeShadow(uint bladeIdx, Blade curBlade, uint cascade) {
+    vec3 v0 = curBlade.v0.xyz;
+    vec3 v1 = curBlade.v1.xyz;
+    vec3 v2 = curBlade.v2.xyz;
+    vec3 up = curBlade.up.xyz;
+
+    bool culled = false;
+
+    #if USE_CULLING
+        #if USE_VIEW_FRUSTUM_CULLING
+            // The blade stays within the hull of its control points, widened by its width
+            vec3 halfWidth = vec3(0.5 * curBlade.v2.w);
+            culled = culled || !boxInCascade(min(min(v0, v1), v2) - halfWidth, max(max(v0, v1), v2) + halfWidth, cascade);
+        #endif
+
+        #if USE_DISTANCE_CULLING
+            // Blades the camera does not draw do not cast shadows either
+            vec3 camera_to_blade = v0 - camera.position.xyz;
+            float d_proj = length(camera_to_blade - dot(camera_to_blade, up) * up);
+            culled = culled || d_proj >= CULLING_DISTANCE;
+        #endif
+
+        #if USE_SUBPIXEL_CULLING
+            // Same thinning as for the camera, in texels of the cascade. blade_strip.vert widens the blades kept
+            float texels = shadow.extents[cascade].y;
+            bool is_too_short = curBlade.v1.w * texels < MIN_BLADE_HEIGHT_PIXELS;
+            bool is_too_thin = bladeRandom(bladeIdx) * MIN_BLADE_PIXELS >= curBlade.v2.w * texels;
+            culled = culled || is_too_short || is_too_thin;
+        #endif
+    #endif
+
+    return !culled;
+}
+
+// Counts of the culled lists are packed into one uint, LIST_COUNT_BITS each, so that a single scan compacts
+// every list. A field never exceeds WORKGROUP_SIZE, and NUM_CULLED_LISTS fields fit in 32 bits
+#define LIST_COUNT_BITS 6u
+
+uint listCount(uint packedCounts, uint list) {
+    return (packedCounts >> (LIST_COUNT_BITS * list)) & ((1u << LIST_COUNT_BITS) - 1u);
+}
+
+uint listFlag(uint list) {
+    return 1u << (LIST_COUNT_BITS * list);
+}
+
+// Where the workgroup's blades of each list start in the list
+shared uint listBases[NUM_CULLED_LISTS];
+
+// Reserve room for the workgroup's blades of each list, from the packed counts of the whole workgroup
+void reserveLists(uint packedTotal) {
+    for (uint list = 0u; list < NUM_CULLED_LISTS; ++list) {
+        uint count = listCount(packedTotal, list);
+        listBases[list] = count > 0u ? atomicAdd(counters.culledBlades[list], count) : 0u;
+    }
+}
+
+#if USE_SUBGROUP_COMPACTION
+// Packed survivor counts of each subgroup, then the packed offsets of each subgroup
+shared uint subgroupOffsets[WORKGROUP_SIZE];
+
+// Find where this invocation writes its blade in each list flagged in flags (listFlag of every list).
+// Must be called by the whole workgroup
+void compactOffsets(uint flags, out uint outputIdx[NUM_CULLED_LISTS]) {
+    uint offsetsInSubgroup = 0u;
+    uint counts = 0u;
+    for (uint list = 0u; list < NUM_CULLED_LISTS; ++list) {
+        uvec4 ballot = subgroupBallot(listCount(flags, list) != 0u);
+        offsetsInSubgroup |= subgroupBallotExclusiveBitCount(ballot) << (LIST_COUNT_BITS * list);
+        counts |= subgroupBallotBitCount(ballot) << (LIST_COUNT_BITS * list);
+    }
+    if (subgroupElect()) {
+        subgroupOffsets[gl_SubgroupID] = counts;
+    }
+    barrier();
+
+    // The first subgroup scans the subgroup counts and reserves space for the whole workgroup
+    // The renderer only picks this path when gl_NumSubgroups <= gl_SubgroupSize
+    if (gl_SubgroupID == 0u) {
+        uint count = gl_SubgroupInvocationID < gl_NumSubgroups ? subgroupOffsets[gl_SubgroupInvocationID] : 0u;
+        uint offset = subgroupExclusiveAdd(count);
+        uint total = subgroupAdd(count);
+
+        if (subgroupElect()) {
+            reserveLists(total);
+        }
+
+        if (gl_SubgroupInvocationID < gl_NumSubgroups) {
+            subgroupOffsets[gl_SubgroupInvocationID] = offset;
+        }
+    }
+    barrier();
+
+    // No field carries into the next one, so the packed offsets add up field by field
+    uint offsets = subgroupOffsets[gl_SubgroupID] + offsetsInSubgroup;
+    for (uint list = 0u; list < NUM_CULLED_LISTS; ++list) {
+        outputIdx[list] = listBases[list] + listCount(offsets, list);
+    }
+    barrier(); // subgroupOffsets and listBases are reused by the next call
+}
+#else
+// Inclusive scan of the packed visibility flags
+shared uint scan[WORKGROUP_SIZE];
+
+// Find where this invocation writes its blade in each list flagged in flags (listFlag of every list).
+// Must be called by the whole workgroup
+void compactOffsets(uint flags, out uint outputIdx[NUM_CULLED_LISTS]) {
+    uint idx = gl_LocalInvocationID.x;
+
+    // Hillis-Steele scan over the workgroup
+    scan[idx] = flags;
+    barrier();
+    for (uint stride = 1u; stride < WORKGROUP_SIZE; stride <<= 1) {
+        uint value = scan[idx];
+        if (idx >= stride) {
+            value += scan[idx - stride];
+        }
+        barrier();
+        scan[idx] = value;
+        barrier();
+    }
+
+    // The last invocation holds the totals and reserves space for the whole workgroup
+    if (idx == WORKGROUP_SIZE - 1) {
+        reserveLists(scan[idx]);
+    }
+    barrier();
+
+    uint offsets = scan[idx] - flags;
+    for (uint list = 0u; list < NUM_CULLED_LISTS; ++list) {
+        outputIdx[list] = listBases[list] + listCount(offsets, list);
+    }
+    barrier(); // scan and listBases are reused by the next call
+}
+#endif
+
+// The blade between its last two simulated states, as it is drawn this frame
+Blade interpolateBlade(uint stateIndex, uint bladeIdx) {
+    Blade blade = readRestBlade(bladeIdx);
+    vec3 prevV1, prevV2, curV1, curV2;
+    readControlPoints((stateIndex + 1u) % NUM_BLADE_STATES, bladeIdx, blade.v0.xyz, prevV1, prevV2);
+    readControlPoints(stateIndex, bladeIdx, blade.v0.xyz, curV1, curV2);
+    blade.v1.xyz = mix(prevV1, curV1, time.alpha);
+    blade.v2.xyz = mix(prevV2, curV2, time.alpha);
+    return blade;
+}
+
+// Blades of the workgroup's tile that were tested and kept from the visible set, added to the counters once
+shared uint tileRetested;
+shared uint tileReused;
+
+void main() {
+    uint tileEntry = visibleTiles.indices[gl_WorkGroupID.x];
+    uint tileIdx = visibleTileIndex(tileEntry);
+    uint views = visibleTileViews(tileEntry);
+    BladeTile tile = tiles.tiles[tileIdx];
+#if USE_TEMPORAL_CULLING
+    // Tiles take turns testing their whole visible set again
+    bool revalidate = hiZ.reuseVisibleSet == 0u || (time.frame + tileIdx) % REVALIDATE_FRAMES == 0u;
+    uint visibilityBase = tileIdx * tileVisibilityWords();
+#endif
+
+    if (gl_LocalInvocationID.x == 0u) {
+        tileRetested = 0u;
+        tileReused = 0u;
+    }
+    barrier();
+
+    // The whole workgroup runs every iteration so that compactOffsets sees uniform control flow
+    for (uint first = 0u; first < tile.bladeCount; first += WORKGROUP_SIZE) {
+        uint i = first + gl_LocalInvocationID.x;
+
+        Blade curBlade;
+        bool visible = false;
+        // listFlag of every list the blade is written to
+        uint flags = 0u;
+        if (i < tile.bladeCount) {
+#if USE_DENSITY_SPAWNING
+            bool spawned = spawnBlade(tile, tile.firstBlade + i, curBlade);
+#else
+            bool spawned = true;
+            curBlade = interpolateBlade(tile.stateIndex, tile.firstBlade + i);
+#endif
+#if USE_TEMPORAL_CULLING
+            uint word = visibilityBase + i / 32u;
+            uint bit = 1u << (i % 32u);
+            bool wasVisible = (tileVisibility.words[word] & bit) != 0u;
+            bool retest = revalidate || !wasVisible;
+#else
+            bool retest = true;
+#endif
+            if (spawned && (views & VIEW_CAMERA) != 0u) {
+                uint lod = bladeLod(curBlade);
+                visible = cullBlade(tile.firstBlade + i, curBlade, lod, retest);
+                if (visible) {
+                    flags |= listFlag(lod);
+                }
+                if (retest) {
+                    atomicAdd(tileRetested, 1u);
+                } else {
+                    atomicAdd(tileReused, 1u);
+                }
+            }
+            // The shadow cascades are tested every frame, they are cheap next to the camera's tests
+            for (uint cascade = 0u; cascade < NUM_SHADOW_CASCADES; ++cascade) {
+                if (spawned && (views & VIEW_SHADOW(cascade)) != 0u && cullBladeShadow(tile.firstBlade + i, curBlade, cascade)) {
+                    flags |= listFlag(SHADOW_LIST(cascade));
+                }
+            }
+#if USE_TEMPORAL_CULLING
+            // Patch the blades that came into view into the set, and drop the ones that left it
+            if (visible && !wasVisible) {
+                atomicOr(tileVisibility.words[word], bit);
+            } else if (!visible && wasVisible) {
+                atomicAnd(tileVisibility.words[word], ~bit);
+            }
+#endif
+        }
+
+        // One atomic per list per workgroup instead of one per surviving blade and view.
+        // Spawned blades that do not fit in a list are dropped from it
+        uint outputIdx[NUM_CULLED_LISTS];
+        compactOffsets(flags, outputIdx);
+        for (uint list = 0u; list < NUM_CULLED_LISTS; ++list) {
+            if (listCount(flags, list) != 0u && outputIdx[list] < culledListLength()) {
+                writeCulledBlade(culledListStart(list) + outputIdx[list], tile.firstBlade + i, curBlade);
+            }
+        }
+    }
+
+    barrier();
+    if (gl_LocalInvocationID.x == 0u) {
+        atomicAdd(counters.retestedBlades, tileRetested);
+        atomicAdd(counters.reusedBlades, tileReused);
+    }
+}
@@ -0,0 +1,39 @@
+// Indirect draw arguments of the LOD tiers, shared by finalize.comp and finalize_pull.comp
+// which only differ in USE_VERTEX_PULLING
+
+#include "blades.glsl"
+
+layout(local_size_x = 1, local_size_y = 1, local_size_z = 1) in;
+
+// Turn the culled blade counts into the draw arguments of each LOD tier and shadow cascade, and the draw counts
+// that let vkCmdDrawIndirectCount skip the empty ones.
+// Near blades are one patch vertex each (or PULL_VERTICES_PER_BLADE strip vertices without tessellation),
+// mid and far blades are one instance each, and shadow casters are mid tier strips whatever their distance
+void main() {
+    // Spawned blades may overflow the lists, the ones past the end were not written
+    uint culledBlades[NUM_CULLED_LISTS];
+    for (uint list = 0u; list < NUM_CULLED_LISTS; ++list) {
+        culledBlades[list] = min(counters.culledBlades[list], culledListLength());
+    }
+
+#if USE_VERTEX_PULLING
+    numBlades.draws[LOD_NEAR].vertexCount = culledBlades[LOD_NEAR] * PULL_VERTICES_PER_BLADE;
+#else
+    numBlades.draws[LOD_NEAR].vertexCount = culledBlades[LOD_NEAR];
+#endif
+    numBlades.draws[LOD_NEAR].instanceCount = 1u;
+    numBlades.draws[LOD_MID].vertexCount = STRIP_VERTICES;
+    numBlades.draws[LOD_MID].instanceCount = culledBlades[LOD_MID];
+    numBlades.draws[LOD_FAR].vertexCount = CARD_VERTICES;
+    numBlades.draws[LOD_FAR].instanceCount = culledBlades[LOD_FAR];
+    for (uint cascade = 0u; cascade < NUM_SHADOW_CASCADES; ++cascade) {
+        numBlades.draws[SHADOW_LIST(cascade)].vertexCount = STRIP_VERTICES;
+        numBlades.draws[SHADOW_LIST(cascade)].instanceCount = culledBlades[SHADOW_LIST(cascade)];
+    }
+
+    for (uint list = 0u; list < NUM_CULLED_LISTS; ++list) {
+        numBlades.draws[list].firstVertex = 0u;
+        numBlades.draws[list].firstInstance = 0u;
+        numBlades.drawCounts[list] = culledBlades[list] > 0u ? 1u : 0u;
+    }
+}
@@ -1,13 +1,20 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+// The ground receives the shadows of the grass
+#define SAMPLE_SHADOW_MAP
+#include "shadow.glsl"
 
 layout(set = 1, binding = 1) uniform sampler2D texSampler;
 
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
+layout(location = 2) in vec3 fragWorldPos;
 
 layout(location = 0) out vec4 outColor;
 
 void main() {
-    outColor = texture(texSampler, fragTexCoord);
+    vec4 color = texture(texSampler, fragTexCoord);
+    outColor = vec4(color.rgb * shadowLight(fragWorldPos), color.a);
 }
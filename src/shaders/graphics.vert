@@ -16,13 +16,17 @@ layout(location = 2) in vec2 inTexCoord;
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
+// Where graphics.frag looks the shadow map up
+layout(location = 2) out vec3 fragWorldPos;
 
 out gl_PerVertex {
     vec4 gl_Position;
 };
 
 void main() {
-    gl_Position = camera.proj * camera.view * model * vec4(inPosition, 1.0);
+    vec4 worldPos = model * vec4(inPosition, 1.0);
+    gl_Position = camera.proj * camera.view * worldPos;
     fragColor = inColor;
+    fragWorldPos = worldPos.xyz;
     fragTexCoord = inTexCoord;
 }
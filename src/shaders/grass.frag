@@ -1,5 +1,6 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
 
 // For debugging
 #define USE_TESS_LEVEL_AS_COLOR 0
@@ -9,12 +10,16 @@ layout(set = 0, binding = 0) uniform CameraBufferObject {
     mat4 proj;
 } camera;
 
+#define SAMPLE_SHADOW_MAP
+#include "shadow.glsl"
+
 // TODO: Declare fragment shader inputs
 layout(location = 0) in vec2 inUV;
 /** For Rendering Tessellation **/
 layout(location = 1) in float inTessLevel; 
 layout(location = 2) in float inMinTessLevel; 
 layout(location = 3) in float inMaxTessLevel; 
+layout(location = 4) in vec3 inWorldPos;
 
 layout(location = 0) out vec4 outColor;
 
@@ -34,6 +39,9 @@ void main() {
     // Blend the base color with noise for subtle variation
     vec3 grassColor = mix(grassDarkColor, grassLightColor, gradient);
 
+    // Shadows of the other blades
+    grassColor *= shadowLight(inWorldPos);
+
     #if USE_TESS_LEVEL_AS_COLOR
         float normalised_tess_level = (inTessLevel - inMinTessLevel) / (inMaxTessLevel - inMinTessLevel);
         outColor = vec4(normalised_tess_level);
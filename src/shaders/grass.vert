@@ -1,23 +1,55 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "blade_packing.glsl"
 
 layout(set = 1, binding = 0) uniform ModelBufferObject {
     mat4 model;
 };
 
 // TODO: Declare vertex shader inputs and outputs
+#if USE_PACKED_BLADES
+// Leading fields of BladeTile in blades.glsl, positions are stored relative to the tile bounds
+struct TileBounds {
+    vec4 boundsMin;
+    vec4 boundsMax;
+    uvec4 range;
+};
+
+layout(set = 2, binding = 0) readonly buffer Tiles {
+    TileBounds tiles[];
+} tiles;
+
+layout(location = 0) in uvec2 inPositionTile; // PackedBlade position and tileOrientationUp
+layout(location = 1) in uvec3 inControlPoints;
+layout(location = 2) in uint inShape;
+#else
 layout(location = 0) in vec4 v0;
 layout(location = 1) in vec4 v1;
 layout(location = 2) in vec4 v2;
 layout(location = 3) in vec4 up;
+#endif
 
 layout(location = 0) out vec3 outV0;
 layout(location = 1) out vec3 outV1;
 layout(location = 2) out vec3 outV2;
+#if USE_PACKED_BLADES
+// Orientation and shape words, decoded by grass.tese
+layout(location = 3) out uvec2 outParams;
+#else
 layout(location = 3) out vec3 outParams;
+#endif
 
 void main() {
 	// TODO: Write gl_Position and any other shader outputs
+#if USE_PACKED_BLADES
+    TileBounds tile = tiles.tiles[unpackTileIndex(inPositionTile.y)];
+    vec4 v0 = vec4(unpackBladePosition(inPositionTile.x, tile.boundsMin.xyz, tile.boundsMax.xyz), 1.0);
+    vec4 v1 = vec4(0.0, 0.0, 0.0, 1.0);
+    vec4 v2 = vec4(0.0, 0.0, 0.0, 1.0);
+    unpackControlPoints(inControlPoints, v0.xyz, v1.xyz, v2.xyz);
+#endif
     vec4 worldV0 = model * vec4(v0.xyz, 1.0);
     vec4 worldV1 = model * vec4(v1.xyz, 1.0);
     vec4 worldV2 = model * vec4(v2.xyz, 1.0);
@@ -25,5 +57,9 @@ void main() {
     outV0 = worldV0.xyz;
     outV1 = worldV1.xyz;
     outV2 = worldV2.xyz;
+#if USE_PACKED_BLADES
+    outParams = uvec2(inPositionTile.y, inShape);
+#else
     outParams = vec3(v0.w, v1.w, v2.w);
+#endif
 }
@@ -0,0 +1,103 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_GOOGLE_include_directive : require
+
+#include "blade_packing.glsl"
+#include "blade_lod.glsl"
+
+// Near blades without tessellation. Blades are read straight from the culled blades of the near tier,
+// PULL_VERTICES_PER_BLADE vertices each, and evaluated along the same curve as grass.tese
+
+#include "camera.glsl"
+
+layout(set = 1, binding = 0) uniform ModelBufferObject {
+    mat4 model;
+};
+
+#if USE_PACKED_BLADES
+// Leading fields of BladeTile in blades.glsl, positions are stored relative to the tile bounds
+struct TileBounds {
+    vec4 boundsMin;
+    vec4 boundsMax;
+    uvec4 range;
+};
+
+layout(set = 2, binding = 0) readonly buffer Tiles {
+    TileBounds tiles[];
+} tiles;
+#else
+struct Blade {
+    vec4 v0;
+    vec4 v1;
+    vec4 v2;
+    vec4 up;
+};
+#endif
+
+// The near tier list comes first in the culled blades
+layout(set = 2, binding = 1) readonly buffer CulledBlades {
+#if USE_PACKED_BLADES
+    PackedBlade blades[];
+#else
+    Blade blades[];
+#endif
+} culledBlades;
+
+layout(location = 0) out vec2 outUV;
+// grass.frag can show the tessellation level, a pulled blade is drawn as if tessellated at its segment count
+layout(location = 1) out float outTessLevel;
+layout(location = 2) out float outMinTessLevel;
+layout(location = 3) out float outMaxTessLevel;
+// Where grass.frag looks the shadow map up
+layout(location = 4) out vec3 outWorldPos;
+
+void main() {
+    uint bladeIdx = uint(gl_VertexIndex) / PULL_VERTICES_PER_BLADE;
+    // The first and last vertex of a blade repeat their neighbour, which leaves degenerate triangles between blades
+    uint stripIdx = uint(clamp(int(uint(gl_VertexIndex) % PULL_VERTICES_PER_BLADE) - 1, 0, int(2u * PULL_SEGMENTS)));
+
+#if USE_PACKED_BLADES
+    PackedBlade blade = culledBlades.blades[bladeIdx];
+    TileBounds tile = tiles.tiles[unpackTileIndex(blade.tileOrientationUp)];
+    vec3 v0 = unpackBladePosition(blade.position, tile.boundsMin.xyz, tile.boundsMax.xyz);
+    vec3 v1;
+    vec3 v2;
+    unpackControlPoints(uvec3(blade.controlPoints[0], blade.controlPoints[1], blade.controlPoints[2]), v0, v1, v2);
+    float o = unpackOrientation(blade.tileOrientationUp);
+    float w = unpackShape(blade.shape).y;
+#else
+    Blade blade = culledBlades.blades[bladeIdx];
+    vec3 v0 = blade.v0.xyz;
+    vec3 v1 = blade.v1.xyz;
+    vec3 v2 = blade.v2.xyz;
+    float o = blade.v0.w;
+    float w = blade.v2.w;
+#endif
+    v0 = (model * vec4(v0, 1.0)).xyz;
+    v1 = (model * vec4(v1, 1.0)).xyz;
+    v2 = (model * vec4(v2, 1.0)).xyz;
+    // Blades kept by sub-pixel thinning stand in for the ones dropped around them
+    w = drawnBladeWidth(w, pixelsPerUnit(v0));
+
+    // Vertices alternate between the two edges of the blade, bottom to top, and end at the tip
+    float u = float(stripIdx & 1u);
+    float v = float(stripIdx / 2u) / float(PULL_SEGMENTS);
+
+    vec3 t1 = vec3(cos(o), 0.0f, sin(o));
+    vec3 a = v0 + v * (v1 - v0);
+    vec3 b = v1 + v * (v2 - v1);
+    vec3 c = a + v * (b - a);
+    vec3 c0 = c - w * t1;
+    vec3 c1 = c + w * t1;
+
+    // Triangle shape, both edges meet at the tip
+    float t = u + 0.5 * v - u * v;
+    vec3 p = (1.0f - t) * c0 + t * c1;
+    gl_Position = camera.viewProj * vec4(p, 1.0);
+
+    outUV = vec2(u, v);
+    outTessLevel = float(PULL_SEGMENTS);
+    outMinTessLevel = 1.0;  // MIN_TESS_LEVEL of grass.tesc
+    outMaxTessLevel = 10.0; // MAX_TESS_LEVEL of grass.tesc
+    outWorldPos = p;
+}
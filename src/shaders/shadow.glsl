@@ -0,0 +1,37 @@
+// Shadow cascades of a fixed directional light, bound next to the camera and written by ShadowCascades.
+// Shaders that receive shadows define SAMPLE_SHADOW_MAP before including this file
+
+// Mirrors NUM_SHADOW_CASCADES in Blades.h
+#define NUM_SHADOW_CASCADES 2u
+// How much light is left in the shade
+#define SHADOW_AMBIENT 0.45
+
+// Layout matches ShadowBufferObject in ShadowCascades.h
+layout(set = 0, binding = 1) uniform ShadowCascades {
+    mat4 viewProj[NUM_SHADOW_CASCADES];
+    vec4 frustumPlanes[NUM_SHADOW_CASCADES * 6u]; // Six per cascade, as camera.frustumPlanes
+    vec4 extents[NUM_SHADOW_CASCADES];            // Half extent in world units, then texels per world unit
+    vec4 lightDirection;                          // Direction the light travels in
+} shadow;
+
+#ifdef SAMPLE_SHADOW_MAP
+// One layer per cascade, compared against the depth of the point
+layout(set = 0, binding = 2) uniform sampler2DArrayShadow shadowMap;
+
+// Share of the light reaching p, from the first cascade that covers it. Filtered over 2x2 texels by the sampler
+float shadowFactor(vec3 p) {
+    for (uint cascade = 0u; cascade < NUM_SHADOW_CASCADES; ++cascade) {
+        vec4 clip = shadow.viewProj[cascade] * vec4(p, 1.0);
+        vec2 uv = clip.xy * 0.5 + 0.5;
+        if (all(greaterThan(uv, vec2(0.0))) && all(lessThan(uv, vec2(1.0))) && clip.z < 1.0) {
+            return texture(shadowMap, vec4(uv, float(cascade), clip.z));
+        }
+    }
+    return 1.0;
+}
+
+// Light left at p once shadowed by the grass
+float shadowLight(vec3 p) {
+    return mix(SHADOW_AMBIENT, 1.0, shadowFactor(p));
+}
+#endif
@@ -0,0 +1,69 @@
+// Blades spawned per visible tile when USE_DENSITY_SPAWNING is 1, included by cull.glsl.
+// A spawned blade only depends on its index and on the time, so a tile shows the same blades
+// every time it comes into view and nothing is stored per blade
+
+// Independent uniform values in [0, 1) for one blade. Stream 0 is bladeRandom itself, used by sub-pixel culling
+float spawnRandom(uint bladeIdx, uint stream) {
+    return bladeRandom(bladeIdx ^ (stream * 0x9e3779b9u));
+}
+
+// Density map at a point of the ground, bilinearly filtered and repeated over the whole world
+float sampleDensity(vec2 p) {
+    vec2 texel = fract((p - densityMap.origin) * densityMap.inverseSize) * float(densityMap.dim);
+    uvec2 t0 = uvec2(texel) % densityMap.dim;
+    uvec2 t1 = (t0 + 1u) % densityMap.dim;
+    vec2 f = fract(texel);
+
+    float d00 = densityMap.texels[t0.y * densityMap.dim + t0.x];
+    float d10 = densityMap.texels[t0.y * densityMap.dim + t1.x];
+    float d01 = densityMap.texels[t1.y * densityMap.dim + t0.x];
+    float d11 = densityMap.texels[t1.y * densityMap.dim + t1.x];
+    return mix(mix(d00, d10, f.x), mix(d01, d11, f.x), f.y);
+}
+
+// Share of the blades spawned at a distance from the camera
+float distanceDensity(float d) {
+    float t = clamp((d - SPAWN_FULL_DENSITY_DISTANCE) / (CULLING_DISTANCE - SPAWN_FULL_DENSITY_DISTANCE), 0.0, 1.0);
+    return mix(1.0, SPAWN_MIN_DENSITY, t);
+}
+
+// Spawn blade bladeIdx of the tile, bent as far as the wind and gravity hold it against its stiffness
+// at the time the frame is drawn. Returns false when the density map and the distance to the camera leave it out
+bool spawnBlade(BladeTile tile, uint bladeIdx, out Blade blade) {
+    vec2 cellMin = tile.boundsMin.xz + SPAWN_REACH;
+    vec2 cellMax = tile.boundsMax.xz - SPAWN_REACH;
+    vec3 v0 = vec3(mix(cellMin.x, cellMax.x, spawnRandom(bladeIdx, 1u)),
+                   tile.boundsMin.y,
+                   mix(cellMin.y, cellMax.y, spawnRandom(bladeIdx, 2u)));
+
+    // Keep the blade while its own threshold is under the density, so blades come and go one at a time
+    // as the camera moves instead of the whole tile changing
+    float density = sampleDensity(v0.xz) * distanceDensity(distance(v0, camera.position.xyz));
+    if (spawnRandom(bladeIdx, 3u) >= density) {
+        return false;
+    }
+
+    float orientation = spawnRandom(bladeIdx, 4u) * TWO_PI;
+    float height = mix(MIN_HEIGHT, MAX_HEIGHT, spawnRandom(bladeIdx, 5u));
+    float width = mix(MIN_WIDTH, MAX_WIDTH, spawnRandom(bladeIdx, 6u));
+    float stiffness = mix(MIN_BEND, MAX_BEND, spawnRandom(bladeIdx, 7u));
+    vec3 up = vec3(0.0, 1.0, 0.0);
+    vec3 s = vec3(cos(orientation), 0.0, sin(orientation));
+    vec3 f = normalize(cross(up, s));
+
+    // The forces of simulate.comp on the upright blade, balanced by the recovery force
+    vec3 gE = vec3(0.0, -9.8, 0.0);
+    vec3 g = gE + 0.25 * length(gE) * f;
+    vec3 wi = getWindVector(v0, time.totalTime - (1.0 - time.alpha) * time.deltaTime);
+    vec3 w = wi * (1.0 - abs(dot(normalize(wi), up)));
+
+    vec3 v1;
+    vec3 v2 = v0 + up * height + (g + w) / stiffness;
+    validateBlade(v0, up, height, v1, v2);
+
+    blade.v0 = vec4(v0, orientation);
+    blade.v1 = vec4(v1, height);
+    blade.v2 = vec4(v2, width);
+    blade.up = vec4(up, stiffness);
+    return true;
+}